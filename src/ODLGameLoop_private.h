@@ -1,28 +1,51 @@
 #ifndef ODLGAMELOOP_PRIVATE_H_
 #define ODLGAMELOOP_PRIVATE_H_
 
+#include <stdio.h>
+
 typedef struct ODLGameLoopStateStruct {
 	int desiredStateUpdatesPerSecond;
 	double desiredStateUpdateDurationMs;
 
-	double lastLoopTime;
-	double timeAccumulatedMs;
+	long long lastLoopTimeNs; // ODLGameLoop_nowNs() at the last idle call
+	double timeAccumulatedMs; // Wall time not yet simulated
+
+	int maxCatchUpSteps; // Most fixed steps run in one idle call; time beyond that is dropped
+	double interpolationAlpha; // timeAccumulatedMs / desiredStateUpdateDurationMs after the last idle call
+	int interpolate; // Draw bodies between their last two fixed step positions
+	int renderThread; // Run the fixed steps on a thread of their own and draw the frames they publish
 
 	int upsCount;
 	int fpsCount;
-	double lastMeasurementTime;
+	long long lastMeasurementTimeNs;
+	int overrunSteps; // Steps since the last measurement that took longer than one fixed step of wall time
+	int cappedFrames; // Idle calls since the last measurement that hit maxCatchUpSteps
+	double droppedMs; // Wall time since the last measurement that was never simulated
+	long long slowestStepNs; // Longest step since the last measurement
+
+	double simulatedTimeMs; // Sum of the fixed dt values handed to fixedUpdateAll
+	long stepCount;
+
+	void (*fixedUpdate)(float dt); // Runs one fixed step; Component::fixedUpdateAll when NULL
+	int stopRequested; // Set by fixedUpdate to end a headless run early (eg at the end of a replay)
 
 } ODLGameLoopState;
 
-extern ODLGameLoopState odlGameLoopState;
+inline ODLGameLoopState& odlGameLoopState(); // Loop state of the current World, see world.h
+extern FILE* statusOut; // Where run summaries are printed; stderr while frames are written to stdout
 
-// void ODLGameLoop_initOpenGL();
+// void ODLGameLoop_initOpenGL(double dtMs, int maxCatchUpSteps, int interpolate, int renderThread);
 // void ODLGameLoop_updateState();
 // void ODLGameLoop_onOpenGLIdle();
+// long ODLGameLoop_advance();
+// void ODLGameLoop_runSimulationThread();
 // void ODLGameLoop_updateGraphics();
 // void ODLGameLoop_onWindowReshape();
 // void ODLGameLoop_onKeyboard(unsigned char key, int x, int y);
 // void ODLGameLoop_updateMeasurements();
+// long long ODLGameLoop_nowNs();
+// void ODLGameLoop_runFixedUpdate(float dt);
+// void ODLGameLoop_runHeadless(long steps, double dtMs, int renderEvery);
 
 
 #endif /* ODLGAMELOOP_PRIVATE_H_ */
@@ -0,0 +1,215 @@
+#ifndef ARCHETYPE_H
+#define ARCHETYPE_H
+
+#include <vector>
+#include <tuple>
+#include <type_traits>
+#include <typeinfo>
+
+using namespace std;
+
+/* Base of every Archetype, so Component::fixedUpdateAll can run them without knowing their
+ * types. Costs one virtual call per run of instances, see Component::scheduleScripts.
+ */
+class ArchetypeBase {
+  protected:
+    static void claim( Component* c, ArchetypeBase* owner, int instance, bool lead ); // Take c off the virtual update path
+    static void release( Component* c );                                              // Put c back on it
+    static void renumber( Component* c, int instance ) {
+      c->archetypeIndex = instance;
+      Component::scriptedVersion()++;
+    }
+    static int enroll( ArchetypeBase* type );          // Register an archetype type; returns its index in registered
+    static ArchetypeBase* instancesIn( int type );     // The current World's archetype of registered[type], see world.h
+    static ArchetypeBase* owner( Component* c ) { return c->archetype; }
+    static int placeOf( Component* c ) { return c->scriptedIndex; }
+    static const list<Component*>& componentsOf( GameObject* obj ) { return obj->componentList; }
+
+  public:
+    static vector<ArchetypeBase*> registered; // An empty archetype of every type that has been used, in order of first use
+    static mutex registryLock;                // Held while registered changes, as any thread may use a new type
+    virtual ~ArchetypeBase() {}
+    virtual void updateRun( const int* run, int count, float dt ) = 0; // Run the count instances listed in run
+    virtual void fixedUpdateRun( const int* run, int count, float dt ) = 0;
+    virtual bool inPlace( int instance ) = 0;                  // Whether its scripted members follow each other in scriptedComponents, in the listed order
+    virtual void leave( int instance, Component* leaving ) = 0; // A member of an instance is being deleted
+    virtual ArchetypeBase* create() const = 0;                  // An empty archetype of the same type to keep a World's instances in
+};
+
+// Slot of a component type, BUILTIN_COMPONENT_TYPES for types without one
+template <class C> struct archetypeSlot {
+  static const int value = is_same<C, CircleRender>::value ? CIRCLE_RENDER_TYPE :
+    is_same<C, Collider>::value ? COLLIDER_TYPE :
+    is_same<C, Physics>::value ? PHYSICS_TYPE :
+    is_same<C, WallBounceScript>::value ? WALL_BOUNCE_TYPE : BUILTIN_COMPONENT_TYPES;
+};
+
+// BODY_HAS bits of the built in types among Components
+template <class... Components> struct archetypeMask {
+  static const unsigned int value = 0;
+};
+
+template <class C, class... Rest> struct archetypeMask<C, Rest...> {
+  static const unsigned int value = (archetypeSlot<C>::value < BUILTIN_COMPONENT_TYPES ? BODY_HAS( archetypeSlot<C>::value ) : 0u) |
+    archetypeMask<Rest...>::value;
+};
+
+// Position of the first type among Components without a slot, or the number of types if none
+template <class... Components> struct archetypeLead {
+  static const int value = 0;
+};
+
+template <class C, class... Rest> struct archetypeLead<C, Rest...> {
+  static const int value = archetypeSlot<C>::value == BUILTIN_COMPONENT_TYPES ? 0 : 1 + archetypeLead<Rest...>::value;
+};
+
+/* A set of component types declared as a type, eg
+ *
+ *   typedef Archetype<Physics, WallBounceScript, Collider, Gravity> FallingBall;
+ *   FallingBall::adopt( obj );
+ *
+ * Once adopted, the components of obj whose types are listed no longer have their update() and
+ * fixedUpdate() called virtually one by one. Instead the instance runs where its lead, the first
+ * listed type without a slot, is in scriptedComponents, calling the listed types' functions
+ * directly in the order they are listed, so the compiler can inline them; each object's
+ * components were found once, when it was adopted. Neighbouring instances of one archetype run
+ * in one loop. The calls are always made in the same order as without the archetype: an
+ * instance whose scripted members do not follow each other in scriptedComponents in the listed
+ * order, because they were added in another order or one was moved when a component before it
+ * was deleted, has them called virtually at their own places instead.
+ *
+ * The built in types are already updated a column at a time by the BodyStore kernels, so they
+ * get no calls in the loop; they may be listed, to be found at adoption, but at least one type
+ * without a slot must be.
+ *
+ * Objects that are not adopted keep using the virtual path, and an object leaves its
+ * archetype, going back to that path, as soon as one of its listed components is deleted.
+ */
+template <class... Components> class Archetype : public ArchetypeBase {
+  private:
+    typedef tuple<Components*...> members_t;
+    static const int MEMBERS = sizeof...( Components );
+    static const int LEAD = archetypeLead<Components...>::value;
+    static_assert( LEAD < MEMBERS, "An archetype needs a type without a built in slot; the built in types are updated by the BodyStore kernels" );
+    vector<members_t> instances;
+
+    Archetype() {}
+
+    // The first component of obj with type C, found through its slot if it has one. Only the
+    // exact type matches: C::fixedUpdate is called without going through the vtable, so a
+    // subclass overriding it must stay on the virtual path.
+    template <class C> static C* find( GameObject* obj, true_type ) { return obj->get<C>(); }
+    template <class C> static C* find( GameObject* obj, false_type ) {
+      for (Component* c: componentsOf( obj )) {
+        if (typeid( *c ) == typeid( C ) && owner( c ) == NULL) return static_cast<C*>( c );
+      }
+      return NULL;
+    }
+    template <class C> static C* find( GameObject* obj ) {
+      return find<C>( obj, integral_constant<bool, (archetypeSlot<C>::value < BUILTIN_COMPONENT_TYPES)>() );
+    }
+
+    // Calls of member I and the ones after it; types with a slot are skipped
+    template <int I> static void fixedUpdateFrom( members_t& m, float dt, true_type ) {
+      typedef typename tuple_element<I, members_t>::type pointer_t;
+      typedef typename remove_pointer<pointer_t>::type C;
+      if (archetypeSlot<C>::value == BUILTIN_COMPONENT_TYPES) get<I>( m )->C::fixedUpdate( dt );
+      fixedUpdateFrom<I + 1>( m, dt, integral_constant<bool, (I + 1 < MEMBERS)>() );
+    }
+    template <int I> static void fixedUpdateFrom( members_t& m, float dt, false_type ) {}
+    template <int I> static void updateFrom( members_t& m, float dt, true_type ) {
+      typedef typename remove_pointer<typename tuple_element<I, members_t>::type>::type C;
+      if (archetypeSlot<C>::value == BUILTIN_COMPONENT_TYPES) get<I>( m )->C::update( dt );
+      updateFrom<I + 1>( m, dt, integral_constant<bool, (I + 1 < MEMBERS)>() );
+    }
+    template <int I> static void updateFrom( members_t& m, float dt, false_type ) {}
+
+    // Every member of m as a Component*
+    static void list( members_t& m, Component** out ) { listFrom<0>( m, out, true_type() ); }
+    template <int I> static void listFrom( members_t& m, Component** out, true_type ) {
+      out[I] = get<I>( m );
+      listFrom<I + 1>( m, out, integral_constant<bool, (I + 1 < MEMBERS)>() );
+    }
+    template <int I> static void listFrom( members_t& m, Component** out, false_type ) {}
+
+  public:
+    static const unsigned int mask = archetypeMask<Components...>::value; // BODY_HAS bits of the built in types
+
+    // The instances of the current World
+    static Archetype& store() {
+      static int type = enroll( new Archetype() ); // Never deleted: registered keeps pointing at it
+      return *static_cast<Archetype*>( instancesIn( type ) );
+    }
+
+    static int size() { return (int) store().instances.size(); }
+
+    /* This function adds an object to the archetype. The object must already have a component
+     * of every listed type that is not in an archetype yet; otherwise nothing changes and false
+     * is returned. A component of a subclass of a listed type does not count. Each type may only
+     * be listed once.
+     *
+     * @param (GameObject* obj) the object
+     */
+    static bool adopt( GameObject* obj ) {
+      Archetype& a = store();
+      members_t m( find<Components>( obj )... );
+      Component* all[MEMBERS];
+      list( m, all );
+      for (int k = 0; k < MEMBERS; k++) {
+        if (all[k] == NULL || owner( all[k] ) != NULL) return false;
+        for (int j = 0; j < k; j++) if (all[j] == all[k]) return false;
+      }
+      for (int k = 0; k < MEMBERS; k++) claim( all[k], &a, (int) a.instances.size(), k == LEAD );
+      a.instances.push_back( m );
+      return true;
+    }
+
+    // The members are copied out, as a call may adopt another object and move instances
+    void updateRun( const int* run, int count, float dt ) {
+      for (int k = 0; k < count; k++) {
+        members_t m = instances[run[k]];
+        updateFrom<0>( m, dt, true_type() );
+      }
+    }
+
+    void fixedUpdateRun( const int* run, int count, float dt ) {
+      for (int k = 0; k < count; k++) {
+        members_t m = instances[run[k]];
+        fixedUpdateFrom<0>( m, dt, true_type() );
+      }
+    }
+
+    bool inPlace( int instance ) {
+      Component* all[MEMBERS];
+      list( instances[instance], all );
+      int place = placeOf( all[LEAD] );
+      for (int k = LEAD; k < MEMBERS; k++) {
+        if (placeOf( all[k] ) >= 0 && placeOf( all[k] ) != place++) return false; // Built in members have no place
+      }
+      return true;
+    }
+
+    /* This function takes an instance out when one of its members is deleted. Its other members
+     * go back to the virtual path, and the last instance moves into its place.
+     *
+     * @param (int instance) the instance
+     * @param (Component* leaving) the member being deleted
+     */
+    void leave( int instance, Component* leaving ) {
+      Component* all[MEMBERS];
+      list( instances[instance], all );
+      for (int k = 0; k < MEMBERS; k++) {
+        if (all[k] != leaving) release( all[k] );
+      }
+      if (instance + 1 != (int) instances.size()) {
+        instances[instance] = instances.back();
+        list( instances[instance], all );
+        for (int k = 0; k < MEMBERS; k++) renumber( all[k], instance );
+      }
+      instances.pop_back();
+    }
+
+    ArchetypeBase* create() const { return new Archetype(); }
+};
+
+#endif
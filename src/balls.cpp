@@ -0,0 +1,115 @@
+/*-------------------------------------------------------
+
+Implements the trigger functions, a collision handler and
+the createBall helper
+shared by the game and the benchmark.
+
+---------------------------------------------------------*/
+
+/* trigger function that will print to the terminal when called
+ *
+ * @param (Collider* c1) first collider involved in collision
+ * @param (Collider* cc) first second involved in collision
+*/
+void printOnCollide(Collider* c1, Collider* c2){
+  printf("collide");
+}
+
+/* trigger function that will freeze the colliding balls and change their colors when called
+ *
+ * @param (Collider* c1) first collider involved in collision
+ * @param (Collider* cc) first second involved in collision
+*/
+void freezeTag(Collider* c1, Collider* c2){
+  // Freeze both objects
+  Physics* p1 = c1->parent->get<Physics>();
+  Physics* p2 = c2->parent->get<Physics>();
+  p1->dx = 0;
+  p1->dy = 0;
+  p2->dx = 0;
+  p2->dy = 0;
+
+  // Change their color to red
+  CircleRender* cr1 = c1->parent->get<CircleRender>();
+  CircleRender* cr2 = c2->parent->get<CircleRender>();
+  cr1->setColor(1, 0, 0);
+  cr2->setColor(1, 0, 0);
+}
+
+/* trigger function that cause the balls to "bounce" when called
+ *
+ * @param (Collider* c1) first collider involved in collision
+ * @param (Collider* cc) first second involved in collision
+*/
+void Bounce(Collider* c1, Collider* c2, float dt){
+  // Work on the rows of both balls so the math stays in the precision of the build
+  int a = c1->parent->body;
+  int b = c2->parent->body;
+  scalar_t m1 = bodyStore().mass[a];
+  scalar_t m2 = bodyStore().mass[b];
+  scalar_t two = toScalar(2);
+  scalar_t step = toScalar(dt);
+
+  // Calculate new velocities. The mass ratios are taken first so fixed point never multiplies
+  // two tiny values together
+  scalar_t keep1 = (m1 - m2) / (m1 + m2);
+  scalar_t keep2 = (m2 - m1) / (m1 + m2);
+  scalar_t from2 = two * m2 / (m1 + m2);
+  scalar_t from1 = two * m1 / (m1 + m2);
+  scalar_t newv1x = bodyStore().dx[a] * keep1 + bodyStore().dx[b] * from2;
+  scalar_t newv1y = bodyStore().dy[a] * keep1 + bodyStore().dy[b] * from2;
+
+  scalar_t newv2x = bodyStore().dx[b] * keep2 + bodyStore().dx[a] * from1;
+  scalar_t newv2y = bodyStore().dy[b] * keep2 + bodyStore().dy[a] * from1;
+
+    // Assign velocities
+    bodyStore().dx[a] = newv1x;
+    bodyStore().dy[a] = newv1y;
+
+    bodyStore().dx[b] = newv2x;
+    bodyStore().dy[b] = newv2y;
+
+    // Back the balls off by one step of their new velocities so that collision does not register twice
+    bodyStore().x[a] += newv1x * step;
+    bodyStore().y[a] += newv1y * step;
+
+    bodyStore().x[b] += newv2x * step;
+    bodyStore().y[b] += newv2y * step;
+}
+
+long collisionsEntered = 0; // Pairs that started touching, counted by countCollisions
+long collisionsExited = 0;  // Pairs that stopped touching
+
+/* collision handler that counts the pairs that start and stop touching
+ *
+ * @param (const contact_t* events) the collision events of the step
+ * @param (int count) the number of events
+ * @param (float dt) the fixed step in milliseconds
+*/
+void countCollisions(const contact_t* events, int count, float dt){
+  for (int k = 0; k < count; k++) {
+    if (events[k].phase == COLLISION_ENTER) collisionsEntered++;
+    else if (events[k].phase == COLLISION_EXIT) collisionsExited++;
+  }
+}
+
+/* Creates a ball GameObject and associated components
+ *
+ * @param (double x) the starting x position of the ball
+ * @param (double y) the starting y position of the ball
+ * @param (double dx) the starting x speed of the ball
+ * @param (double dy) the starting y speed of the ball
+ * @param (double radius) the starting radius of the ball
+*/
+GameObject* createBall(double x, double y, double dx, double dy, double radius) {
+  GameObject* obj = new GameObject(x, y);
+  CircleRender* circleRender = new CircleRender(obj, radius);
+  Collider* collider = new Collider(obj, radius);
+  Physics* physics = new Physics(obj, dx, dy);
+  WallBounceScript* wallBounceScript = new WallBounceScript(obj, radius);
+  collider->addTrigger(Bounce);
+  // The area in the build's precision, so the mass does not depend on the math library
+  scalar_t r = toScalar(radius);
+  bodyStore().mass[obj->body] = toScalar(PI) * r * r;
+  return obj;
+}
@@ -0,0 +1,338 @@
+/*-------------------------------------------------------
+
+Headless benchmark of the simulation hot paths. Runs a
+set of standard scenes at several sizes and prints the
+cost of integration, collision and rendering as JSON.
+
+Build with "make bench" and run bin/bench. Build with
+"make -B bench PRECISION=float" or "PRECISION=fixed" to
+compare the precisions of src/scalar.h.
+
+---------------------------------------------------------*/
+
+#include "components.h"
+#include "components.cpp"
+#include "gameloop.cpp"
+#include "balls.cpp"
+#include <string.h>
+
+// One row of the JSON report
+struct benchResult_t {
+  const char* scene;
+  int balls;
+  long steps;
+  double integrateSeconds;
+  long integratePeakKb;
+  double collideSeconds;
+  long collidePeakKb;
+  long pairTests;
+  long contacts;
+  int sleeping;
+  double energyDrift;
+  unsigned long long stateHash;
+  long frames;
+  double renderSeconds;
+  long renderPeakKb;
+};
+
+/* This function returns a random number between two values
+ *
+ * @param (double low) the smallest value
+ * @param (double high) the largest value
+ */
+static double benchRandom(double low, double high) {
+  return low + (high - low) * (rand() / (double) RAND_MAX);
+}
+
+/* This function fills the world with a scene. All scenes are seeded the same way, so every
+ * run of the benchmark simulates the same balls.
+ *
+ *   gas:     balls spread evenly over the box, covering 5% of it
+ *   cluster: balls packed in a disk of radius 0.2, covering 40% of it
+ *   mixed:   like gas, with radii spread over a factor of 10
+ *   frozen:  like gas, with 95% of the balls at rest
+ *
+ * @param (const char* scene) one of the names above
+ * @param (int balls) the number of balls to create
+ */
+static bool buildScene(const char* scene, int balls) {
+  srand(12345);
+  double speed = .0004;
+  if (strcmp(scene, "gas") == 0 || strcmp(scene, "frozen") == 0) {
+    double radius = sqrt(.05 * 4 / (PI * balls));
+    bool frozen = scene[0] == 'f';
+    for (int i = 0; i < balls; i++) {
+      double s = frozen && i % 20 != 0 ? 0 : speed;
+      createBall(benchRandom(-1 + radius, 1 - radius), benchRandom(-1 + radius, 1 - radius),
+        benchRandom(-s, s), benchRandom(-s, s), radius);
+    }
+  } else if (strcmp(scene, "cluster") == 0) {
+    double radius = .2 * sqrt(.4 / balls);
+    for (int i = 0; i < balls; i++) {
+      double angle = benchRandom(0, 2 * PI);
+      double distance = .2 * sqrt(benchRandom(0, 1));
+      createBall(distance * cos(angle), distance * sin(angle), benchRandom(-speed, speed), benchRandom(-speed, speed), radius);
+    }
+  } else if (strcmp(scene, "mixed") == 0) {
+    // Log uniform radii from r to 10r; the mean area of such a ball is pi r^2 * 99 / (2 ln 10)
+    double radius = sqrt(.05 * 4 / (PI * balls * 99 / (2 * log(10.0))));
+    for (int i = 0; i < balls; i++) {
+      double r = radius * pow(10, benchRandom(0, 1));
+      createBall(benchRandom(-1 + r, 1 - r), benchRandom(-1 + r, 1 - r), benchRandom(-speed, speed), benchRandom(-speed, speed), r);
+    }
+  } else {
+    return false;
+  }
+  return true;
+}
+
+/* This function removes every object from the world
+ */
+static void clearWorld() {
+  for (int i = bodyStore().size() - 1; i >= 0; i--) bodyStore().removeLater(i);
+  Component::removeDestroyed();
+}
+
+/* This function returns the kinetic energy of every ball, in double whatever the precision
+ */
+static double kineticEnergy() {
+  double energy = 0;
+  for (int i = 0; i < bodyStore().size(); i++) {
+    double dx = bodyStore().dx[i];
+    double dy = bodyStore().dy[i];
+    energy += .5 * bodyStore().mass[i] * (dx * dx + dy * dy);
+  }
+  return energy;
+}
+
+/* This function returns a 64 bit FNV-1a hash of the positions and velocities as they are
+ * stored, so two runs with the same step count can be checked for bit-identical results
+ */
+static unsigned long long stateHash() {
+  unsigned long long hash = 14695981039346656037ull;
+  const BodyColumn<scalar_t>* columns[4] = {&bodyStore().x, &bodyStore().y, &bodyStore().dx, &bodyStore().dy};
+  for (int c = 0; c < 4; c++) {
+    const unsigned char* bytes = (const unsigned char*) columns[c]->data();
+    for (size_t b = 0; b < sizeof(scalar_t) * bodyStore().size(); b++) hash = (hash ^ bytes[b]) * 1099511628211ull;
+  }
+  return hash;
+}
+
+/* This function resets the peak resident set size of the process, so the next peakRssKb()
+ * only covers what runs after it. Kernels older than Linux 4.0 ignore this, and the peak then
+ * covers the whole run.
+ */
+static void resetPeakRss() {
+  FILE* refs = fopen("/proc/self/clear_refs", "w");
+  if (refs == NULL) return;
+  fputs("5", refs);
+  fclose(refs);
+}
+
+/* This function returns the peak resident set size of the process in kilobytes
+ */
+static long peakRssKb() {
+  FILE* status = fopen("/proc/self/status", "r");
+  if (status == NULL) return -1;
+  char line[256];
+  long kb = -1;
+  while (fgets(line, sizeof(line), status) != NULL) {
+    if (strncmp(line, "VmHWM:", 6) == 0) kb = atol(line + 6);
+  }
+  fclose(status);
+  return kb;
+}
+
+/* This function returns the seconds elapsed since a time point
+ *
+ * @param (chrono::steady_clock::time_point start) the time point
+ */
+static double secondsSince(chrono::steady_clock::time_point start) {
+  return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+/* This function runs one scene. The phases of fixedUpdateAll are timed one by one, stepping
+ * until the time budget is used or the step limit is reached; then the same number of frames
+ * is rendered with the software backend.
+ *
+ * @param (const char* scene) the scene name
+ * @param (int balls) the number of balls
+ * @param (double budgetSeconds) the time after which no new step is started
+ * @param (long minSteps) the fewest steps to run
+ * @param (long maxSteps) the most steps to run
+ * @param (SoftwareRenderBackend* backend) the renderer, or NULL to skip rendering
+ */
+static benchResult_t runScene(const char* scene, int balls, double budgetSeconds, long minSteps, long maxSteps, SoftwareRenderBackend* backend) {
+  benchResult_t result;
+  memset(&result, 0, sizeof(result));
+  result.scene = scene;
+  result.balls = balls;
+  buildScene(scene, balls);
+
+  // One untimed step, so first time allocations are not counted, or with sleeping on enough
+  // for the resting balls to fall asleep
+  float dt = (float) DESIRED_STATE_UPDATE_DURATION_MS;
+  long warmup = sleepSettings().enabled ? (long) ceil(sleepSettings().delayMs / dt) + 1 : 1;
+  for (long i = 0; i < warmup; i++) Component::fixedUpdateAll(dt);
+  result.sleeping = sleepingBodies();
+  double startEnergy = kineticEnergy();
+
+  long integratePeak = 0, collidePeak = 0;
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  while (result.steps < maxSteps && (result.steps < minSteps || secondsSince(start) < budgetSeconds)) {
+    resetPeakRss();
+    chrono::steady_clock::time_point phase = chrono::steady_clock::now();
+    bodyStore().integrateAll(dt);
+    result.integrateSeconds += secondsSince(phase);
+    integratePeak = max(integratePeak, peakRssKb());
+
+    resetPeakRss();
+    phase = chrono::steady_clock::now();
+    Collider::updateBroadphase();
+    Collider::generateContacts();
+    Collider::resolveContacts(dt);
+    updateSleep(dt);
+    result.collideSeconds += secondsSince(phase);
+    collidePeak = max(collidePeak, peakRssKb());
+    result.pairTests += Collider::pairTests();
+    result.contacts += Collider::contacts().size();
+    result.steps++;
+  }
+  result.integratePeakKb = integratePeak;
+  result.collidePeakKb = collidePeak;
+  result.energyDrift = startEnergy > 0 ? kineticEnergy() / startEnergy - 1 : 0;
+  result.stateHash = stateHash();
+
+  if (backend != NULL) {
+    resetPeakRss();
+    for (long f = 0; f < result.steps; f++) {
+      chrono::steady_clock::time_point phase = chrono::steady_clock::now();
+      backend->drawCircles(bodyStore());
+      backend->endFrame();
+      result.renderSeconds += secondsSince(phase);
+      result.frames++;
+    }
+    result.renderPeakKb = peakRssKb();
+  }
+
+  clearWorld();
+  return result;
+}
+
+/* This function prints one scene result as a JSON object
+ *
+ * @param (FILE* out) where to print
+ * @param (const benchResult_t& r) the result
+ * @param (bool last) whether this is the last result of the list
+ */
+static void printResult(FILE* out, const benchResult_t& r, bool last) {
+  double bodySteps = (double) r.balls * r.steps;
+  fprintf(out, "    {\"scene\": \"%s\", \"balls\": %d, \"sleeping\": %d, \"steps\": %ld,\n", r.scene, r.balls, r.sleeping, r.steps);
+  fprintf(out, "     \"energy_drift\": %.3e, \"state_hash\": \"%016llx\",\n", r.energyDrift, r.stateHash);
+  fprintf(out, "     \"integrate\": {\"ns_per_body_step\": %.3f, \"peak_rss_kb\": %ld},\n",
+    bodySteps > 0 ? r.integrateSeconds * 1e9 / bodySteps : 0, r.integratePeakKb);
+  fprintf(out, "     \"collide\": {\"ns_per_body_step\": %.3f, \"pair_tests_per_sec\": %.0f, \"contacts_per_sec\": %.0f, "
+    "\"pair_tests_per_step\": %.1f, \"contacts_per_step\": %.1f, \"peak_rss_kb\": %ld},\n",
+    bodySteps > 0 ? r.collideSeconds * 1e9 / bodySteps : 0,
+    r.collideSeconds > 0 ? r.pairTests / r.collideSeconds : 0, r.collideSeconds > 0 ? r.contacts / r.collideSeconds : 0,
+    r.steps > 0 ? (double) r.pairTests / r.steps : 0, r.steps > 0 ? (double) r.contacts / r.steps : 0, r.collidePeakKb);
+  double bodyFrames = (double) r.balls * r.frames;
+  fprintf(out, "     \"render\": {\"frames\": %ld, \"ns_per_body_frame\": %.3f, \"frames_per_sec\": %.1f, \"peak_rss_kb\": %ld}}%s\n",
+    r.frames, bodyFrames > 0 ? r.renderSeconds * 1e9 / bodyFrames : 0,
+    r.renderSeconds > 0 ? r.frames / r.renderSeconds : 0, r.renderPeakKb, last ? "" : ",");
+}
+
+/* This function splits a comma separated list
+ *
+ * @param (const char* text) the list
+ */
+static vector<string> splitList(const char* text) {
+  vector<string> items;
+  string item;
+  for (const char* c = text; ; c++) {
+    if (*c == ',' || *c == 0) {
+      if (!item.empty()) items.push_back(item);
+      item.clear();
+      if (*c == 0) break;
+    } else {
+      item += *c;
+    }
+  }
+  return items;
+}
+
+/* Runs every scene at every size and prints the results as JSON
+ *
+ * "--scenes <list>" and "--sizes <list>" pick the scenes and ball counts (comma separated).
+ * Each scene steps for about "--seconds <s>" of wall time, at least "--min-steps <n>" and at
+ * most "--max-steps <n>" steps. "--threads <n>" and "--kernel <name>" work as in BallBouncer,
+ * "--size <w>x<h>" sets the render size and "--no-render" skips rendering. "--sleep" lets
+ * resting balls fall asleep before timing starts. "--out <file>" writes the JSON to a file
+ * instead of stdout.
+*/
+int main(int argc, char** argv) {
+  vector<string> scenes = splitList("gas,cluster,mixed,frozen");
+  vector<string> sizes = splitList("1000,10000,100000,1000000");
+  double budgetSeconds = 1;
+  long minSteps = 2;
+  long maxSteps = 200;
+  int threads = thread::hardware_concurrency();
+  int frameWidth = VIEW_WIDTH;
+  int frameHeight = VIEW_HEIGHT;
+  bool render = true;
+  const char* outPath = NULL;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--scenes") == 0 && i + 1 < argc) scenes = splitList(argv[++i]);
+    else if (strcmp(argv[i], "--sizes") == 0 && i + 1 < argc) sizes = splitList(argv[++i]);
+    else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) budgetSeconds = atof(argv[++i]);
+    else if (strcmp(argv[i], "--min-steps") == 0 && i + 1 < argc) minSteps = atol(argv[++i]);
+    else if (strcmp(argv[i], "--max-steps") == 0 && i + 1 < argc) maxSteps = atol(argv[++i]);
+    else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) threads = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--kernel") == 0 && i + 1 < argc) {
+      if (!selectStepKernel(argv[++i])) {
+        fprintf(stderr, "kernel %s is unknown or not supported by this CPU\n", argv[i]);
+        return 1;
+      }
+    }
+    else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc) sscanf(argv[++i], "%dx%d", &frameWidth, &frameHeight);
+    else if (strcmp(argv[i], "--no-render") == 0) render = false;
+    else if (strcmp(argv[i], "--sleep") == 0) sleepSettings().enabled = true;
+    else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) outPath = argv[++i];
+    else {
+      fprintf(stderr, "usage: %s [--scenes gas,cluster,mixed,frozen] [--sizes 1000,10000,...] [--seconds <s>]\n"
+        "          [--min-steps <n>] [--max-steps <n>] [--threads <n>] [--kernel <name>] [--size <w>x<h>]\n"
+        "          [--no-render] [--sleep] [--out <file>]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  if (threads > 1) jobPool.start(threads);
+  SoftwareRenderBackend* backend = render ? new SoftwareRenderBackend(frameWidth, frameHeight) : NULL;
+
+  FILE* out = outPath != NULL ? fopen(outPath, "w") : stdout;
+  if (out == NULL) {
+    fprintf(stderr, "could not create %s\n", outPath);
+    return 1;
+  }
+  fprintf(out, "{\n  \"benchmark\": \"BallBouncer\",\n  \"format\": 1,\n  \"precision\": \"%s\",\n  \"scalar_bytes\": %d,\n"
+    "  \"kernel\": \"%s\",\n  \"threads\": %d,\n  \"render_size\": [%d, %d],\n  \"results\": [\n",
+    SCALAR_NAME, (int) sizeof(scalar_t), activeStepKernel.name, max(threads, 1), frameWidth, frameHeight);
+  for (size_t s = 0; s < scenes.size(); s++) {
+    for (size_t n = 0; n < sizes.size(); n++) {
+      const char* scene = scenes[s].c_str();
+      int balls = atoi(sizes[n].c_str());
+      if (!buildScene(scene, 0)) {
+        fprintf(stderr, "unknown scene %s\n", scene);
+        return 1;
+      }
+      fprintf(stderr, "%s %d...\n", scene, balls);
+      benchResult_t result = runScene(scene, balls, budgetSeconds, minSteps, maxSteps, backend);
+      printResult(out, result, s + 1 == scenes.size() && n + 1 == sizes.size());
+      fflush(out);
+    }
+  }
+  fprintf(out, "  ]\n}\n");
+  if (out != stdout) fclose(out);
+  delete backend;
+  return 0;
+}
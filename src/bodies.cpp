@@ -0,0 +1,280 @@
+/*-------------------------------------------------------
+
+Implements the packed body storage and the update kernels
+for the built in components.
+
+---------------------------------------------------------*/
+
+#include "components.h"
+#include "kernels.h"
+#include <math.h>
+#include <algorithm>
+#include <unordered_map>
+#include <limits.h>
+
+/*Begin BodyStore-------------------------------------------------------*/
+
+/* This function makes room for a number of rows in every column, so adding that many bodies
+ * never copies a column.
+ *
+ * @param (int rows) the total number of rows to make room for
+ */
+void BodyStore::reserve( int rows ) {
+  objects.reserve( rows );
+  mask.reserve( rows );
+  x.reserve( rows );
+  y.reserve( rows );
+  dx.reserve( rows );
+  dy.reserve( rows );
+  mass.reserve( rows );
+  colliderRadius.reserve( rows );
+  wallRadius.reserve( rows );
+  renderRadius.reserve( rows );
+  color.reserve( rows );
+  triggerSet.reserve( rows );
+  restMs.reserve( rows );
+  island.reserve( rows );
+}
+
+/* This function appends a row for a new GameObject. Component columns get the same defaults
+ * as the component constructors until a component is attached.
+ *
+ * @param (GameObject* obj) the owner of the new row
+ */
+int BodyStore::add( GameObject* obj ) {
+  color_t blue = { 0, 0, 1 };
+  objects.push_back( obj );
+  mask.push_back( 0 );
+  x.push_back( toScalar( 0 ) );
+  y.push_back( toScalar( 0 ) );
+  dx.push_back( toScalar( 0 ) );
+  dy.push_back( toScalar( 0 ) );
+  mass.push_back( toScalar( 1 ) );
+  colliderRadius.push_back( toScalar( 0 ) );
+  wallRadius.push_back( toScalar( 0 ) );
+  renderRadius.push_back( toScalar( 0 ) );
+  color.push_back( blue );
+  triggerSet.push_back( 0 );
+  restMs.push_back( 0 );
+  island.push_back( 0 );
+  return size() - 1;
+}
+
+/* This function returns the GameObject that owns a row. Rows restored from a snapshot or bulk
+ * loaded from a scene start without one; the first call creates the GameObject and the built in
+ * components its mask names, bound to the existing values. Not thread safe when
+ * the object does not exist yet.
+ *
+ * @param (int i) the row
+ */
+GameObject* BodyStore::object( int i ) {
+  if (objects[i] != NULL) return objects[i];
+  unsigned int has = mask[i];
+  color_t restored = color[i];
+  GameObject* obj = new GameObject( i );
+  if (has & BODY_HAS( CIRCLE_RENDER_TYPE )) {
+    CircleRender* circle = new CircleRender( obj, renderRadius[i] );
+    circle->setColor( restored.R, restored.G, restored.B );
+  }
+  if (has & BODY_HAS( COLLIDER_TYPE )) new Collider( obj, colliderRadius[i] );
+  if (has & BODY_HAS( PHYSICS_TYPE )) new Physics( obj, dx[i], dy[i], mass[i] );
+  if (has & BODY_HAS( WALL_BOUNCE_TYPE )) new WallBounceScript( obj, wallRadius[i] );
+  return obj;
+}
+
+/* This function queues a row for removal. Its mask is cleared right away, so the body is no
+ * longer moved, collided or drawn, but the row keeps its index until removeQueued() runs at
+ * the start of the next fixed step. Queuing a row twice is harmless.
+ *
+ * @param (int i) the row to remove
+ */
+void BodyStore::removeLater( int i ) {
+  lock_guard<mutex> hold( removeLock );
+  mask[i] = 0;
+  removeQueue.push_back( i );
+}
+
+/* This function copies every column of one row over another and hands the row's GameObject
+ * its new index.
+ *
+ * @param (int from) the row to move
+ * @param (int to) the row to overwrite
+ */
+void BodyStore::moveRow( int from, int to ) {
+  objects[to] = objects[from];
+  if (objects[to] != NULL) objects[to]->body = to;
+  mask[to] = mask[from];
+  x[to] = x[from];
+  y[to] = y[from];
+  dx[to] = dx[from];
+  dy[to] = dy[from];
+  mass[to] = mass[from];
+  colliderRadius[to] = colliderRadius[from];
+  wallRadius[to] = wallRadius[from];
+  renderRadius[to] = renderRadius[from];
+  color[to] = color[from];
+  triggerSet[to] = triggerSet[from];
+  restMs[to] = restMs[from];
+  island[to] = island[from];
+}
+
+/* This function removes every queued row by moving the last row into its place, and deletes
+ * the GameObjects and components of the removed rows. Rows are removed from the highest down,
+ * so a row that is moved is never one still waiting to be removed. Each removal costs the
+ * same no matter how many rows there are. Where every affected row went is added to renamed,
+ * which keeps the rows from before the first call since it was last cleared, so a call that
+ * removes nothing or a second call before the reader has looked loses no moves.
+ */
+void BodyStore::removeQueued() {
+  if (removeQueue.empty()) return;
+  sort( removeQueue.begin(), removeQueue.end(), greater<int>() );
+  removeQueue.erase( unique( removeQueue.begin(), removeQueue.end() ), removeQueue.end() );
+  // Row in renamed's terms of the body now in each row moved into, -1 for a body added since
+  // renamed was cleared. A row listed in renamed that nothing was moved into holds such a body.
+  unordered_map<int, int> origin;
+  for (const pair<int, int>& entry: renamed) {
+    if (entry.second >= 0) origin[entry.second] = entry.first;
+  }
+  size_t earlier = renamed.size(); // The entries of earlier calls, sorted by old row
+  auto originOf = [&]( int row ) {
+    unordered_map<int, int>::iterator found = origin.find( row );
+    if (found != origin.end()) return found->second;
+    vector< pair<int, int> >::iterator end = renamed.begin() + earlier;
+    vector< pair<int, int> >::iterator listed = lower_bound( renamed.begin(), end, make_pair( row, INT_MIN ) );
+    return listed != end && listed->first == row ? -1 : row;
+  };
+  for (int i: removeQueue) {
+    GameObject* removed = objects[i];
+    int last = size() - 1;
+    int gone = originOf( i );
+    if (gone >= 0) renamed.push_back( make_pair( gone, -1 ) );
+    if (i != last) {
+      int kept = originOf( last );
+      moveRow( last, i );
+      origin[i] = kept;
+      if (kept >= 0) renamed.push_back( make_pair( kept, i ) );
+    }
+    objects.pop_back();
+    mask.pop_back();
+    x.pop_back();
+    y.pop_back();
+    dx.pop_back();
+    dy.pop_back();
+    mass.pop_back();
+    colliderRadius.pop_back();
+    wallRadius.pop_back();
+    renderRadius.pop_back();
+    color.pop_back();
+    triggerSet.pop_back();
+    restMs.pop_back();
+    island.pop_back();
+    delete removed;
+  }
+  removeQueue.clear();
+  version++;
+
+  // A row moved more than once, by this call or an earlier one, is listed once per move; keep the last
+  stable_sort( renamed.begin(), renamed.end(), []( const pair<int, int>& a, const pair<int, int>& b ) { return a.first < b.first; } );
+  vector< pair<int, int> > last;
+  for (const pair<int, int>& entry: renamed) {
+    if (!last.empty() && last.back().first == entry.first) last.back() = entry;
+    else last.push_back( entry );
+  }
+  renamed.swap( last );
+}
+
+/* This function returns the row a body that was in the given row when renamed was last
+ * cleared is in now, or -1 if a removeQueued() since then removed it.
+ *
+ * @param (int row) the row when renamed was last cleared
+ */
+int BodyStore::renamedRow( int row ) const {
+  vector< pair<int, int> >::const_iterator found = lower_bound( renamed.begin(), renamed.end(), make_pair( row, INT_MIN ) );
+  return found != renamed.end() && found->first == row ? found->second : row;
+}
+
+/* This function moves every awake body with a Physics component by its velocity.
+ *
+ * @param (int begin) first row to update
+ * @param (int end) one past the last row to update
+ * @param (double dt) The elapsed time since the last fixedUpdate in milliseconds
+ */
+void BodyStore::integrate( int begin, int end, double dt ) {
+  scalar_t step = toScalar( dt );
+  for (int i = begin; i < end; i++) {
+    if ((mask[i] & (BODY_HAS( PHYSICS_TYPE ) | BODY_SLEEPING)) != BODY_HAS( PHYSICS_TYPE )) continue;
+    x[i] += dx[i] * step;
+    y[i] += dy[i] * step;
+  }
+}
+
+/* This function points the velocity of every awake body with both a WallBounceScript and a
+ * Physics component away from any of the +-1 walls it is touching.
+ *
+ * @param (int begin) first row to update
+ * @param (int end) one past the last row to update
+ */
+void BodyStore::bounceWalls( int begin, int end ) {
+  const unsigned int needed = BODY_HAS( WALL_BOUNCE_TYPE ) | BODY_HAS( PHYSICS_TYPE );
+  const scalar_t one = toScalar( 1 );
+  for (int i = begin; i < end; i++) {
+    if ((mask[i] & (needed | BODY_SLEEPING)) != needed) continue;
+    scalar_t r = wallRadius[i];
+    if (x[i] + r >= one) dx[i] = -scalarAbs( dx[i] );
+    if (x[i] - r <= -one) dx[i] = scalarAbs( dx[i] );
+    if (y[i] + r >= one) dy[i] = -scalarAbs( dy[i] );
+    if (y[i] - r <= -one) dy[i] = scalarAbs( dy[i] );
+  }
+}
+
+/* This function runs integrate() and then bounceWalls() on every row in a single pass,
+ * using the SIMD kernel chosen by selectStepKernel. The result is bit-identical to calling
+ * the two functions separately.
+ *
+ * @param (int begin) first row to update
+ * @param (int end) one past the last row to update
+ * @param (double dt) The elapsed time since the last fixedUpdate in milliseconds
+ */
+void BodyStore::integrateAndBounce( int begin, int end, double dt ) {
+  activeStepKernel.kernel( x.data(), y.data(), dx.data(), dy.data(), wallRadius.data(),
+    mask.data(), begin, end, dt );
+}
+
+/* This function runs integrateAndBounce over every row on jobPool. The SIMD kernels skip
+ * sleeping rows almost for free, so only when most bodies sleep are the rows of awakeRows()
+ * visited one by one instead; the result is the same either way.
+ *
+ * @param (double dt) The elapsed time since the last fixedUpdate in milliseconds
+ */
+void BodyStore::integrateAll( double dt ) {
+  const vector<int>& rows = awakeRows(); // Of bodyStore(), the current world's store, the only one that is ever stepped
+  if ((int) rows.size() * 2 > size()) {
+    jobPool.parallelFor( size(), 16384, [this, dt]( int begin, int end ) {
+      PROFILE_SCOPE( "integrate chunk" );
+      integrateAndBounce( begin, end, dt );
+    });
+    return;
+  }
+  jobPool.parallelFor( (int) rows.size(), 4096, [this, &rows, dt]( int begin, int end ) {
+    PROFILE_SCOPE( "integrate chunk" );
+    const unsigned int physics = BODY_HAS( PHYSICS_TYPE );
+    const unsigned int wall = BODY_HAS( WALL_BOUNCE_TYPE );
+    const scalar_t step = toScalar( dt );
+    const scalar_t one = toScalar( 1 );
+    for (int k = begin; k < end; k++) {
+      // Same steps as integrate() and bounceWalls(), which every kernel matches bit for bit
+      int i = rows[k];
+      if (!(mask[i] & physics)) continue;
+      x[i] += dx[i] * step;
+      y[i] += dy[i] * step;
+      if (!(mask[i] & wall)) continue;
+      scalar_t r = wallRadius[i];
+      if (x[i] + r >= one) dx[i] = -scalarAbs( dx[i] );
+      if (x[i] - r <= -one) dx[i] = scalarAbs( dx[i] );
+      if (y[i] + r >= one) dy[i] = -scalarAbs( dy[i] );
+      if (y[i] - r <= -one) dy[i] = scalarAbs( dy[i] );
+    }
+  });
+}
+
+/*End BodyStore-------------------------------------------------------*/
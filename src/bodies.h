@@ -0,0 +1,203 @@
+#ifndef BODIES_H
+#define BODIES_H
+
+#include <vector>
+#include <mutex>
+#include <new>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "profile.h"
+#include "scalar.h"
+
+using namespace std;
+
+class GameObject;
+
+struct color_t {
+  float R;
+  float G;
+  float B;
+};
+
+/* A growable array of plain values, used for the BodyStore columns. Unlike a vector it can also
+ * point at memory it does not own, such as a mapped snapshot, so a restored world simulates
+ * straight from the file's pages. The first push_back() after adopt() copies the values into
+ * memory of its own.
+ */
+template <class T> class BodyColumn {
+  private:
+    T* items;
+    size_t count;
+    size_t capacity;
+    bool owned;  // False while items points into memory adopted from elsewhere
+    BodyColumn( const BodyColumn& );
+
+    void resize( size_t wanted ) {
+      if (wanted > SIZE_MAX / sizeof( T )) throw bad_alloc();
+      T* copy = (T*) malloc( wanted * sizeof( T ) );
+      if (copy == NULL && wanted > 0) throw bad_alloc();
+      if (count > 0) memcpy( copy, items, count * sizeof( T ) );
+      if (owned) free( items );
+      items = copy;
+      capacity = wanted;
+      owned = true;
+    }
+
+  public:
+    BodyColumn() : items( NULL ), count( 0 ), capacity( 0 ), owned( true ) {}
+    ~BodyColumn() { if (owned) free( items ); }
+    T& operator[]( size_t i ) { return items[i]; }
+    const T& operator[]( size_t i ) const { return items[i]; }
+    T* data() { return items; }
+    const T* data() const { return items; }
+    size_t size() const { return count; }
+    void reserve( size_t wanted ) { if (wanted > capacity) resize( wanted ); } // Make room for wanted values without growing again
+    void push_back( const T& value ) {
+      if (count == capacity) resize( capacity < 16 ? 16 : capacity * 2 );
+      items[count++] = value;
+    }
+    void pop_back() { count--; }
+    void assign( const T* values, size_t n ) { // Replace the contents with a copy of n values
+      count = 0;
+      if (n > capacity || !owned) resize( n );
+      if (n > 0) memcpy( items, values, n * sizeof( T ) );
+      count = n;
+    }
+    void adopt( T* external, size_t n ) { // Use n values at external, which must outlive this column or the next push_back()
+      if (owned) free( items );
+      items = external;
+      count = capacity = n;
+      owned = false;
+    }
+};
+
+#define ARENA_BLOCK_BYTES ( 1 << 20 )
+
+/* Hands out memory from large blocks for objects that live as long as the world, so creating
+ * many small objects costs a pointer bump each instead of a call to the allocator.
+ */
+class ObjectArena {
+  private:
+    vector<char*> blocks;
+    size_t used; // Bytes taken from the last block
+    ObjectArena( const ObjectArena& );
+
+  public:
+    ObjectArena() : used( 0 ) {}
+    ~ObjectArena() { for (char* block: blocks) free( block ); }
+    void* allocate( size_t bytes ) {
+      bytes = (bytes + 15) & ~(size_t) 15;
+      if (blocks.empty() || used + bytes > ARENA_BLOCK_BYTES) {
+        blocks.push_back( (char*) malloc( bytes > ARENA_BLOCK_BYTES ? bytes : ARENA_BLOCK_BYTES ) );
+        used = 0;
+      }
+      void* at = blocks.back() + used;
+      used += bytes;
+      return at;
+    }
+};
+
+/* Recycles the memory of deleted objects. Freed blocks go on a free list per 16 byte size
+ * class and are handed out again before any new memory is taken from the arena, so spawning
+ * and despawning at a steady rate stops calling the allocator once the lists have filled.
+ * Not thread safe.
+ */
+class ObjectPool {
+  private:
+    ObjectArena arena;
+    vector< vector<void*> > freeLists; // Free blocks of 16 * i bytes in freeLists[i]
+
+  public:
+    void* allocate( size_t bytes ) {
+      PROFILE_COUNT( PROFILE_ALLOCATIONS, 1 );
+      size_t sizeClass = (bytes + 15) / 16;
+      if (sizeClass < freeLists.size() && !freeLists[sizeClass].empty()) {
+        void* recycled = freeLists[sizeClass].back();
+        freeLists[sizeClass].pop_back();
+        return recycled;
+      }
+      return arena.allocate( sizeClass * 16 );
+    }
+    void release( void* block, size_t bytes ) {
+      size_t sizeClass = (bytes + 15) / 16;
+      if (sizeClass >= freeLists.size()) freeLists.resize( sizeClass + 1 );
+      freeLists[sizeClass].push_back( block );
+    }
+};
+
+// Bit set in BodyStore::mask when a body has the built in component with that typeId
+#define BODY_HAS( typeId ) ( 1u << ( typeId ) )
+#define BODY_SLEEPING ( 1u << 31 ) // Set in BodyStore::mask while a body sleeps, see sleep.h
+
+/* Structure of arrays holding the hot state of every GameObject and its built in components.
+ * Row i belongs to the GameObject whose body field is i. Each column is a densely packed
+ * array, so the per-type update kernels walk memory linearly instead of chasing pointers.
+ *
+ * Removing a row moves the last row into its place, so rows of other bodies can change at
+ * step boundaries; the GameObject's body field always follows its row.
+ */
+class BodyStore {
+  private:
+    vector<int> removeQueue;             // Rows to remove at the next step boundary
+    mutex removeLock;
+    void moveRow( int from, int to );
+
+  public:
+    vector<GameObject*> objects;         // Owner of each row; NULL until object() creates it for restored rows
+    BodyColumn<unsigned int> mask;       // BODY_HAS bits of the built in components attached to each row
+
+    BodyColumn<scalar_t> x;              // GameObject position
+    BodyColumn<scalar_t> y;
+    BodyColumn<scalar_t> dx;             // Physics velocity
+    BodyColumn<scalar_t> dy;
+    BodyColumn<scalar_t> mass;           // Physics mass
+    BodyColumn<scalar_t> colliderRadius; // Collider radius
+    BodyColumn<scalar_t> wallRadius;     // WallBounceScript radius
+    BodyColumn<scalar_t> renderRadius;   // CircleRender radius
+    BodyColumn<color_t> color;           // CircleRender color
+    BodyColumn<unsigned int> triggerSet; // Collider triggers, an index into Collider::triggerSets
+    BodyColumn<float> restMs;            // Time the body has been slower than sleepSettings.speed
+    BodyColumn<unsigned int> island;     // Sleeping island of the body, 0 while awake
+
+    ObjectPool pool;                     // Storage of every GameObject and component
+    unsigned long version;               // Changes whenever rows move or masks change other than through sleep.cpp
+    vector< pair<int, int> > renamed;    // (old row, new row or -1 if removed) of every row removeQueued() moved or removed since this was last cleared, by old row; cleared by its reader
+
+    BodyStore() : version( 0 ) {}
+
+    int size() const { return (int) objects.size(); }
+    void reserve( int rows );            // Make room for this many rows in every column
+    int add( GameObject* obj );          // Append a row with default values and return its index; obj may be NULL to create it on demand
+    GameObject* object( int i );         // Owner of row i, creating it and its built in components if the row has none yet
+    void removeLater( int i );           // Stop simulating and drawing row i now and remove it, and its GameObject, at the next removeQueued(). Thread safe
+    void removeQueued();                 // Remove every row passed to removeLater since the last call
+    int renamedRow( int row ) const;     // Where removeQueued() put a row from before renamed was last cleared, or -1
+    void integrate( int begin, int end, double dt );   // Physics: position += velocity * dt
+    void bounceWalls( int begin, int end );            // WallBounceScript: reflect velocity at the +-1 walls
+    void integrateAndBounce( int begin, int end, double dt ); // Both of the above in one pass, using the active SIMD kernel
+    void integrateAll( double dt );      // integrateAndBounce every awake row, split across jobPool
+};
+
+inline BodyStore& bodyStore(); // Bodies of the current World, see world.h
+
+/* A field of a component or GameObject that lives in a BodyStore column. It reads and writes
+ * like a double so scripts can keep using obj->x or physics->dx, while the value itself stays
+ * in the packed array in scalar_t. The row is read through the owner's body index on every access.
+ */
+class BodyField {
+  private:
+    BodyColumn<scalar_t>* column;
+    const int* body;
+
+  public:
+    BodyField( BodyColumn<scalar_t>* column, const int* body ) : column( column ), body( body ) {}
+    operator double() const { return toDouble( (*column)[*body] ); }
+    BodyField& operator=( double v ) { (*column)[*body] = toScalar( v ); return *this; }
+    BodyField& operator=( const BodyField& other ) { return *this = (double) other; }
+    BodyField& operator+=( double v ) { return *this = (double) *this + v; }
+    BodyField& operator-=( double v ) { return *this = (double) *this - v; }
+    BodyField& operator*=( double v ) { return *this = (double) *this * v; }
+};
+
+#endif
@@ -0,0 +1,101 @@
+/*-------------------------------------------------------
+
+Implements the spatial hash used to find nearby colliders.
+
+---------------------------------------------------------*/
+
+#include "broadphase.h"
+#include <math.h>
+
+/*Begin SpatialHash-------------------------------------------------------*/
+
+/* The constructor for a SpatialHash. The hash starts empty with a unit cell size.
+ */
+SpatialHash::SpatialHash() : cellSize( 1 ), bucketMask( 0 ) {}
+
+/* This function returns the grid cell coordinate containing a position
+ *
+ * @param (double v) an x or y position
+ */
+int SpatialHash::cellOf( double v ) const {
+  return (int) floor( v / cellSize );
+}
+
+/* This function maps a cell to its bucket. Distinct cells may share a bucket, so queries
+ * compare cell coordinates before reporting an entry.
+ *
+ * @param (int cellX) the x coordinate of the cell
+ * @param (int cellY) the y coordinate of the cell
+ */
+unsigned int SpatialHash::bucketOf( int cellX, int cellY ) const {
+  unsigned int h = (unsigned int) cellX * 73856093u ^ (unsigned int) cellY * 19349663u;
+  return h & bucketMask;
+}
+
+/* This function removes every entry and sets the size of the grid cells
+ *
+ * @param (double cellSize) the edge length of a cell, normally the largest collider diameter
+ */
+void SpatialHash::clear( double cellSize ) {
+  this->cellSize = cellSize > 0 ? cellSize : 1;
+  pending.clear();
+  entries.clear();
+}
+
+/* This function queues an entry. It is not visible to queries until build() runs.
+ *
+ * @param (int id) the value reported by query() for this entry
+ * @param (double x) the x position of the entry's center
+ * @param (double y) the y position of the entry's center
+ */
+void SpatialHash::insert( int id, double x, double y ) {
+  Entry e;
+  e.id = id;
+  e.cellX = cellOf( x );
+  e.cellY = cellOf( y );
+  pending.push_back( e );
+}
+
+/* This function sorts the queued entries into their buckets with a counting sort.
+ * The bucket count is the next power of two above twice the entry count.
+ */
+void SpatialHash::build() {
+  unsigned int buckets = 1;
+  while (buckets < 2 * pending.size()) buckets <<= 1;
+  bucketMask = buckets - 1;
+
+  bucketStart.assign( buckets + 1, 0 );
+  for (const Entry& e: pending) bucketStart[bucketOf( e.cellX, e.cellY ) + 1]++;
+  for (unsigned int b = 0; b < buckets; b++) bucketStart[b + 1] += bucketStart[b];
+
+  entries.resize( pending.size() );
+  vector<int> next( bucketStart.begin(), bucketStart.end() - 1 );
+  for (const Entry& e: pending) entries[next[bucketOf( e.cellX, e.cellY )]++] = e;
+  pending.clear();
+}
+
+/* This function reports every entry whose cell overlaps an axis aligned box.
+ * Entries are appended in bucket order; callers that need a stable order should sort the result.
+ *
+ * @param (double minX) left edge of the box
+ * @param (double minY) bottom edge of the box
+ * @param (double maxX) right edge of the box
+ * @param (double maxY) top edge of the box
+ * @param (vector<int>& out) receives the ids of the entries found
+ */
+void SpatialHash::query( double minX, double minY, double maxX, double maxY, vector<int>& out ) const {
+  if (entries.empty()) return;
+  int x0 = cellOf( minX ), x1 = cellOf( maxX );
+  int y0 = cellOf( minY ), y1 = cellOf( maxY );
+  for (int cy = y0; cy <= y1; cy++) {
+    for (int cx = x0; cx <= x1; cx++) {
+      unsigned int b = bucketOf( cx, cy );
+      for (int i = bucketStart[b]; i < bucketStart[b + 1]; i++) {
+        const Entry& e = entries[i];
+        if (e.cellX == cx && e.cellY == cy) out.push_back( e.id );
+      }
+    }
+  }
+}
+
+/*End SpatialHash-------------------------------------------------------*/
@@ -0,0 +1,37 @@
+#ifndef BROADPHASE_H
+#define BROADPHASE_H
+
+#include <vector>
+
+using namespace std;
+
+/* A uniform grid stored as a spatial hash. Entries are bucketed by the cell their center falls in
+ * and kept sorted by bucket, so one rebuild per step is a counting sort over flat arrays and a
+ * query only visits the handful of cells that overlap the search box.
+ */
+class SpatialHash {
+  private:
+    struct Entry {
+      int id;
+      int cellX;
+      int cellY;
+    };
+    double cellSize;
+    unsigned int bucketMask;
+    vector<Entry> pending;        // Entries in insertion order, consumed by build()
+    vector<Entry> entries;        // Entries sorted by bucket
+    vector<int> bucketStart;      // bucketStart[b]..bucketStart[b+1] is the range of bucket b in entries
+
+    int cellOf( double v ) const;
+    unsigned int bucketOf( int cellX, int cellY ) const;
+
+  public:
+    SpatialHash();
+    void clear( double cellSize );                   // Drop all entries and set the cell edge length
+    void insert( int id, double x, double y );       // Queue an entry whose center is (x, y)
+    void build();                                    // Sort queued entries into buckets; call before query
+    void query( double minX, double minY, double maxX, double maxY, vector<int>& out ) const; // Append the ids of every entry whose cell overlaps the box
+    double getCellSize() const { return cellSize; }
+};
+
+#endif
@@ -13,9 +13,29 @@ Implements all of the components used program.
 #include <GL/gl.h>     // The GL Header File
 #include <GL/glut.h>   // The GL Utility Toolkit (Glut) Header
 #include <unistd.h>
+#include <algorithm>
 
 #define PI 3.14159265f
 
+#include "profile.cpp"
+#include "broadphase.cpp"
+#include "bodies.cpp"
+#include "kernels.cpp"
+#include "jobs.cpp"
+#include "render.cpp"
+#include "softraster.cpp"
+#include "trace.cpp"
+#include "snapshot.cpp"
+#include "scene.cpp"
+#include "continuous.cpp"
+#include "sleep.cpp"
+#include "publish.cpp"
+#include "transport.cpp"
+#include "domain.cpp"
+#include "world.cpp"
+#include "ensemble.cpp"
+#include "stream.cpp"
+
 using namespace std;
 
 /*Begin GameObject-------------------------------------------------------*/
@@ -25,9 +45,40 @@ using namespace std;
  * @param (double x) starting x position of object
  * @param (double y) starting y position of object
  */
-GameObject::GameObject( double x, double y ) : x( x ), y( y ) {}
+GameObject::GameObject( double x, double y ) :
+body( bodyStore().add( this ) ), x( &bodyStore().x, &body ), y( &bodyStore().y, &body ) {
+  for (int i = 0; i < BUILTIN_COMPONENT_TYPES; i++) slots[i] = NULL;
+  this->x = x;
+  this->y = y;
+}
+
+/* The constructor used by BodyStore::object() for rows restored from a snapshot. The row
+ * already holds the position, so nothing is written to it.
+ *
+ * @param (int body) the row to own
+ */
+GameObject::GameObject( int body ) :
+body( body ), x( &bodyStore().x, &this->body ), y( &bodyStore().y, &this->body ) {
+  for (int i = 0; i < BUILTIN_COMPONENT_TYPES; i++) slots[i] = NULL;
+  bodyStore().objects[body] = this;
+}
+
+/* The destructor for a GameObject. Its row has already been removed from bodyStore.
+ */
+GameObject::~GameObject() {
+  for (Component* c: componentList) delete c;
+}
+
+/* This function queues the GameObject for removal. It stops moving, colliding and being drawn
+ * at once; it and its components are deleted at the start of the next fixed step, after which
+ * pointers to them must not be used.
+ */
+void GameObject::destroy() {
+  bodyStore().removeLater( body );
+}
 
-/* This function returns a list of all components that have the input string as their type
+/* This function returns a list of all components that have the input string as their type.
+ * It allocates and compares strings on every call; hot paths should use get<T>() instead.
  *
  * @param (string type) the desired "type" of component
  */
@@ -40,12 +91,18 @@ list<Component*> GameObject::getComponent( string type ) {
 }
 
 /**
- * This function adds a component to the GameObject's component list.
+ * This function adds a component to the GameObject's component list. The first component of
+ * each built in type is also stored in its slot so get<T>() can return it directly.
  * 
  * @param (Component* c) the component to add to the Gameobject's list
+ * @param (int typeId) the slot of the component's type, or BUILTIN_COMPONENT_TYPES for none
  */
-void GameObject::addComponent( Component* c) {
+void GameObject::addComponent( Component* c, int typeId ) {
   componentList.push_back( c );
+  if (typeId < BUILTIN_COMPONENT_TYPES && slots[typeId] == NULL) {
+    slots[typeId] = c;
+    bodyStore().mask[body] |= BODY_HAS( typeId );
+  }
 }
 
 /*End GameObject---------------------------------------------------------*/
@@ -56,13 +113,88 @@ void GameObject::addComponent( Component* c) {
  *  
  * @param (GameObject* parent) the parent of the new Component
  * @param (string type) the type of the new component
+ * @param (int typeId) the built in type slot of the new component, BUILTIN_COMPONENT_TYPES for user types
  */
 
-Component::Component( GameObject* parent, string type ) : parent ( parent ), type ( type ) {
-  Component::components.push_back( this ); 
-  parent->addComponent( this );
+Component::Component( GameObject* parent, string type, int typeId ) : slot ( typeId ), type ( type ), parent ( parent ) {
+  componentsIndex = (int) Component::components().size();
+  Component::components().push_back( this ); 
+  scriptedIndex = -1;
+  archetype = NULL;
+  archetypeIndex = -1;
+  archetypeLead = false;
+  if (typeId == BUILTIN_COMPONENT_TYPES) {
+    scriptedIndex = (int) Component::scriptedComponents().size();
+    Component::scriptedComponents().push_back( this );
+    Component::scriptedVersion()++;
+#ifdef ENABLE_PROFILING
+    updateZone = Profiler::intern( type + "::update" );
+    fixedUpdateZone = Profiler::intern( type + "::fixedUpdate" );
+#endif
+  }
+  parent->addComponent( this, typeId );
 };
 
+/* The destructor for a Component. It takes the component out of its archetype, if any, and out
+ * of the static lists by moving the last entry into its place.
+ */
+Component::~Component() {
+  if (archetype != NULL) archetype->leave( archetypeIndex, this );
+  Component* moved = Component::components().back();
+  Component::components()[componentsIndex] = moved;
+  moved->componentsIndex = componentsIndex;
+  Component::components().pop_back();
+  if (scriptedIndex >= 0) {
+    moved = Component::scriptedComponents().back();
+    Component::scriptedComponents()[scriptedIndex] = moved;
+    moved->scriptedIndex = scriptedIndex;
+    Component::scriptedComponents().pop_back();
+    Component::scriptedVersion()++;
+  }
+}
+
+/* This function queues the component for removal from its parent. It is deleted at the start
+ * of the next fixed step, after which pointers to it must not be used.
+ */
+void Component::destroy() {
+  lock_guard<mutex> hold( destroyLock );
+  destroyQueue().push_back( this );
+}
+
+/* This function takes the component out of its parent's list and slot. Another component of
+ * the same built in type takes over the slot; if there is none the body loses that type.
+ */
+void Component::detach() {
+  parent->componentList.remove( this );
+  if (slot == BUILTIN_COMPONENT_TYPES || parent->slots[slot] != this) return;
+  parent->slots[slot] = NULL;
+  for (Component* other: parent->componentList) {
+    if (other->slot == slot) {
+      parent->slots[slot] = other;
+      return;
+    }
+  }
+  bodyStore().mask[parent->body] &= ~BODY_HAS( slot );
+}
+
+/* This function deletes every component and GameObject destroyed since the last fixed step.
+ * Removal only happens here, so the components lists and body rows never change while a
+ * step is running. Components are removed in order of their place in the components list, not
+ * in the order they were destroyed, so triggers running in parallel cannot change the result.
+ */
+void Component::removeDestroyed() {
+  if (!destroyQueue().empty()) {
+    sort( destroyQueue().begin(), destroyQueue().end(), []( Component* a, Component* b ) { return a->componentsIndex > b->componentsIndex; } );
+    destroyQueue().erase( unique( destroyQueue().begin(), destroyQueue().end() ), destroyQueue().end() );
+    for (Component* c: destroyQueue()) {
+      c->detach();
+      delete c;
+    }
+    destroyQueue().clear();
+  }
+  bodyStore().removeQueued();
+}
+
 
 /* This function is intended to be run at a variable interval (useful for things like rendering)
  * The defualt implementation does nothing
@@ -84,34 +216,192 @@ void Component::fixedUpdate( float dt ) {}
  * It runs the update(float dt) funtion for every component
  */
 
-/* This function runs update() on every component
+/* This function runs the variable update of every component. All CircleRenders are drawn
+ * together in one batch; components of other types have their update() called one by one, or
+ * in order through the archetype they belong to.
  *
  * @param (float dt) time since the last fixedUpdate in milliseconds
  */
 void Component::updateAll( float dt ){
   //printf("floatingUpdateDt:%f \n", (float) dt);
-  for(Component* elem: Component::components){
-    elem->update( dt );
-  }
+  PROFILE_SCOPE( "updateAll" );
+  CircleRender::renderAll();
+  Component::runScripts( dt, false );
 };
 
-/* This function runs fixedUpdate() on every component
+mutex Component::destroyLock;
+
+/* This function runs the fixed update of every component. The built in components are
+ * updated a whole column at a time by the bodyStore kernels, split into chunks across
+ * jobPool; only components of other types have their fixedUpdate() called one by one.
+ * The result does not depend on the number of threads. Objects destroyed since the last step
+ * are removed first. When Collider::continuousSubsteps is set, Collider::sweepStep moves the
+ * bodies and resolves every impact at its time of impact instead of testing for overlap at the
+ * end of the step. The step's collision events go to the subscribers of Collider after the
+ * triggers have run, and resting bodies are put to sleep last, see sleep.h.
  *
  * @param (float dt) time since the last fixedUpdate in milliseconds
  */
 void Component::fixedUpdateAll( float dt ){
   //printf("fixedUpdateDt:%f \n", (float) dt);
-  for(Component* elem: Component::components){
-    elem->fixedUpdate( dt );
+  PROFILE_SCOPE( "fixedUpdateAll" );
+  {
+    PROFILE_SCOPE( "removeDestroyed" );
+    Component::removeDestroyed();
+  }
+  if (Collider::continuousSubsteps() > 0) {
+    // Moves the bodies and resolves their collisions in one go
+    PROFILE_SCOPE( "Collider sweepStep" );
+    Collider::sweepStep( dt );
+    Collider::classifyContacts();
+  } else {
+    PROFILE_SCOPE( "Physics+WallBounceScript" );
+    bodyStore().integrateAll( dt );
+  }
+  Component::fixedUpdateScripts( dt );
+  if (Collider::continuousSubsteps() == 0) {
+    Collider::updateBroadphase();
+    Collider::generateContacts();
+    Collider::classifyContacts();
+    Collider::resolveContacts( dt );
   }
+  Collider::dispatchEvents( dt );
+  updateSleep( dt );
 };
 
+/* This function runs fixedUpdate() of every component without a built in type, in the order
+ * of scriptedComponents, one by one or through the archetype it belongs to.
+ *
+ * @param (float dt) time since the last fixedUpdate in milliseconds
+ */
+void Component::fixedUpdateScripts( float dt ){
+  Component::runScripts( dt, true );
+}
+
+/* This function cuts scriptedComponents into runs: components called virtually, and instances
+ * of one archetype led by the components from one place to the next component that is called
+ * virtually or leads an instance of another archetype. Members that do not lead are passed
+ * over, as their instance runs where its lead is. The members of an instance that is not in
+ * place, see ArchetypeBase::inPlace, are called virtually like components without one.
+ */
+void Component::scheduleScripts() {
+  scriptRuns().clear();
+  runInstances().clear();
+  for (size_t i = 0; i < scriptedComponents().size(); i++) {
+    Component* c = scriptedComponents()[i];
+    ArchetypeBase* fused = c->archetype;
+    if (fused != NULL && !fused->inPlace( c->archetypeIndex )) fused = NULL; // Called at its own place to keep the order
+    else if (fused != NULL && !c->archetypeLead) continue;
+    scriptRun_t* last = scriptRuns().empty() ? NULL : &scriptRuns().back();
+    // Components called virtually only share a run when nothing was passed over between them
+    if (last == NULL || last->archetype != fused || (fused == NULL && last->first + last->count != (int) i)) {
+      scriptRun_t run = { fused, fused == NULL ? (int) i : (int) runInstances().size(), 0 };
+      scriptRuns().push_back( run );
+      last = &scriptRuns().back();
+    }
+    if (fused != NULL) runInstances().push_back( c->archetypeIndex );
+    last->count++;
+  }
+  scheduledSize() = scriptedComponents().size();
+  scheduledVersion() = scriptedVersion();
+}
+
+/* This function runs update() or fixedUpdate() of every component in scriptedComponents, in
+ * order, one by one or a run of instances at a time through their archetype. Components added
+ * meanwhile run after the others; the runs are made again in the next call.
+ *
+ * @param (float dt) time since the last fixedUpdate in milliseconds
+ * @param (bool fixed) whether to run fixedUpdate() rather than update()
+ */
+void Component::runScripts( float dt, bool fixed ) {
+  if (scheduledVersion() != scriptedVersion()) scheduleScripts();
+  size_t runs = scriptRuns().size();
+  for (size_t r = 0; r < runs; r++) {
+    scriptRun_t run = scriptRuns()[r];
+    if (run.archetype != NULL) {
+      PROFILE_SCOPE( fixed ? "Archetype fixedUpdate" : "Archetype update" );
+      if (fixed) run.archetype->fixedUpdateRun( &runInstances()[run.first], run.count, dt );
+      else run.archetype->updateRun( &runInstances()[run.first], run.count, dt );
+      continue;
+    }
+    for (int i = run.first; i < run.first + run.count; i++) {
+      Component* c = scriptedComponents()[i];
+      PROFILE_SCOPE( fixed ? c->fixedUpdateZone : c->updateZone );
+      if (fixed) c->fixedUpdate( dt );
+      else c->update( dt );
+    }
+  }
+  for (size_t i = scheduledSize(); i < scriptedComponents().size(); i++) {
+    Component* c = scriptedComponents()[i];
+    if (c->archetype == NULL) {
+      PROFILE_SCOPE( fixed ? c->fixedUpdateZone : c->updateZone );
+      if (fixed) c->fixedUpdate( dt );
+      else c->update( dt );
+    } else if (c->archetypeLead) {
+      if (fixed) c->archetype->fixedUpdateRun( &c->archetypeIndex, 1, dt );
+      else c->archetype->updateRun( &c->archetypeIndex, 1, dt );
+    }
+  }
+}
+
 /*End Component-------------------------------------------------------*/
 
 
+/*Begin ArchetypeBase-------------------------------------------------------*/
+
+vector<ArchetypeBase*> ArchetypeBase::registered;
+mutex ArchetypeBase::registryLock;
+
+/* This function adds an archetype type to registered, from the first thread that uses it.
+ * Returns its index, which is also where each World keeps its instances of the type.
+ *
+ * @param (ArchetypeBase* type) an empty archetype of the type, kept for good
+ */
+int ArchetypeBase::enroll( ArchetypeBase* type ) {
+  lock_guard<mutex> hold( registryLock );
+  registered.push_back( type );
+  return (int) registered.size() - 1;
+}
+
+/* This function hands a component to an archetype, so only the archetype calls its update()
+ * and fixedUpdate(). It keeps its place in scriptedComponents, where the lead of an instance
+ * runs the whole instance and the other members are passed over, see scheduleScripts.
+ *
+ * @param (Component* c) the component
+ * @param (ArchetypeBase* owner) the archetype
+ * @param (int instance) the instance of owner c belongs to
+ * @param (bool lead) whether c leads its instance
+ */
+void ArchetypeBase::claim( Component* c, ArchetypeBase* owner, int instance, bool lead ) {
+  c->archetype = owner;
+  c->archetypeIndex = instance;
+  c->archetypeLead = lead;
+  Component::scriptedVersion()++;
+}
+
+/* This function takes a component back from its archetype. A component without a built in type
+ * is called virtually again from its place in scriptedComponents.
+ *
+ * @param (Component* c) the component
+ */
+void ArchetypeBase::release( Component* c ) {
+  c->archetype = NULL;
+  c->archetypeIndex = -1;
+  c->archetypeLead = false;
+  Component::scriptedVersion()++;
+}
+
+/*End ArchetypeBase-------------------------------------------------------*/
+
+
 /*Begin Collider (extends Component)-------------------------------------------------------*/
 
-list<Collider*> Collider::allColliders;
+vector< pair<string, triggerFunc> > Collider::registeredTriggers;
+vector<collisionSubscriber_t> Collider::subscribers;
+
+// Colliders per narrowphase chunk. Chunks are fixed in size so the contact order never
+// depends on the number of threads.
+#define NARROWPHASE_CHUNK 1024
 
 /* The constructor for a Collider. 
  *
@@ -119,9 +409,8 @@ list<Collider*> Collider::allColliders;
  * @param (double radius) the collision radius of the object
  */
 Collider::Collider( GameObject* parent, double radius ) :
-  radius( radius ), Component ( parent, "Collider"){
-  Collider::allColliders.push_back( this );
-  list<triggerFunc> triggers; //this list is all colliders
+  Component ( parent, "Collider", COLLIDER_TYPE ), radius( &bodyStore().colliderRadius, &parent->body ){
+  this->radius = radius;
 };
 
 /* This function adds a trigger function (fuction called when there is a collision) to the collider.
@@ -129,48 +418,453 @@ Collider::Collider( GameObject* parent, double radius ) :
  * @param (triggerFunc trigger) a trigger function to be called when the collider detects a collision.
  */
 void Collider::addTrigger(triggerFunc trigger) {
+  vector<triggerFunc> triggers = triggerSets()[bodyStore().triggerSet[parent->body]];
   triggers.push_back(trigger);
+  bodyStore().triggerSet[parent->body] = internTriggerSet(triggers);
+}
+
+/* This function returns the index of the trigger set holding exactly the given triggers, in
+ * order, adding a new set if none does. Most worlds use a handful of sets, so each body only
+ * stores an index.
+ *
+ * @param (const vector<triggerFunc>& triggers) the trigger functions of the set
+ */
+unsigned int Collider::internTriggerSet( const vector<triggerFunc>& triggers ) {
+  for(unsigned int i = 0; i < triggerSets().size(); i++) {
+    if (triggerSets()[i] == triggers) return i;
+  }
+  triggerSets().push_back(triggers);
+  return (unsigned int) triggerSets().size() - 1;
+}
+
+/* This function names a trigger function. Snapshots store triggers by these names, so every
+ * trigger used by a saved world must be registered before saving and before restoring.
+ *
+ * @param (const string& name) the name to store in snapshots
+ * @param (triggerFunc trigger) the trigger function
+ */
+void Collider::registerTrigger( const string& name, triggerFunc trigger ) {
+  registeredTriggers.push_back( make_pair( name, trigger ) );
 }
 
-/* This function calulates the disatnce between 2 GameObjects 
+/* This function looks up a trigger function by its registered name, returning NULL if none has it.
+ *
+ * @param (const string& name) the registered name
+ */
+triggerFunc Collider::findTrigger( const string& name ) {
+  for(const pair<string, triggerFunc>& entry: registeredTriggers) {
+    if (entry.first == name) return entry.second;
+  }
+  return NULL;
+}
 
- * @param (GameObject* obj1)
- * @param (GameObject* obj2)
+/* This function looks up the registered name of a trigger function, returning NULL if it has none.
+ *
+ * @param (triggerFunc trigger) the trigger function
  */
-float calculateDistance(GameObject* obj1, GameObject* obj2) {
-  return sqrt( pow((obj1->x - obj2->x), 2) + pow((obj1->y - obj2->y), 2) );
+const string* Collider::triggerName( triggerFunc trigger ) {
+  for(const pair<string, triggerFunc>& entry: registeredTriggers) {
+    if (entry.second == trigger) return &entry.first;
+  }
+  return NULL;
 }
 
 /**
- * This function detects if this collider is colliding with any other colliders 
- * that are not attached to the same parent object. If it detects a collision, 
- * it will invoke any collision resolution functions attached to the current collider.
+ * This function rebuilds the broadphase grid from the current collider positions. It runs once
+ * per fixed step, after every component's fixedUpdate. Cells are as wide as the largest collider
+ * so a pair can only touch across neighbouring cells. Only the awake rows are visited for the
+ * awake grid.
  *
- * @param (float dt) The elapsed time since the last fixedUpdate in milliseconds
+ * Sleeping colliders rarely move, so they have grids of their own that are not rebuilt every
+ * step. Colliders that fall asleep, or that a trigger may have moved while asleep, go into
+ * recentGrid. Once recentGrid and the colliders woken since sleepingGrid was built add up to a
+ * sixteenth of sleepingGrid, both are folded into a new sleepingGrid. Only when rows move is
+ * every row scanned for sleeping colliders. Colliders that woke up or moved since a grid was
+ * built are skipped or found again by generateContacts.
+ */
+void Collider::updateBroadphase() {
+  PROFILE_SCOPE( "Collider broadphase" );
+  const unsigned int asleep = BODY_HAS( COLLIDER_TYPE ) | BODY_SLEEPING;
+  maxRadius() = 0;
+  indexed().clear();
+  for(int i: awakeRows()) {
+    if (!(bodyStore().mask[i] & BODY_HAS( COLLIDER_TYPE ))) continue;
+    maxRadius() = max( maxRadius(), toDouble( bodyStore().colliderRadius[i] ) );
+    indexed().push_back( i );
+  }
+  grid().clear( 2 * maxRadius() );
+  for(int i = 0; i < (int) indexed().size(); i++) grid().insert( i, bodyStore().x[indexed()[i]], bodyStore().y[indexed()[i]] );
+  grid().build();
+
+  bool rebuild = false;
+  if (sleepingVersion() != bodyStore().version) {
+    sleepingIndexed().clear();
+    for(int i = 0; i < bodyStore().size(); i++) {
+      if ((bodyStore().mask[i] & asleep) == asleep) sleepingIndexed().push_back( i );
+    }
+    rebuild = true;
+  } else if (!sleepersToIndex().empty()) {
+    for(int i: sleepersToIndex()) {
+      if ((bodyStore().mask[i] & asleep) != asleep) continue;
+      sleepingMaxRadius() = max( sleepingMaxRadius(), toDouble( bodyStore().colliderRadius[i] ) );
+      recentIndexed().push_back( i );
+    }
+    sort( recentIndexed().begin(), recentIndexed().end() );
+    recentIndexed().erase( unique( recentIndexed().begin(), recentIndexed().end() ), recentIndexed().end() );
+    // Entries beyond the sleeping bodies are woken colliders and stale copies of moved ones
+    long wasted = (long) (sleepingIndexed().size() + recentIndexed().size()) - sleepingBodies();
+    if ((long) recentIndexed().size() + max( wasted, 0L ) > (long) sleepingIndexed().size() / 16) {
+      // Fold the recent colliders in, dropping the ones that woke up since
+      vector<int> merged;
+      merged.reserve( sleepingIndexed().size() + recentIndexed().size() );
+      set_union( sleepingIndexed().begin(), sleepingIndexed().end(), recentIndexed().begin(), recentIndexed().end(), back_inserter( merged ) );
+      sleepingIndexed().clear();
+      for(int i: merged) {
+        if ((bodyStore().mask[i] & asleep) == asleep) sleepingIndexed().push_back( i );
+      }
+      rebuild = true;
+    } else {
+      recentGrid().clear( 2 * sleepingMaxRadius() );
+      for(int i = 0; i < (int) recentIndexed().size(); i++) recentGrid().insert( i, bodyStore().x[recentIndexed()[i]], bodyStore().y[recentIndexed()[i]] );
+      recentGrid().build();
+    }
+  }
+  sleepersToIndex().clear();
+  if (rebuild) {
+    sleepingMaxRadius() = 0;
+    for(int i: sleepingIndexed()) sleepingMaxRadius() = max( sleepingMaxRadius(), toDouble( bodyStore().colliderRadius[i] ) );
+    sleepingGrid().clear( 2 * sleepingMaxRadius() );
+    for(int i = 0; i < (int) sleepingIndexed().size(); i++) sleepingGrid().insert( i, bodyStore().x[sleepingIndexed()[i]], bodyStore().y[sleepingIndexed()[i]] );
+    sleepingGrid().build();
+    sleepingVersion() = bodyStore().version;
+    recentIndexed().clear();
+    recentGrid().clear( 1 );
+    recentGrid().build();
+  }
+}
+
+/**
+ * This function finds every pair of overlapping colliders and stores each pair once in
+ * contacts, with a the collider on the lower body row. Only awake colliders look for contacts:
+ * pairs of awake colliders are ordered by the body row of their first collider, then by the
+ * second, and each awake collider's contacts with sleeping ones follow its own, so the order
+ * does not depend on the grid layout. Two sleeping colliders are never tested. Colliders are
+ * split into chunks that are tested in parallel, each into its own buffer, and the buffers
+ * are joined in chunk order.
+ */
+void Collider::generateContacts() {
+  PROFILE_SCOPE( "Collider narrowphase" );
+  int chunks = ((int) indexed().size() + NARROWPHASE_CHUNK - 1) / NARROWPHASE_CHUNK;
+  chunkContacts().resize( chunks );
+  chunkPairTests().assign( chunks, 0 );
+  jobPool.parallelFor( chunks, 1, []( int chunkBegin, int chunkEnd ) {
+    PROFILE_SCOPE( "narrowphase chunk" );
+    vector<int> candidates;
+    for(int chunk = chunkBegin; chunk < chunkEnd; chunk++) {
+      vector<contact_t>& out = chunkContacts()[chunk];
+      long tests = 0;
+      out.clear();
+      int end = min( (int) indexed().size(), (chunk + 1) * NARROWPHASE_CHUNK );
+      for(int i = chunk * NARROWPHASE_CHUNK; i < end; i++) {
+        int a = indexed()[i];
+        scalar_t x = bodyStore().x[a];
+        scalar_t y = bodyStore().y[a];
+
+        for(int pass = 0; pass < 2; pass++) {
+          bool sleeping = pass == 1;
+          if (sleeping && sleepingIndexed().empty() && recentIndexed().empty()) break;
+          double reach = bodyStore().colliderRadius[a] + (sleeping ? sleepingMaxRadius() : maxRadius());
+          candidates.clear();
+          if (sleeping) {
+            // Body rows from both sleeping grids; a collider that fell asleep again after
+            // waking up can be in both
+            sleepingGrid().query( x - reach, y - reach, x + reach, y + reach, candidates );
+            size_t recent = candidates.size();
+            recentGrid().query( x - reach, y - reach, x + reach, y + reach, candidates );
+            for(size_t k = 0; k < candidates.size(); k++) candidates[k] = k < recent ? sleepingIndexed()[candidates[k]] : recentIndexed()[candidates[k]];
+            sort( candidates.begin(), candidates.end() );
+            candidates.erase( unique( candidates.begin(), candidates.end() ), candidates.end() );
+          } else {
+            grid().query( x - reach, y - reach, x + reach, y + reach, candidates );
+            sort( candidates.begin(), candidates.end() );
+          }
+
+          for(int j: candidates) {
+            int b;
+            if (sleeping) {
+              b = j;
+              // Removed or woken since the sleeping grids were built
+              if ((bodyStore().mask[b] & (BODY_HAS( COLLIDER_TYPE ) | BODY_SLEEPING)) != (BODY_HAS( COLLIDER_TYPE ) | BODY_SLEEPING)) continue;
+            } else {
+              // Each pair is reported by its lower index only
+              if (j <= i) continue;
+              b = indexed()[j];
+            }
+            tests++;
+
+            scalar_t dx = bodyStore().x[b] - x;
+            scalar_t dy = bodyStore().y[b] - y;
+            scalar_t reachSum = bodyStore().colliderRadius[a] + bodyStore().colliderRadius[b];
+            if (dx * dx + dy * dy > reachSum * reachSum) continue;
+
+            contact_t contact;
+            contact.bodyA = min( a, b );
+            contact.bodyB = max( a, b );
+            contact.a = bodyStore().objects[contact.bodyA] != NULL ? bodyStore().objects[contact.bodyA]->get<Collider>() : NULL;
+            contact.b = bodyStore().objects[contact.bodyB] != NULL ? bodyStore().objects[contact.bodyB]->get<Collider>() : NULL;
+            measureContact( contact );
+            out.push_back( contact );
+          }
+        }
+      }
+      chunkPairTests()[chunk] = tests;
+    }
+  });
+
+  pairTests() = 0;
+  for(long tests: chunkPairTests()) pairTests() += tests;
+  PROFILE_COUNT( PROFILE_PAIR_TESTS, pairTests() );
+  contacts().clear();
+  for(const vector<contact_t>& out: chunkContacts()) contacts().insert( contacts().end(), out.begin(), out.end() );
+
+  PROFILE_COUNT( PROFILE_CONTACTS, contacts().size() );
+
+  // Bodies restored from a snapshot get their GameObject the first time they touch something
+  for(contact_t& contact: contacts()) {
+    if (contact.a == NULL) contact.a = bodyStore().object( contact.bodyA )->get<Collider>();
+    if (contact.b == NULL) contact.b = bodyStore().object( contact.bodyB )->get<Collider>();
+  }
+}
+
+/* This function fills in the normal, penetration and relative velocity of a contact from the
+ * current positions and velocities of its bodies. Bodies at the same spot get the normal (1, 0).
+ *
+ * @param (contact_t& contact) the contact; bodyA and bodyB must be set
+ */
+void Collider::measureContact( contact_t& contact ) {
+  int a = contact.bodyA;
+  int b = contact.bodyB;
+  double dx = bodyStore().x[b] - bodyStore().x[a];
+  double dy = bodyStore().y[b] - bodyStore().y[a];
+  double distance = sqrt( dx * dx + dy * dy );
+  contact.normalX = distance > 0 ? (float) (dx / distance) : 1;
+  contact.normalY = distance > 0 ? (float) (dy / distance) : 0;
+  contact.penetration = (float) (bodyStore().colliderRadius[a] + bodyStore().colliderRadius[b] - distance);
+  contact.relativeDx = (float) (bodyStore().dx[b] - bodyStore().dx[a]);
+  contact.relativeDy = (float) (bodyStore().dy[b] - bodyStore().dy[a]);
+  contact.phase = COLLISION_ENTER;
+}
+
+/**
+ * This function compares this step's contacts with the pairs that touched after the previous
+ * step. Each contact is marked COLLISION_STAY if its pair touched before and COLLISION_ENTER
+ * otherwise; a pair met more than once in a step, as a swept step can, enters at most once.
+ * Every pair that touched before and is not among the contacts gets a COLLISION_EXIT event,
+ * measured from where its bodies are now, unless both bodies sleep: sleeping pairs are never
+ * tested, so they are taken to still touch. Rows moved by removeQueued() since the last call
+ * are followed through bodyStore.renamed, which is cleared here, and a pair with a removed body
+ * exits with that body's row -1 and collider NULL.
+ *
+ * events is left holding the contacts in the order they were found followed by the exits in
+ * row order, so it does not depend on the number of threads. Nothing is done while there are
+ * no subscribers.
  */
+void Collider::classifyContacts() {
+  events().clear();
+  if (subscribers.empty()) {
+    touching().clear();
+    bodyStore().renamed.clear();
+    return;
+  }
+  PROFILE_SCOPE( "Collider classify" );
+  static thread_local vector< pair<unsigned long long, int> > found;
+  static thread_local vector<unsigned long long> before;
+  static thread_local vector<unsigned long long> now;
+
+  // Pairs of the previous step in their current rows
+  before.clear();
+  vector<contact_t> removed;
+  for(unsigned long long key: touching()) {
+    int a = bodyStore().renamedRow( (int) (key >> 32) );
+    int b = bodyStore().renamedRow( (int) (key & 0xffffffffu) );
+    if (a < 0 || b < 0) {
+      contact_t exit;
+      memset( &exit, 0, sizeof( exit ) );
+      exit.bodyA = a;
+      exit.bodyB = b;
+      if (a >= 0) exit.a = bodyStore().object( a )->get<Collider>();
+      if (b >= 0) exit.b = bodyStore().object( b )->get<Collider>();
+      exit.phase = COLLISION_EXIT;
+      removed.push_back( exit );
+      continue;
+    }
+    before.push_back( (unsigned long long) min( a, b ) << 32 | (unsigned int) max( a, b ) );
+  }
+  if (!bodyStore().renamed.empty()) sort( before.begin(), before.end() );
 
-void Collider::fixedUpdate(float dt) {
-  // Retrieve a list of all colliders attached to the parent
-  list <Component*> parentList =  parent->getComponent("Collider");
+  found.clear();
+  for(int k = 0; k < (int) contacts().size(); k++) {
+    found.push_back( make_pair( (unsigned long long) contacts()[k].bodyA << 32 | (unsigned int) contacts()[k].bodyB, k ) );
+  }
+  sort( found.begin(), found.end() );
+  now.clear();
+  for(const pair<unsigned long long, int>& entry: found) {
+    bool repeat = !now.empty() && now.back() == entry.first;
+    bool stays = repeat || binary_search( before.begin(), before.end(), entry.first );
+    contacts()[entry.second].phase = stays ? COLLISION_STAY : COLLISION_ENTER;
+    if (!repeat) now.push_back( entry.first );
+  }
+  events().assign( contacts().begin(), contacts().end() );
+
+  const unsigned int asleep = BODY_HAS( COLLIDER_TYPE ) | BODY_SLEEPING;
+  touching().clear();
+  vector<unsigned long long>::const_iterator current = now.begin();
+  for(unsigned long long key: before) {
+    while (current != now.end() && *current < key) touching().push_back( *current++ );
+    if (current != now.end() && *current == key) continue;
+    int a = (int) (key >> 32);
+    int b = (int) (key & 0xffffffffu);
+    if ((bodyStore().mask[a] & asleep) == asleep && (bodyStore().mask[b] & asleep) == asleep) {
+      touching().push_back( key );
+      continue;
+    }
+    contact_t exit;
+    exit.bodyA = a;
+    exit.bodyB = b;
+    exit.a = bodyStore().object( a )->get<Collider>();
+    exit.b = bodyStore().object( b )->get<Collider>();
+    measureContact( exit );
+    exit.phase = COLLISION_EXIT;
+    events().push_back( exit );
+  }
+  touching().insert( touching().end(), current, now.cend() );
+  events().insert( events().end(), removed.begin(), removed.end() );
+  bodyStore().renamed.clear();
+}
 
-  Collider* parentCollider;
-  for(Collider* otherCollider: Collider::allColliders) {
-    for(Component* elem: parentList) {
-      // Skip this loop iteration if the other collider in consideration is
-      // attached to the same object as the current collider
-      parentCollider = (Collider*) elem;
-      if (otherCollider == parentCollider) continue;
+/* This function subscribes a handler to collision events. After the triggers of every fixed
+ * step have run, the handler is called once with all of the step's events.
+ *
+ * @param (collisionHandler handler) the handler
+ */
+void Collider::subscribe( collisionHandler handler ) {
+  collisionSubscriber_t subscriber = { handler, NULL, 0 };
+  subscribers.push_back( subscriber );
+}
 
-      // If there is no collision, skip this loop iteration
-      float distance = calculateDistance(otherCollider->parent, parent);
-      if (distance > this->radius + otherCollider->radius) continue;
+/* This function subscribes a listener to collision events. After the triggers of every fixed
+ * step have run, the listener is called for each of the step's events whose phase is one of
+ * the given phases, in the order of events.
+ *
+ * @param (unsigned int phases) collisionPhase_t bits of the events to pass on
+ * @param (collisionListener listener) the listener
+ */
+void Collider::subscribe( unsigned int phases, collisionListener listener ) {
+  collisionSubscriber_t subscriber = { NULL, listener, phases };
+  subscribers.push_back( subscriber );
+}
 
-      // Otherwise, execute any registered collision resolution functions
-      for (triggerFunc trigger: triggers) trigger(this, otherCollider, dt);
+/* This function hands the events of the step to every subscriber, in the order they
+ * subscribed. Subscribers run one after the other on the calling thread, so unlike triggers
+ * they may change any object. Objects they destroy stay in events until the next step.
+ *
+ * @param (float dt) The elapsed time since the last fixedUpdate in milliseconds
+ */
+void Collider::dispatchEvents( float dt ) {
+  if (events().empty()) return;
+  PROFILE_SCOPE( "Collider events" );
+  for(const collisionSubscriber_t& subscriber: subscribers) {
+    if (subscriber.handler != NULL) {
+      subscriber.handler( events().data(), (int) events().size(), dt );
+      continue;
+    }
+    for(const contact_t& event: events()) {
+      if (event.phase & subscriber.phases) subscriber.listener( event, dt );
     }
   }
 }
 
+/**
+ * This function sorts contacts into batches in which no two contacts share a body. Each
+ * contact goes in the batch after the latest batch used by either of its bodies, so every
+ * body still sees its contacts in the original order. Resolving the batches one after the
+ * other therefore gives the same result as resolving the contacts in order, while the
+ * contacts inside a batch can run at the same time.
+ */
+void Collider::batchContacts() {
+  static thread_local vector<int> lastBatch;
+  static thread_local vector<int> batchOf;
+  lastBatch.assign( bodyStore().size(), -1 );
+  batchOf.resize( contacts().size() );
+
+  int batches = 0;
+  for(int k = 0; k < (int) contacts().size(); k++) {
+    int batch = max( lastBatch[contacts()[k].bodyA], lastBatch[contacts()[k].bodyB] ) + 1;
+    lastBatch[contacts()[k].bodyA] = batch;
+    lastBatch[contacts()[k].bodyB] = batch;
+    batchOf[k] = batch;
+    batches = max( batches, batch + 1 );
+  }
+
+  // Counting sort by batch, keeping the original order inside each batch
+  batchStart().assign( batches + 1, 0 );
+  for(int batch: batchOf) batchStart()[batch + 1]++;
+  for(int b = 0; b < batches; b++) batchStart()[b + 1] += batchStart()[b];
+  static thread_local vector<contact_t> sorted;
+  sorted.resize( contacts().size() );
+  vector<int> next( batchStart().begin(), batchStart().end() - 1 );
+  for(int k = 0; k < (int) contacts().size(); k++) sorted[next[batchOf[k]]++] = contacts()[k];
+  contacts().swap( sorted );
+}
+
+/**
+ * This function runs the triggers of one contact. The first collider's triggers are called as
+ * (a, b), then those of the second collider that the first does not have as (b, a). Returns
+ * the number of triggers called.
+ *
+ * @param (const contact_t& contact) the contact
+ * @param (float dt) passed on to the triggers
+ */
+long Collider::fireTriggers( const contact_t& contact, float dt ) {
+  const vector<triggerFunc>& triggersA = triggerSets()[bodyStore().triggerSet[contact.bodyA]];
+  const vector<triggerFunc>& triggersB = triggerSets()[bodyStore().triggerSet[contact.bodyB]];
+  long fired = triggersA.size();
+  for(triggerFunc trigger: triggersA) trigger( contact.a, contact.b, dt );
+  for(triggerFunc trigger: triggersB) {
+    if (find( triggersA.begin(), triggersA.end(), trigger ) != triggersA.end()) continue;
+    trigger( contact.b, contact.a, dt );
+    fired++;
+  }
+  return fired;
+}
+
+/**
+ * This function runs the collision resolution functions for every contact found this step.
+ * The first collider's triggers are called as (a, b), then the second collider's as (b, a).
+ * A trigger registered on both colliders only runs once per contact, so a symmetric response
+ * such as Bounce resolves each pair exactly once.
+ *
+ * Contacts inside a batch run in parallel, so a trigger must only change the two objects it
+ * is given.
+ *
+ * @param (float dt) The elapsed time since the last fixedUpdate in milliseconds
+ */
+void Collider::resolveContacts( float dt ) {
+  PROFILE_SCOPE( "Collider resolve" );
+  batchContacts();
+  for(int batch = 0; batch + 1 < (int) batchStart().size(); batch++) {
+    int first = batchStart()[batch];
+    jobPool.parallelFor( batchStart()[batch + 1] - first, 256, [first, dt]( int begin, int end ) {
+      PROFILE_SCOPE( "Collider triggers" );
+      long fired = 0;
+      for(int k = first + begin; k < first + end; k++) {
+        fired += fireTriggers( contacts()[k], dt );
+      }
+      PROFILE_COUNT( PROFILE_TRIGGERS, fired );
+    });
+  }
+}
+
 /*End Coliider-------------------------------------------------------*/
 
 
@@ -182,7 +876,8 @@ void Collider::fixedUpdate(float dt) {
  * @param (double radius) the collision radius of the object
  */
 CircleRender::CircleRender( GameObject* parent, double radius ) :
-radius ( radius ), Component(parent, string("CircleRender")) {
+Component(parent, string("CircleRender"), CIRCLE_RENDER_TYPE), radius ( &bodyStore().renderRadius, &parent->body ) {
+  this->radius = radius;
   setColor(0, 0, 1);
 }
 
@@ -193,13 +888,14 @@ radius ( radius ), Component(parent, string("CircleRender")) {
  * @param (float B) The value of blue (0-255)
  */
 void CircleRender::setColor(float R, float G, float B) {
+  color_t& color = bodyStore().color[parent->body];
   color.R = R;
   color.G = G;
   color.B = B;
 }
 
 /**
- * This function detects if this collider is colliding with any other colliders 
+ * This function draws this circle on its own. updateAll draws every circle with renderAll instead.
  *
  * @param (float dt) The elapsed time since the last fixedUpdate in milliseconds
  */
@@ -212,19 +908,25 @@ void CircleRender::update( float dt ) {
   glMatrixMode(GL_MODELVIEW);    // To operate on the model-view matrix
   glLoadIdentity();              // Reset model-view matrix
 
+  const color_t& color = bodyStore().color[parent->body];
   glTranslatef(ballX, ballY, 0.0f);  // Translate to (xPos, yPos)
+  int numSegments = CircleBatch::segmentsFor( ballRadius * glPixelsPerUnit() ); // Queried before glBegin, where glGet is not allowed
+  const vector<GLfloat>& circle = CircleBatch::unitCircle( numSegments );
   // Use triangular segments to form a circle
   glBegin(GL_TRIANGLE_FAN);
      glColor3f(color.R, color.G, color.B);
      glVertex2f(0.0f, 0.0f);       // Center of circle
-     int numSegments = 100;
-     GLfloat angle;
      for (int i = 0; i <= numSegments; i++) { // Last vertex same as first vertex
-        angle = (i * 2.0f * PI) / numSegments;  // 360 deg for all segments
-        glVertex2f(cos(angle) * ballRadius, sin(angle) * ballRadius);
+        glVertex2f(circle[2 * i] * ballRadius, circle[2 * i + 1] * ballRadius);
      }
   glEnd();
 }
+
+/* This function draws every CircleRender through the active render backend
+ */
+void CircleRender::renderAll() {
+  renderBackend->drawCircles( bodyStore() );
+}
 /*End CircleRenderer-------------------------------------------------------*/
 
 /*Begin Physics-------------------------------------------------------*/
@@ -237,16 +939,21 @@ void CircleRender::update( float dt ) {
  * @param (double mass) the mass of the object
  */
 Physics::Physics ( GameObject* parent, double dx, double dy, double mass) :
-mass ( mass ), dx ( dx ), dy ( dy ), Component (parent, string("Physics")) {};
+Component (parent, string("Physics"), PHYSICS_TYPE), dx ( &bodyStore().dx, &parent->body ),
+dy ( &bodyStore().dy, &parent->body ), mass ( &bodyStore().mass, &parent->body ) {
+  this->dx = dx;
+  this->dy = dy;
+  this->mass = mass;
+};
 
 /**
- * This function changes the state of the object at a fixed rate
+ * This function changes the state of the object at a fixed rate.
+ * fixedUpdateAll does this for every body at once; this runs the same kernel on one row.
  *
  * @param (float dt) The elapsed time since the last fixedUpdate in milliseconds
  */
 void Physics::fixedUpdate( float dt ) {
-  parent->x += dx * dt;
-  parent->y += dy * dt;
+  bodyStore().integrate( parent->body, parent->body + 1, dt );
 };
 
 /*End Physics------------------------------------------------------*/
@@ -264,38 +971,21 @@ void Physics::fixedUpdate( float dt ) {
  * @param (double radius) the radius of the ball
  */
 WallBounceScript::WallBounceScript( GameObject* parent, double radius ) :
-radius ( radius ), Component (parent, string( "WallBounceScript" )) {};
+Component (parent, string( "WallBounceScript" ), WALL_BOUNCE_TYPE), radius ( &bodyStore().wallRadius, &parent->body ) {
+  this->radius = radius;
+};
 
 /* This function takes in a float (dt) representing the time since the last fixedUpdate
  * This function updates the x and y speeds in the Physics component of the GameObject to make objects bounce off walls.
  */
 
 /**
- * This function snsures that GameObjects don't leave the screen
+ * This function snsures that GameObjects don't leave the screen.
+ * fixedUpdateAll does this for every body at once; this runs the same kernel on one row.
  *
  * @param (float dt) The elapsed time since the last fixedUpdate in milliseconds
  */
 void WallBounceScript::fixedUpdate( float dt ) {
-  double x = parent->x;
-  double y = parent->y;
-  Physics* physComp = dynamic_cast<Physics*> (parent->getComponent(string("Physics")).front());
-  double dx = physComp->dx;
-  double dy = physComp->dy;
-
-  if (x+radius >= 1) {
-    dx = -1 * fabs(dx);
-  }
-  if (x-radius <= -1) {
-    dx = fabs(dx);
-  }
-  if (y+radius >= 1) {
-    dy = -1 * fabs(dy);
-  }
-  if (y-radius <= -1) {
-    dy = fabs(dy);
-  }
-
-  physComp->dx = dx;
-  physComp->dy = dy;
+  bodyStore().bounceWalls( parent->body, parent->body + 1 );
 }
 /*End WalBounceScript-------------------------------------------------------*/
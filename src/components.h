@@ -3,85 +3,225 @@
 
 #include <list>
 #include <string>
+#include <vector>
+#include "broadphase.h"
+#include "bodies.h"
+#include "jobs.h"
+#include "render.h"
+#include "softraster.h"
+#include "trace.h"
+#include "snapshot.h"
+#include "scene.h"
+#include "sleep.h"
+#include "publish.h"
+#include "domain.h"
+#include "ensemble.h"
+#include "stream.h"
 
 using namespace std;
 
 //g++ -std=c++11 components.cpp -o components && ./components
 
+// Slot indices for the built in component types, used by GameObject::get<T>()
+enum componentTypeId_t {
+  CIRCLE_RENDER_TYPE,
+  COLLIDER_TYPE,
+  PHYSICS_TYPE,
+  WALL_BOUNCE_TYPE,
+  BUILTIN_COMPONENT_TYPES, // Number of slots; also the id of components without a slot
+};
+
 class Component; // Forward declaration to resolve circular dependency
+class ArchetypeBase;
 class GameObject {
   friend class Component;
+  friend class BodyStore;
+  friend class ArchetypeBase;
   private:
   	list<Component*> componentList;
-  	void addComponent( Component* c );
+  	Component* slots[BUILTIN_COMPONENT_TYPES]; // First component of each built in type, or NULL
+  	void addComponent( Component* c, int typeId );
+  	GameObject( const GameObject& ); // Not copyable: fields are bound to this object's body row
+  	explicit GameObject( int body ); // Take ownership of an existing row that has no GameObject yet
+  	~GameObject(); // Deletes the components; only BodyStore::removeQueued deletes GameObjects
 
   public:
   	GameObject( double x, double y );
-  	list<Component*> getComponent( string type );	// Returns a list of all components matching the type parameter
-  	double x;
-  	double y;
+  	void destroy(); // Remove this object and its components at the start of the next fixed step. Safe to call from triggers
+  	static void* operator new( size_t bytes ) { return bodyStore().pool.allocate( bytes ); }
+  	static void operator delete( void* block, size_t bytes ) { bodyStore().pool.release( block, bytes ); }
+  	list<Component*> getComponent( string type );	// Returns a list of all components matching the type parameter. Slow path, prefer get<T>()
+  	template <class T> T* get() { return static_cast<T*>( slots[T::typeId] ); } // Returns the first component of type T, or NULL
+  	int body; // Row of this object in bodyStore
+  	BodyField x;
+  	BodyField y;
 };
 
 class Component {
+  friend class ArchetypeBase;
+  friend class World;
 	private:
-  	static list<Component*> components;
+  	// The state below belongs to the current World; these return its copy, see world.h
+  	static vector<Component*>& components();
+  	static vector<Component*>& scriptedComponents(); // Components without a built in type; their fixedUpdate is called virtually
+  	static vector<Component*>& destroyQueue(); // Components to remove at the start of the next fixed step
+  	static mutex destroyLock;
+  	int slot; // Built in type slot, or BUILTIN_COMPONENT_TYPES
+  	int componentsIndex; // Position in components
+  	int scriptedIndex; // Position in scriptedComponents, or -1
+  	ArchetypeBase* archetype; // Archetype this component is updated by, or NULL
+  	int archetypeIndex; // Instance of archetype this component belongs to
+  	bool archetypeLead; // Whether its instance runs from this component's place in scriptedComponents
+  	struct scriptRun_t {
+  	  ArchetypeBase* archetype; // Archetype whose instances run, or NULL for components called virtually
+  	  int first;                // First place in scriptedComponents, or in runInstances when archetype is set
+  	  int count;
+  	};
+  	static vector<scriptRun_t>& scriptRuns(); // scriptedComponents cut into runs, see scheduleScripts
+  	static vector<int>& runInstances();       // Instances of the archetype runs
+  	static size_t& scheduledSize();           // Components scriptRuns cover
+  	static unsigned long& scriptedVersion();  // Changed whenever scriptedComponents or a claim on one of them changes
+  	static unsigned long& scheduledVersion(); // scriptedVersion scriptRuns were made for
+  	static void scheduleScripts();
+  	static void runScripts( float dt, bool fixed ); // update() or fixedUpdate() of every component in scriptedComponents
+#ifdef ENABLE_PROFILING
+  	const char* updateZone; // Profiler zone names of update() and fixedUpdate(), interned once when a scripted component is created
+  	const char* fixedUpdateZone;
+#endif
+  	void detach(); // Take this component off its parent
 
   public:
-  	Component( GameObject* parent, string type ); // Similar as an init method: In this case, initilizes the type and parent fields, and adds self to the static components list.
+  	Component( GameObject* parent, string type, int typeId = BUILTIN_COMPONENT_TYPES ); // Similar as an init method: In this case, initilizes the type and parent fields, and adds self to the static components list.
+  	virtual ~Component(); // Removes self from the static components lists
+  	void destroy(); // Remove this component at the start of the next fixed step. Safe to call from triggers
+  	static void removeDestroyed(); // Remove every destroyed component and GameObject; runs at the start of fixedUpdateAll
+  	static void* operator new( size_t bytes ) { return bodyStore().pool.allocate( bytes ); }
+  	static void operator delete( void* block, size_t bytes ) { bodyStore().pool.release( block, bytes ); }
   	static void updateAll( float dt );  // Run all variable updates (eg renderAll)
   	static void fixedUpdateAll( float dt ); // Updates on fixed interval (eg physicsUpdateAll)
+  	static void fixedUpdateScripts( float dt ); // The fixedUpdate of every component without a built in type; part of fixedUpdateAll
   	virtual void update( float dt );
   	virtual void fixedUpdate( float dt );
   	const string type;
   	GameObject* const parent; // Declare the pointer constant without making the data constant
 };
 
-struct color_t {
-  float R;
-  float G;
-  float B;
-};
+// The built in components below keep their state in bodyStore columns. A GameObject should
+// carry at most one of each; a second one shares the first one's columns.
 
 class CircleRender : public Component {
-  private:
-    color_t color;
-
   public:
+    static const int typeId = CIRCLE_RENDER_TYPE;
     CircleRender( GameObject* parent, double radius);
     void setColor(float R, float G, float B);
-    double radius;
+    BodyField radius;
     void update( float dt );
+    static void renderAll(); // Draw every CircleRender through renderBackend
 };
 
 class Physics : public Component {
   public:
+    static const int typeId = PHYSICS_TYPE;
     Physics ( GameObject* parent, double dx = 0, double dy = 0, double mass = 1 );
     void fixedUpdate( float dt );
-    double dx;
-    double dy;
-    double mass;
+    BodyField dx;
+    BodyField dy;
+    BodyField mass;
 };
 
 class WallBounceScript : public Component {
   public:
+    static const int typeId = WALL_BOUNCE_TYPE;
     WallBounceScript( GameObject* parent, double radius );
     void fixedUpdate( float dt );
-    double radius;
+    BodyField radius;
 };
 
 class Collider; //Forward declaration, alerts the compiler that collider is coming
   typedef void ( * triggerFunc ) ( Collider* c1, Collider* c2, float dt); //New type called triggerFunc, takes a Collider pointer returns void
-  list<Component*> Component::components;
+
+  //Bits of contact_t::phase
+  enum collisionPhase_t {
+    COLLISION_ENTER = 1, //The pair touches now but did not after the previous step
+    COLLISION_STAY = 2,  //The pair touched after the previous step too
+    COLLISION_EXIT = 4,  //The pair touched after the previous step but no longer does
+  };
+
+  struct contact_t {
+    Collider* a; //The collider whose body row comes first; NULL in an exit event if it was removed
+    Collider* b;
+    int bodyA; //Body rows of a and b; -1 in an exit event if the body was removed
+    int bodyB;
+    float normalX; //Unit vector from a towards b
+    float normalY;
+    float penetration; //How far the colliders overlap; negative when an exit event's colliders are apart
+    float relativeDx; //Velocity of b minus that of a
+    float relativeDy;
+    int phase; //A collisionPhase_t, set by classifyContacts()
+  };
+
+  typedef void ( * collisionHandler ) ( const contact_t* events, int count, float dt ); //Gets every event of a step at once
+  typedef void ( * collisionListener ) ( const contact_t& event, float dt ); //Gets one event
+
+  struct collisionSubscriber_t {
+    collisionHandler handler; //Set for a handler
+    collisionListener listener; //Set for a listener, with the collisionPhase_t bits it wants
+    unsigned int phases;
+  };
+
+  struct impact_t;
+
   class Collider : public Component{
+    friend class World;
     private:
-      double radius;
-      static list<Collider*> allColliders; //List of colliders
-      list<triggerFunc> triggers; //list of trigger functions
+      BodyField radius;
+      static vector< pair<string, triggerFunc> > registeredTriggers; //Trigger functions that can be saved by name
+
+      //The state below belongs to the current World; these return its copy, see world.h
+      static SpatialHash& grid(); //Broadphase grid of the awake colliders, rebuilt once per fixed step
+      static vector<int>& indexed(); //Body rows that have an awake Collider, in row order; grid ids index into this
+      static double& maxRadius(); //Largest awake collider radius at the last build
+      static SpatialHash& sleepingGrid(); //Broadphase grid of the sleeping colliders, rebuilt when rows move or recentGrid grows too large
+      static vector<int>& sleepingIndexed(); //Body rows that have a sleeping Collider, in row order
+      static double& sleepingMaxRadius();
+      static unsigned long& sleepingVersion(); //bodyStore.version at the last sleepingGrid build
+      static SpatialHash& recentGrid(); //Broadphase grid of the colliders that fell asleep since sleepingGrid was built
+      static vector<int>& recentIndexed(); //Body rows of the colliders in recentGrid, in row order
+      static vector< vector<contact_t> >& chunkContacts(); //Contacts found by each narrowphase chunk, joined in chunk order
+      static vector<long>& chunkPairTests(); //Pairs distance tested by each narrowphase chunk
+      static vector<int>& batchStart(); //Contacts of batch k are contacts[batchStart[k]..batchStart[k+1]) after batchContacts()
+      static void batchContacts(); //Reorder contacts into batches that share no body
+      static long fireTriggers( const contact_t& contact, float dt ); //Run the triggers of one contact; returns how many ran
+      static vector<unsigned long long>& touching(); //Pairs touching after the last step as bodyA << 32 | bodyB, sorted
+      static vector<collisionSubscriber_t> subscribers; //In the order they subscribed
+      static void predictImpacts( double horizon, vector<impact_t>& impacts ); //Every impact within horizon ms from now, earliest first
 
     public:
+      static const int typeId = COLLIDER_TYPE;
       void addTrigger(triggerFunc trigger);  //add trigger
+      static vector< vector<triggerFunc> >& triggerSets(); //Distinct trigger lists of the current World; bodyStore.triggerSet picks one per body. Set 0 is empty
+      static unsigned int internTriggerSet( const vector<triggerFunc>& triggers ); //Index of the set holding exactly these triggers, added if new
+      static void registerTrigger( const string& name, triggerFunc trigger ); //Give a trigger a name so snapshots can store it
+      static triggerFunc findTrigger( const string& name ); //Registered trigger with this name, or NULL
+      static const string* triggerName( triggerFunc trigger ); //Registered name of a trigger, or NULL
       Collider( GameObject* parent, double radius); //Collider init
-      void fixedUpdate ( float dt ); //Update for a collider
+      static vector<contact_t>& contacts(); //Overlapping pairs found by the last generateContacts, each pair once
+      static long& pairTests(); //Candidate pairs the last generateContacts tested for overlap
+      static void updateBroadphase(); //Rebuild the grid from the current positions
+      static void generateContacts(); //Fill contacts with every overlapping pair
+      static void measureContact( contact_t& contact ); //Fill in the normal, penetration and relative velocity from the bodies
+      static void classifyContacts(); //Set the phase of every contact and fill events
+      static void resolveContacts( float dt ); //Run the triggers of every contact, one batch at a time
+      static int& continuousSubsteps(); //Most substeps of a swept step; 0 tests for overlap once per step instead
+      static int& lastSubsteps(); //Substeps used by the last sweepStep
+      static void sweepStep( float dt ); //Move every body by dt, resolving each impact at its time of impact
+      static vector<contact_t>& events(); //Contacts of the last step in the order they were found, followed by exits
+      static void subscribe( collisionHandler handler ); //Call handler with every step's events
+      static void subscribe( unsigned int phases, collisionListener listener ); //Call listener for each event whose phase is in phases
+      static void dispatchEvents( float dt ); //Hand events to the subscribers; runs after the triggers
   };
 
+#include "archetype.h"
+#include "world.h"
+
 #endif
@@ -0,0 +1,324 @@
+/*-------------------------------------------------------
+
+Implements continuous (swept) collision: every ball-ball
+and ball-wall impact inside a step is found from the
+velocities and resolved at its time of impact.
+
+---------------------------------------------------------*/
+
+#include <math.h>
+#include <algorithm>
+
+// Colliders per swept narrowphase chunk; fixed so the result never depends on the thread count
+#define SWEEP_CHUNK 1024
+#define SWEEP_WALL -1 // bodyB of an impact with a +-1 wall
+
+// Times of impact and the positions at them are found in double, except in fixed point builds,
+// where they stay in Fixed so a swept step never depends on how the compiler rounds
+#if defined( SCALAR_FIXED )
+typedef Fixed sweep_t;
+#else
+typedef double sweep_t;
+#endif
+
+static inline sweep_t toSweep( scalar_t v ) { return (sweep_t) v; }
+
+// The smallest whole number at least v, for 0 <= v < 2^23
+static inline int sweepCeil( double v ) { return (int) ceil( v ); }
+static inline int sweepCeil( Fixed v ) {
+  return (int) ((v.raw + ((int64_t) 1 << FIXED_FRACTION_BITS) - 1) >> FIXED_FRACTION_BITS);
+}
+
+/* One predicted impact. Impacts are handled in order of (time, bodyA, bodyB) so the result is
+ * the same for any number of threads.
+ */
+struct impact_t {
+  sweep_t time; // ms after the start of the substep
+  int bodyA;
+  int bodyB;   // SWEEP_WALL for a wall
+};
+
+static bool impactBefore( const impact_t& p, const impact_t& q ) {
+  if (p.time != q.time) return p.time < q.time;
+  if (p.bodyA != q.bodyA) return p.bodyA < q.bodyA;
+  return p.bodyB < q.bodyB;
+}
+
+/*Begin Time of impact-------------------------------------------------------*/
+
+/* This function returns when two moving circles first touch, or -1 if they do not within the
+ * horizon. Circles that already overlap and are still approaching touch at 0; circles moving
+ * apart never do.
+ *
+ * @param (sweep_t px, sweep_t py) position of b relative to a
+ * @param (sweep_t vx, sweep_t vy) velocity of b relative to a, per ms
+ * @param (sweep_t reach) the sum of both radii
+ * @param (sweep_t horizon) the latest time of interest in ms
+ */
+static sweep_t pairTimeOfImpact( sweep_t px, sweep_t py, sweep_t vx, sweep_t vy, sweep_t reach, sweep_t horizon ) {
+  const sweep_t zero = sweep_t( 0 );
+  const sweep_t never = sweep_t( -1 );
+  sweep_t closing = px * vx + py * vy;
+  if (closing >= zero) return never;
+  sweep_t gap = px * px + py * py - reach * reach;
+  if (gap <= zero) return zero;
+  sweep_t speed = vx * vx + vy * vy;
+  sweep_t discriminant = closing * closing - speed * gap;
+  if (discriminant < zero) return never;
+  sweep_t time = (-closing - scalarSqrt( discriminant )) / speed;
+  return time <= horizon ? time : never;
+}
+
+/* This function returns when one coordinate of a circle reaches a +-1 wall it is moving towards,
+ * or -1 if it does not within the horizon. A circle already past the wall hits it at 0.
+ *
+ * @param (sweep_t p) the coordinate
+ * @param (sweep_t v) its velocity per ms
+ * @param (sweep_t radius) the wall radius of the circle
+ * @param (sweep_t horizon) the latest time of interest in ms
+ */
+static sweep_t wallTimeOfImpact( sweep_t p, sweep_t v, sweep_t radius, sweep_t horizon ) {
+  const sweep_t zero = sweep_t( 0 );
+  const sweep_t one = sweep_t( 1 );
+  sweep_t time;
+  if (v > zero) time = (one - radius - p) / v;
+  else if (v < zero) time = (-one + radius - p) / v;
+  else return sweep_t( -1 );
+  if (time < zero) time = zero;
+  return time <= horizon ? time : sweep_t( -1 );
+}
+
+/* This function returns the earliest wall impact of a body, or -1 if none is within the horizon
+ *
+ * @param (int i) the body row
+ * @param (sweep_t horizon) the latest time of interest in ms
+ */
+static sweep_t bodyWallTimeOfImpact( int i, sweep_t horizon ) {
+  sweep_t radius = toSweep( bodyStore().wallRadius[i] );
+  sweep_t tx = wallTimeOfImpact( toSweep( bodyStore().x[i] ), toSweep( bodyStore().dx[i] ), radius, horizon );
+  sweep_t ty = wallTimeOfImpact( toSweep( bodyStore().y[i] ), toSweep( bodyStore().dy[i] ), radius, horizon );
+  if (tx < sweep_t( 0 )) return ty;
+  if (ty < sweep_t( 0 )) return tx;
+  return min( tx, ty );
+}
+
+/*End Time of impact-------------------------------------------------------*/
+
+/*Begin Swept step-------------------------------------------------------*/
+
+/* This function picks how many substeps a swept step is split into: enough that no body moves
+ * further than the smallest collider radius per substep, so an impact missed because an earlier
+ * one changed a velocity shows up as a shallow overlap in the next substep rather than a body
+ * passing through another. At most continuousSubsteps are used.
+ *
+ * @param (double dt) the fixed step in ms
+ */
+static int sweepSubsteps( double dt ) {
+  const sweep_t zero = sweep_t( 0 );
+  sweep_t fastest = zero;
+  sweep_t smallest = sweep_t( -1 ); // None yet
+  for (int i = 0; i < bodyStore().size(); i++) {
+    if (!(bodyStore().mask[i] & BODY_HAS( PHYSICS_TYPE ))) continue;
+    sweep_t dx = toSweep( bodyStore().dx[i] );
+    sweep_t dy = toSweep( bodyStore().dy[i] );
+    fastest = max( fastest, dx * dx + dy * dy );
+    sweep_t radius = toSweep( bodyStore().colliderRadius[i] );
+    if ((bodyStore().mask[i] & BODY_HAS( COLLIDER_TYPE )) && (smallest < zero || radius < smallest)) smallest = radius;
+  }
+  if (smallest < zero || fastest == zero) return 1;
+  sweep_t substeps = scalarSqrt( fastest ) * sweep_t( dt ) / smallest;
+  if (substeps >= sweep_t( Collider::continuousSubsteps() )) return Collider::continuousSubsteps();
+  return max( 1, sweepCeil( substeps ) );
+}
+
+/**
+ * This function finds every impact predicted within one substep from the current positions
+ * and velocities. Colliders are put in the broadphase grid by where they start, and each is
+ * tested against everything its swept circle could reach. Pairs and walls are tested in
+ * parallel, fixed size chunks, and the impacts are then sorted by time.
+ *
+ * @param (double horizonMs) the substep length in ms, which a fixed point build gets back exactly
+ * @param (vector<impact_t>& impacts) receives the impacts, earliest first
+ */
+void Collider::predictImpacts( double horizonMs, vector<impact_t>& impacts ) {
+  PROFILE_SCOPE( "Collider sweep" );
+  // Scratch of this thread, so worlds on other threads sweep at the same time. Bound to
+  // references for the chunks, which may run on jobPool's threads
+  static thread_local vector< vector<impact_t> > chunkScratch;
+  static thread_local vector<double> reachScratch;
+  vector< vector<impact_t> >& chunkImpacts = chunkScratch;
+  vector<double>& reachOf = reachScratch; // Only used to pick candidates from the grid, so kept in double
+  double maxReach = 0;
+  sweep_t horizon = sweep_t( horizonMs );
+  indexed().clear();
+  reachOf.clear();
+  for(int i = 0; i < bodyStore().size(); i++) {
+    if (!(bodyStore().mask[i] & BODY_HAS( COLLIDER_TYPE ))) continue;
+    double speed = sqrt( bodyStore().dx[i] * bodyStore().dx[i] + bodyStore().dy[i] * bodyStore().dy[i] );
+    double reach = bodyStore().colliderRadius[i] + speed * horizonMs;
+    maxReach = max( maxReach, reach );
+    indexed().push_back( i );
+    reachOf.push_back( reach );
+  }
+  grid().clear( 2 * maxReach );
+  for(int i = 0; i < (int) indexed().size(); i++) grid().insert( i, bodyStore().x[indexed()[i]], bodyStore().y[indexed()[i]] );
+  grid().build();
+
+  int pairChunks = ((int) indexed().size() + SWEEP_CHUNK - 1) / SWEEP_CHUNK;
+  int wallChunks = (bodyStore().size() + SWEEP_CHUNK - 1) / SWEEP_CHUNK;
+  chunkImpacts.resize( pairChunks + wallChunks );
+  chunkPairTests().assign( pairChunks, 0 );
+  jobPool.parallelFor( pairChunks + wallChunks, 1, [&chunkImpacts, &reachOf, pairChunks, horizon, maxReach]( int chunkBegin, int chunkEnd ) {
+    vector<int> candidates;
+    for(int chunk = chunkBegin; chunk < chunkEnd; chunk++) {
+      vector<impact_t>& out = chunkImpacts[chunk];
+      out.clear();
+      if (chunk >= pairChunks) {
+        const unsigned int needed = BODY_HAS( PHYSICS_TYPE ) | BODY_HAS( WALL_BOUNCE_TYPE );
+        int end = min( bodyStore().size(), (chunk - pairChunks + 1) * SWEEP_CHUNK );
+        for(int i = (chunk - pairChunks) * SWEEP_CHUNK; i < end; i++) {
+          if ((bodyStore().mask[i] & needed) != needed) continue;
+          sweep_t time = bodyWallTimeOfImpact( i, horizon );
+          if (time >= sweep_t( 0 )) out.push_back( impact_t { time, i, SWEEP_WALL } );
+        }
+        continue;
+      }
+
+      long tests = 0;
+      int end = min( (int) indexed().size(), (chunk + 1) * SWEEP_CHUNK );
+      for(int i = chunk * SWEEP_CHUNK; i < end; i++) {
+        int a = indexed()[i];
+        double x = bodyStore().x[a];
+        double y = bodyStore().y[a];
+        double reach = reachOf[i] + maxReach;
+
+        candidates.clear();
+        grid().query( x - reach, y - reach, x + reach, y + reach, candidates );
+        for(int j: candidates) {
+          if (j <= i) continue;
+          int b = indexed()[j];
+          tests++;
+          sweep_t time = pairTimeOfImpact( toSweep( bodyStore().x[b] ) - toSweep( bodyStore().x[a] ), toSweep( bodyStore().y[b] ) - toSweep( bodyStore().y[a] ),
+            toSweep( bodyStore().dx[b] ) - toSweep( bodyStore().dx[a] ), toSweep( bodyStore().dy[b] ) - toSweep( bodyStore().dy[a] ),
+            toSweep( bodyStore().colliderRadius[a] ) + toSweep( bodyStore().colliderRadius[b] ), horizon );
+          if (time >= sweep_t( 0 )) out.push_back( impact_t { time, a, b } );
+        }
+      }
+      chunkPairTests()[chunk] = tests;
+    }
+  });
+
+  long tests = 0;
+  for(long chunkTests: chunkPairTests()) tests += chunkTests;
+  pairTests() += tests;
+  PROFILE_COUNT( PROFILE_PAIR_TESTS, tests );
+  impacts.clear();
+  for(const vector<impact_t>& out: chunkImpacts) impacts.insert( impacts.end(), out.begin(), out.end() );
+  sort( impacts.begin(), impacts.end(), impactBefore );
+}
+
+/**
+ * This function advances the world by one fixed step with continuous collision instead of
+ * moving every body by dt and testing for overlap. The step is split into substeps (see
+ * sweepSubsteps); in each one the predicted impacts are handled one after the other, earliest
+ * first. The bodies involved are moved to the moment they touch, recomputed from their
+ * current velocities since an earlier impact may have changed them, and then bounce off the
+ * wall or run their triggers right there. Everything is finally moved to the end of the
+ * substep by the usual integration kernel, which also keeps the discrete wall test as a
+ * safety net.
+ *
+ * Triggers are called one at a time and get a dt of 0: the bodies are exactly touching, so
+ * there is nothing to back off from. Every impact of the step is left in contacts.
+ *
+ * @param (float dt) the fixed step in milliseconds
+ */
+void Collider::sweepStep( float dt ) {
+  static thread_local vector<impact_t> impacts;
+  static thread_local vector<sweep_t> bodyTime; // Time each body has been moved to within the substep
+  static thread_local vector<int> moved;        // Rows whose bodyTime is not 0
+  const sweep_t zero = sweep_t( 0 );
+  int substeps = sweepSubsteps( dt );
+  sweep_t horizon = sweep_t( (double) dt ) / sweep_t( (double) substeps );
+  lastSubsteps() = substeps;
+  pairTests() = 0;
+  contacts().clear();
+  bodyTime.assign( bodyStore().size(), zero );
+
+  for(int substep = 0; substep < substeps; substep++) {
+    predictImpacts( (double) horizon, impacts );
+
+    PROFILE_SCOPE( "Collider impacts" );
+    moved.clear();
+    long fired = 0;
+    for(const impact_t& impact: impacts) {
+      int a = impact.bodyA;
+      int b = impact.bodyB;
+      // Bring the bodies to a common time, then find when they touch from their current velocities
+      sweep_t start = b == SWEEP_WALL ? bodyTime[a] : max( bodyTime[a], bodyTime[b] );
+      sweep_t remaining = horizon - start;
+      sweep_t time;
+      sweep_t adx = toSweep( bodyStore().dx[a] );
+      sweep_t ady = toSweep( bodyStore().dy[a] );
+      if (b == SWEEP_WALL) {
+        sweep_t move = start - bodyTime[a];
+        sweep_t x = toSweep( bodyStore().x[a] ) + adx * move;
+        sweep_t y = toSweep( bodyStore().y[a] ) + ady * move;
+        sweep_t r = toSweep( bodyStore().wallRadius[a] );
+        sweep_t tx = wallTimeOfImpact( x, adx, r, remaining );
+        sweep_t ty = wallTimeOfImpact( y, ady, r, remaining );
+        time = tx < zero ? ty : ty < zero ? tx : min( tx, ty );
+        if (time < zero) continue;
+        if (bodyTime[a] == zero) moved.push_back( a );
+        bodyStore().x[a] = toScalar( x + adx * time );
+        bodyStore().y[a] = toScalar( y + ady * time );
+        bodyTime[a] = start + time;
+        if (tx == time) bodyStore().dx[a] = adx > zero ? -scalarAbs( bodyStore().dx[a] ) : scalarAbs( bodyStore().dx[a] );
+        if (ty == time) bodyStore().dy[a] = ady > zero ? -scalarAbs( bodyStore().dy[a] ) : scalarAbs( bodyStore().dy[a] );
+        continue;
+      }
+
+      sweep_t bdx = toSweep( bodyStore().dx[b] );
+      sweep_t bdy = toSweep( bodyStore().dy[b] );
+      sweep_t ax = toSweep( bodyStore().x[a] ) + adx * (start - bodyTime[a]);
+      sweep_t ay = toSweep( bodyStore().y[a] ) + ady * (start - bodyTime[a]);
+      sweep_t bx = toSweep( bodyStore().x[b] ) + bdx * (start - bodyTime[b]);
+      sweep_t by = toSweep( bodyStore().y[b] ) + bdy * (start - bodyTime[b]);
+      time = pairTimeOfImpact( bx - ax, by - ay, bdx - adx, bdy - ady,
+        toSweep( bodyStore().colliderRadius[a] ) + toSweep( bodyStore().colliderRadius[b] ), remaining );
+      if (time < zero) continue;
+      // A sleeping body that is hit has to move again from here on
+      wakeBody( a );
+      wakeBody( b );
+      if (bodyTime[a] == zero) moved.push_back( a );
+      if (bodyTime[b] == zero) moved.push_back( b );
+      bodyStore().x[a] = toScalar( ax + adx * time );
+      bodyStore().y[a] = toScalar( ay + ady * time );
+      bodyStore().x[b] = toScalar( bx + bdx * time );
+      bodyStore().y[b] = toScalar( by + bdy * time );
+      bodyTime[a] = bodyTime[b] = start + time;
+
+      contact_t contact;
+      contact.a = bodyStore().object( a )->get<Collider>();
+      contact.b = bodyStore().object( b )->get<Collider>();
+      contact.bodyA = a;
+      contact.bodyB = b;
+      measureContact( contact );
+      fired += fireTriggers( contact, 0 );
+      contacts().push_back( contact );
+    }
+    PROFILE_COUNT( PROFILE_TRIGGERS, fired );
+
+    // Put every moved body back where its new velocity would have had it at the start of the
+    // substep, so one integration pass over all rows takes everything to the end of it. A row
+    // listed twice is only moved once, since its time is 0 after the first
+    for(int i: moved) {
+      bodyStore().x[i] = toScalar( toSweep( bodyStore().x[i] ) - toSweep( bodyStore().dx[i] ) * bodyTime[i] );
+      bodyStore().y[i] = toScalar( toSweep( bodyStore().y[i] ) - toSweep( bodyStore().dy[i] ) * bodyTime[i] );
+      bodyTime[i] = zero;
+    }
+    bodyStore().integrateAll( (double) horizon );
+  }
+  PROFILE_COUNT( PROFILE_CONTACTS, contacts().size() );
+}
+
+/*End Swept step-------------------------------------------------------*/
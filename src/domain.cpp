@@ -0,0 +1,447 @@
+/*-------------------------------------------------------
+
+Implements domain decomposed runs: worker processes that
+each simulate one strip of the world, exchanging bodies
+near the borders and the contacts that cross them.
+
+---------------------------------------------------------*/
+
+#include "domain.h"
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <algorithm>
+
+#define DOMAIN_COORDINATOR 0 // Endpoint of the coordinator; the worker of strip d is endpoint d + 1
+
+static SharedMemoryTransport* domainTransport = NULL;
+static int domainCount = 0;
+static double domainHalo = 0;      // Bodies this close to another strip are copied to its worker
+static vector<pid_t> domainWorkers;
+static int domainSelf = -1;        // Strip of this worker
+static vector<uint32_t> domainIds; // Coordinator row of every row of this worker
+static vector<char> domainOwned;   // Whether each row belongs to this worker rather than being a copy
+
+/*Begin Strips-------------------------------------------------------*/
+
+/* This function returns the strip a position belongs to. Positions outside the walls belong to
+ * the nearest strip.
+ *
+ * @param (double x) the position
+ */
+static int domainOf( double x ) {
+  int d = (int) floor( (x + 1) * domainCount / 2 );
+  return min( domainCount - 1, max( 0, d ) );
+}
+
+/* This function returns how far a position is from a strip, 0 inside it
+ *
+ * @param (double x) the position
+ * @param (int d) the strip
+ */
+static double distanceToDomain( double x, int d ) {
+  double low = d == 0 ? -HUGE_VAL : -1 + 2.0 * d / domainCount;
+  double high = d == domainCount - 1 ? HUGE_VAL : -1 + 2.0 * (d + 1) / domainCount;
+  return x < low ? low - x : x > high ? x - high : 0;
+}
+
+/*End Strips-------------------------------------------------------*/
+
+/*Begin Bodies-------------------------------------------------------*/
+
+/* This function copies a row into a domainBody_t
+ *
+ * @param (int row) the row
+ * @param (uint32_t id) the coordinator row of the body
+ * @param (domainBody_t& body) receives the body
+ */
+static void packBody( int row, uint32_t id, domainBody_t& body ) {
+  body.id = id;
+  body.mask = bodyStore().mask[row];
+  body.triggerSet = bodyStore().triggerSet[row];
+  body.color = bodyStore().color[row];
+  body.x = bodyStore().x[row];
+  body.y = bodyStore().y[row];
+  body.dx = bodyStore().dx[row];
+  body.dy = bodyStore().dy[row];
+  body.mass = bodyStore().mass[row];
+  body.colliderRadius = bodyStore().colliderRadius[row];
+  body.wallRadius = bodyStore().wallRadius[row];
+  body.renderRadius = bodyStore().renderRadius[row];
+}
+
+/* This function copies a domainBody_t into a row
+ *
+ * @param (int row) the row
+ * @param (const domainBody_t& body) the body
+ */
+static void storeBody( int row, const domainBody_t& body ) {
+  bodyStore().mask[row] = body.mask;
+  bodyStore().triggerSet[row] = body.triggerSet;
+  bodyStore().color[row] = body.color;
+  bodyStore().x[row] = body.x;
+  bodyStore().y[row] = body.y;
+  bodyStore().dx[row] = body.dx;
+  bodyStore().dy[row] = body.dy;
+  bodyStore().mass[row] = body.mass;
+  bodyStore().colliderRadius[row] = body.colliderRadius;
+  bodyStore().wallRadius[row] = body.wallRadius;
+  bodyStore().renderRadius[row] = body.renderRadius;
+}
+
+/* This function appends a list of bodies to a message
+ *
+ * @param (vector<uint8_t>& message) the message
+ * @param (const vector<domainBody_t>& bodies) the bodies
+ */
+static void putBodies( vector<uint8_t>& message, const vector<domainBody_t>& bodies ) {
+  put<uint32_t>( message, (uint32_t) bodies.size() );
+  const uint8_t* bytes = (const uint8_t*) bodies.data();
+  message.insert( message.end(), bytes, bytes + bodies.size() * sizeof( domainBody_t ) );
+}
+
+/* This function reads a list of bodies written by putBodies
+ *
+ * @param (const vector<uint8_t>& message) the message
+ * @param (size_t& at) offset of the list; moved past it
+ * @param (vector<domainBody_t>& bodies) receives the bodies
+ */
+static void getBodies( const vector<uint8_t>& message, size_t& at, vector<domainBody_t>& bodies ) {
+  uint32_t count = get<uint32_t>( message.data(), at );
+  bodies.resize( count );
+  memcpy( bodies.data(), message.data() + at, count * sizeof( domainBody_t ) );
+  at += count * sizeof( domainBody_t );
+}
+
+/* This function removes the rows queued for removal, along with destroyed components, and
+ * keeps domainIds in step with the rows that moved. Every row left belongs to this worker.
+ */
+static void removeCopies() {
+  Component::removeDestroyed();
+  static vector<uint32_t> moved;
+  moved.clear();
+  for (const pair<int, int>& entry: bodyStore().renamed) moved.push_back( domainIds[entry.first] );
+  for (size_t k = 0; k < moved.size(); k++) {
+    if (bodyStore().renamed[k].second >= 0) domainIds[bodyStore().renamed[k].second] = moved[k];
+  }
+  bodyStore().renamed.clear();
+  domainIds.resize( bodyStore().size() );
+  domainOwned.assign( bodyStore().size(), 1 );
+}
+
+/*End Bodies-------------------------------------------------------*/
+
+/*Begin Worker-------------------------------------------------------*/
+
+/* This function swaps a message with another endpoint. The endpoint with the lower number
+ * sends first, so as long as every process goes through its peers in increasing order no two
+ * of them ever wait on each other, however large the messages are.
+ *
+ * @param (int peer) the other endpoint
+ * @param (const vector<uint8_t>& out) the message to send
+ * @param (vector<uint8_t>& in) receives its message
+ */
+static void exchange( int peer, const vector<uint8_t>& out, vector<uint8_t>& in ) {
+  if (domainTransport->self() < peer) {
+    domainTransport->send( peer, out );
+    domainTransport->receive( peer, in );
+  } else {
+    domainTransport->receive( peer, in );
+    domainTransport->send( peer, out );
+  }
+}
+
+/* This function returns the representative row of a group of touching bodies, flattening the
+ * path to it
+ *
+ * @param (vector<int>& parent) the union find forest, by row
+ * @param (int row) the row
+ */
+static int groupRoot( vector<int>& parent, int row ) {
+  while (parent[row] != row) {
+    parent[row] = parent[parent[row]];
+    row = parent[row];
+  }
+  return row;
+}
+
+/**
+ * This function runs one fixed step of a worker, see domain.h. Rows that left the strip stay
+ * as copies until the start of the next step, when they are removed together with the halo
+ * copies and destroyed objects, just as a single process removes destroyed objects then.
+ *
+ * @param (float dt) the fixed step in milliseconds
+ */
+static void domainWorkerStep( float dt ) {
+  static vector< vector<domainBody_t> > leaving;
+  static vector< vector<domainBody_t> > halo;
+  static vector<domainBody_t> arriving, copies, received;
+  static vector<uint8_t> out, in;
+  static vector<contact_t> local, border;
+  static vector<int> parent, sentRows;
+  static vector<char> crosses, listed;
+
+  removeCopies();
+  bodyStore().integrateAll( dt );
+  Component::fixedUpdateScripts( dt );
+
+  // Hand bodies that left the strip to their new owner and copy those near a border across it
+  leaving.resize( domainCount );
+  halo.resize( domainCount );
+  for (int d = 0; d < domainCount; d++) {
+    leaving[d].clear();
+    halo[d].clear();
+  }
+  int n = bodyStore().size();
+  for (int row = 0; row < n; row++) {
+    double x = bodyStore().x[row];
+    int owner = domainOf( x );
+    domainBody_t body;
+    bool packed = false;
+    for (int d = 0; d < domainCount; d++) {
+      if (d == owner || d == domainSelf || distanceToDomain( x, d ) > domainHalo) continue;
+      if (!packed) packBody( row, domainIds[row], body );
+      packed = true;
+      halo[d].push_back( body );
+    }
+    if (owner == domainSelf) continue;
+    if (!packed) packBody( row, domainIds[row], body );
+    leaving[owner].push_back( body );
+    domainOwned[row] = 0;
+  }
+  arriving.clear();
+  copies.clear();
+  for (int d = 0; d < domainCount; d++) {
+    if (d == domainSelf) continue;
+    out.clear();
+    putBodies( out, leaving[d] );
+    putBodies( out, halo[d] );
+    exchange( d + 1, out, in );
+    size_t at = 0;
+    getBodies( in, at, received );
+    arriving.insert( arriving.end(), received.begin(), received.end() );
+    getBodies( in, at, received );
+    copies.insert( copies.end(), received.begin(), received.end() );
+  }
+  for (int k = 0; k < (int) (arriving.size() + copies.size()); k++) {
+    bool owned = k < (int) arriving.size();
+    const domainBody_t& body = owned ? arriving[k] : copies[k - arriving.size()];
+    storeBody( bodyStore().add( NULL ), body );
+    domainIds.push_back( body.id );
+    domainOwned.push_back( owned );
+  }
+
+  Collider::updateBroadphase();
+  Collider::generateContacts();
+
+  // Group the bodies of this worker by the contacts between them; a group that touches a copy
+  // crosses a border
+  n = bodyStore().size();
+  parent.resize( n );
+  for (int row = 0; row < n; row++) parent[row] = row;
+  crosses.assign( n, 0 );
+  for (const contact_t& contact: Collider::contacts()) {
+    if (!domainOwned[contact.bodyA] && !domainOwned[contact.bodyB]) continue;
+    int rootA = groupRoot( parent, contact.bodyA );
+    int rootB = groupRoot( parent, contact.bodyB );
+    if (rootA != rootB) parent[rootB] = rootA;
+  }
+  for (const contact_t& contact: Collider::contacts()) {
+    if (domainOwned[contact.bodyA] != domainOwned[contact.bodyB]) crosses[groupRoot( parent, contact.bodyA )] = 1;
+  }
+  local.clear();
+  border.clear();
+  for (contact_t contact: Collider::contacts()) {
+    if (!domainOwned[contact.bodyA] && !domainOwned[contact.bodyB]) continue;
+    // Put the body with the lower coordinator row first, as a single process would
+    if (domainIds[contact.bodyA] > domainIds[contact.bodyB]) {
+      swap( contact.bodyA, contact.bodyB );
+      swap( contact.a, contact.b );
+      Collider::measureContact( contact );
+    }
+    (crosses[groupRoot( parent, contact.bodyA )] ? border : local).push_back( contact );
+  }
+
+  // Groups of this worker only are resolved here, in coordinator row order
+  sort( local.begin(), local.end(), []( const contact_t& p, const contact_t& q ) {
+    if (domainIds[p.bodyA] != domainIds[q.bodyA]) return domainIds[p.bodyA] < domainIds[q.bodyA];
+    return domainIds[p.bodyB] < domainIds[q.bodyB];
+  });
+  Collider::contacts().swap( local );
+  Collider::resolveContacts( dt );
+
+  // Groups that cross a border go to the coordinator with this worker's bodies in them
+  out.clear();
+  received.clear();
+  sentRows.clear();
+  listed.assign( n, 0 );
+  for (const contact_t& contact: border) {
+    int rows[2] = { contact.bodyA, contact.bodyB };
+    for (int row: rows) {
+      if (!domainOwned[row] || listed[row]) continue;
+      listed[row] = 1;
+      sentRows.push_back( row );
+      received.push_back( domainBody_t() );
+      packBody( row, domainIds[row], received.back() );
+    }
+  }
+  putBodies( out, received );
+  put<uint32_t>( out, (uint32_t) border.size() );
+  for (const contact_t& contact: border) {
+    put<uint32_t>( out, domainIds[contact.bodyA] );
+    put<uint32_t>( out, domainIds[contact.bodyB] );
+  }
+  domainTransport->send( DOMAIN_COORDINATOR, out );
+  domainTransport->receive( DOMAIN_COORDINATOR, in );
+  size_t at = 0;
+  getBodies( in, at, received );
+  for (size_t k = 0; k < sentRows.size(); k++) storeBody( sentRows[k], received[k] );
+
+  for (int row = 0; row < n; row++) {
+    if (!domainOwned[row]) bodyStore().removeLater( row );
+  }
+}
+
+/* This function is all a worker process does: it drops the bodies outside its strip, runs its
+ * steps, sends its bodies to the coordinator and exits.
+ *
+ * @param (int domain) the strip of the worker
+ * @param (long steps) the steps to run
+ * @param (double dtMs) the fixed step in milliseconds
+ * @param (int threads) the threads of its jobPool
+ */
+static void runDomainWorker( int domain, long steps, double dtMs, int threads ) {
+  domainTransport->bind( domain + 1 );
+  domainSelf = domain;
+  if (threads > 1) jobPool.start( threads );
+  domainIds.resize( bodyStore().size() );
+  for (int row = 0; row < bodyStore().size(); row++) {
+    domainIds[row] = row;
+    if (domainOf( bodyStore().x[row] ) != domain) bodyStore().removeLater( row );
+  }
+  removeCopies();
+
+  for (long i = 0; i < steps; i++) domainWorkerStep( (float) dtMs );
+
+  removeCopies();
+  vector<domainBody_t> bodies( bodyStore().size() );
+  for (int row = 0; row < bodyStore().size(); row++) packBody( row, domainIds[row], bodies[row] );
+  vector<uint8_t> out;
+  putBodies( out, bodies );
+  domainTransport->send( DOMAIN_COORDINATOR, out );
+  jobPool.stop();
+  _exit( 0 );
+}
+
+/*End Worker-------------------------------------------------------*/
+
+/*Begin Coordinator-------------------------------------------------------*/
+
+/* This function forks a worker for every strip. The world built so far is split between them;
+ * the coordinator keeps its copy to resolve the contacts that cross borders and to collect
+ * the bodies into at the end. jobPool must not have been started, since its threads would not
+ * survive the fork; each worker starts its own.
+ *
+ * @param (int domains) the number of strips and workers
+ * @param (long steps) the steps every worker runs
+ * @param (double dtMs) the fixed step in milliseconds
+ * @param (int threads) the threads shared out between the workers
+ */
+bool startDomains( int domains, long steps, double dtMs, int threads ) {
+  domainCount = domains;
+  domainHalo = 0;
+  for (int row = 0; row < bodyStore().size(); row++) {
+    if (bodyStore().mask[row] & BODY_HAS( COLLIDER_TYPE )) domainHalo = max( domainHalo, 2 * toDouble( bodyStore().colliderRadius[row] ) );
+  }
+  domainTransport = new SharedMemoryTransport( domains + 1 );
+  if (!domainTransport->valid()) return false;
+  fflush( stdout );
+  fflush( stderr );
+  for (int d = 0; d < domains; d++) {
+    pid_t pid = fork();
+    if (pid == 0) runDomainWorker( d, steps, dtMs, max( 1, threads / domains ) );
+    if (pid < 0) {
+      for (pid_t worker: domainWorkers) kill( worker, SIGKILL );
+      return false;
+    }
+    domainWorkers.push_back( pid );
+  }
+  domainTransport->bind( DOMAIN_COORDINATOR );
+  return true;
+}
+
+/**
+ * This function runs one fixed step of the coordinator. It takes the bodies and contacts of
+ * every group that crosses a border from the workers, resolves all the contacts in row order
+ * with the coordinator's own rows standing in for the bodies, and sends each worker its bodies
+ * back. A contact between two strips arrives from both and is resolved once.
+ *
+ * @param (float dt) the fixed step in milliseconds
+ */
+void domainCoordinatorStep( float dt ) {
+  static vector<uint8_t> message;
+  static vector<domainBody_t> bodies;
+  static vector< vector<uint32_t> > sent;
+  static vector< pair<uint32_t, uint32_t> > pairs;
+  sent.resize( domainCount );
+  pairs.clear();
+  for (int d = 0; d < domainCount; d++) {
+    domainTransport->receive( d + 1, message );
+    size_t at = 0;
+    getBodies( message, at, bodies );
+    sent[d].clear();
+    for (const domainBody_t& body: bodies) {
+      storeBody( body.id, body );
+      sent[d].push_back( body.id );
+    }
+    uint32_t count = get<uint32_t>( message.data(), at );
+    for (uint32_t k = 0; k < count; k++) {
+      uint32_t a = get<uint32_t>( message.data(), at );
+      uint32_t b = get<uint32_t>( message.data(), at );
+      pairs.push_back( make_pair( a, b ) );
+    }
+  }
+  sort( pairs.begin(), pairs.end() );
+  pairs.erase( unique( pairs.begin(), pairs.end() ), pairs.end() );
+
+  Collider::contacts().clear();
+  for (const pair<uint32_t, uint32_t>& p: pairs) {
+    contact_t contact = contact_t();
+    contact.bodyA = (int) p.first;
+    contact.bodyB = (int) p.second;
+    contact.a = bodyStore().object( contact.bodyA )->get<Collider>();
+    contact.b = bodyStore().object( contact.bodyB )->get<Collider>();
+    Collider::measureContact( contact );
+    Collider::contacts().push_back( contact );
+  }
+  Collider::resolveContacts( dt );
+
+  for (int d = 0; d < domainCount; d++) {
+    bodies.resize( sent[d].size() );
+    for (size_t k = 0; k < sent[d].size(); k++) packBody( sent[d][k], sent[d][k], bodies[k] );
+    message.clear();
+    putBodies( message, bodies );
+    domainTransport->send( d + 1, message );
+  }
+}
+
+/* This function writes the bodies every worker holds after its last step into the
+ * coordinator's rows and waits for the workers to exit.
+ */
+void finishDomains() {
+  vector<uint8_t> message;
+  vector<domainBody_t> bodies;
+  for (int d = 0; d < domainCount; d++) {
+    domainTransport->receive( d + 1, message );
+    size_t at = 0;
+    getBodies( message, at, bodies );
+    for (const domainBody_t& body: bodies) storeBody( body.id, body );
+  }
+  bodyStore().version++;
+  for (pid_t worker: domainWorkers) waitpid( worker, NULL, 0 );
+  domainWorkers.clear();
+  delete domainTransport;
+  domainTransport = NULL;
+}
+
+/*End Coordinator-------------------------------------------------------*/
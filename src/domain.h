@@ -0,0 +1,47 @@
+#ifndef DOMAIN_H
+#define DOMAIN_H
+
+#include <vector>
+#include <stdint.h>
+#include "bodies.h"
+#include "transport.h"
+
+using namespace std;
+
+/* Everything another process needs to simulate or collide a body. Sent when a body moves to
+ * another domain, as a halo copy, and to and from the coordinator.
+ */
+struct domainBody_t {
+  uint32_t id;             // Row of the body in the coordinator
+  unsigned int mask;
+  unsigned int triggerSet;
+  color_t color;
+  scalar_t x, y, dx, dy, mass, colliderRadius, wallRadius, renderRadius;
+};
+
+/* A domain decomposed run splits the world into vertical strips of equal width, each simulated
+ * by a worker process that only holds the bodies whose centre is in its strip. Every step each
+ * worker
+ *
+ *   1. integrates and runs the scripts of its own bodies,
+ *   2. hands bodies that left its strip to their new owner, and sends a halo copy of every body
+ *      within two collider radii of another strip to that strip's worker,
+ *   3. finds the contacts among its bodies and the halo copies, and
+ *   4. resolves itself every group of touching bodies that are all its own. Groups that reach
+ *      a halo copy cross a border; their bodies and contacts go to the coordinator, the process
+ *      that built the world, which resolves all of them together and sends the bodies back.
+ *
+ * Contacts are resolved in the order of the bodies' rows in the coordinator, as a single
+ * process resolves them, so the world after a run is the same bit for bit as that of a single
+ * process run. Processes talk through a Transport; shared memory rings are used for now.
+ *
+ * Scripted components stay with the worker the body started in; a body that moves to another
+ * worker only takes its built in components along. Sleeping, continuous collision and collision
+ * events are not supported.
+ */
+
+bool startDomains( int domains, long steps, double dtMs, int threads ); // Fork one worker per strip; returns in the coordinator, false if the workers could not be started
+void domainCoordinatorStep( float dt ); // One fixed step of the coordinator; use as odlGameLoopState.fixedUpdate
+void finishDomains();                   // Collect every body back from the workers and wait for them to exit
+
+#endif
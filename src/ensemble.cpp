@@ -0,0 +1,96 @@
+/*-------------------------------------------------------
+
+Implements the ensemble runner, which steps many small
+independent worlds across jobPool's threads.
+
+---------------------------------------------------------*/
+
+#include "ensemble.h"
+
+/*Begin Ensemble-------------------------------------------------------*/
+
+/* This function adds up the kinetic energy and momentum of the current world and finds its
+ * fastest body
+ *
+ * @param (worldSummary_t& summary) receives energyEnd, momentumX, momentumY and maxSpeed
+ */
+static void measureWorld( worldSummary_t& summary ) {
+  summary.energyEnd = 0;
+  summary.momentumX = 0;
+  summary.momentumY = 0;
+  summary.maxSpeed = 0;
+  for (int row = 0; row < bodyStore().size(); row++) {
+    if (!(bodyStore().mask[row] & BODY_HAS( PHYSICS_TYPE ))) continue;
+    double mass = toDouble( bodyStore().mass[row] );
+    double dx = toDouble( bodyStore().dx[row] );
+    double dy = toDouble( bodyStore().dy[row] );
+    summary.energyEnd += 0.5 * mass * (dx * dx + dy * dy);
+    summary.momentumX += mass * dx;
+    summary.momentumY += mass * dy;
+    summary.maxSpeed = max( summary.maxSpeed, sqrt( dx * dx + dy * dy ) );
+  }
+}
+
+/* This function builds, runs, measures and deletes one world of an ensemble
+ *
+ * @param (int index) the number of the world, passed to setup
+ * @param (long steps) the steps to run
+ * @param (double dtMs) the fixed step in milliseconds
+ * @param (worldSetup setup) creates the world's GameObjects
+ * @param (worldSummary_t& summary) receives what the world did
+ */
+static void runWorld( int index, long steps, double dtMs, worldSetup setup, worldSummary_t& summary ) {
+  World world;
+  world.enter();
+  setup( index );
+  measureWorld( summary );
+  summary.energyStart = summary.energyEnd;
+  summary.contacts = 0;
+  for (long i = 0; i < steps; i++) {
+    Component::fixedUpdateAll( (float) dtMs );
+    summary.contacts += Collider::contacts().size();
+    odlGameLoopState().stepCount++;
+    odlGameLoopState().simulatedTimeMs += (float) dtMs;
+  }
+  summary.steps = steps;
+  summary.bodies = bodyStore().size();
+  measureWorld( summary );
+  world.leave();
+}
+
+/**
+ * This function runs an ensemble, see ensemble.h. Each world is one chunk of a jobPool loop, so
+ * it is built and stepped on a single thread, in a World current on that thread only, and its
+ * steps run their own loops inline.
+ *
+ * @param (int worlds) how many worlds to run
+ * @param (long steps) the steps every world runs
+ * @param (double dtMs) the fixed step in milliseconds
+ * @param (worldSetup setup) creates the GameObjects of each world
+ * @param (vector<worldSummary_t>& summaries) receives the summary of every world, by number
+ */
+void runEnsemble( int worlds, long steps, double dtMs, worldSetup setup, vector<worldSummary_t>& summaries ) {
+  summaries.assign( max( 0, worlds ), worldSummary_t() );
+  jobPool.parallelFor( worlds, 1, [steps, dtMs, setup, &summaries]( int begin, int end ) {
+    for (int w = begin; w < end; w++) runWorld( w, steps, dtMs, setup, summaries[w] );
+  });
+}
+
+/* This function writes ensemble summaries as CSV, one row per world with its number first
+ *
+ * @param (const char* path) the file to write
+ * @param (const vector<worldSummary_t>& summaries) the summaries, by world
+ */
+bool saveEnsembleCsv( const char* path, const vector<worldSummary_t>& summaries ) {
+  FILE* file = fopen( path, "w" );
+  if (file == NULL) return false;
+  fprintf( file, "world,bodies,steps,contacts,energy_start,energy_end,momentum_x,momentum_y,max_speed\n" );
+  for (size_t w = 0; w < summaries.size(); w++) {
+    const worldSummary_t& s = summaries[w];
+    fprintf( file, "%zu,%d,%ld,%ld,%.17g,%.17g,%.17g,%.17g,%.17g\n", w, s.bodies, s.steps, s.contacts,
+      s.energyStart, s.energyEnd, s.momentumX, s.momentumY, s.maxSpeed );
+  }
+  return fclose( file ) == 0;
+}
+
+/*End Ensemble-------------------------------------------------------*/
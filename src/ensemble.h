@@ -0,0 +1,31 @@
+#ifndef ENSEMBLE_H
+#define ENSEMBLE_H
+
+#include <vector>
+
+using namespace std;
+
+// What one world of an ensemble did, measured by runEnsemble
+struct worldSummary_t {
+  int bodies;
+  long steps;
+  long contacts;       // Contacts resolved over all steps
+  double energyStart;  // Kinetic energy before the first step
+  double energyEnd;    // Kinetic energy after the last step
+  double momentumX;    // Momentum after the last step
+  double momentumY;
+  double maxSpeed;     // Fastest body after the last step
+};
+
+typedef void ( * worldSetup ) ( int world ); // Creates the GameObjects of world number world in the current world
+
+/* Runs many small, independent worlds, eg a parameter sweep, for the same number of steps each.
+ * Every world is built by setup in a World of its own, stepped headless, measured and deleted.
+ * The worlds are spread over jobPool's threads, several at a time, each stepped on the one
+ * thread that took it. A world steps the same however many threads there are. setup runs on
+ * any of the threads, so it must only change the current world.
+ */
+void runEnsemble( int worlds, long steps, double dtMs, worldSetup setup, vector<worldSummary_t>& summaries );
+bool saveEnsembleCsv( const char* path, const vector<worldSummary_t>& summaries ); // One row per world; false on error
+
+#endif
@@ -9,5 +9,6 @@
 
 #define DESIRED_STATE_UPDATES_PER_SECOND 60
 #define DESIRED_STATE_UPDATE_DURATION_MS 16.666 // obtained as: 1000/DESIRED_STATE_UPDATES_PER_SECOND
+#define MAX_CATCH_UP_STEPS 5 // Fixed steps run per frame at most before the rest of the backlog is dropped
 
 #endif /* GAMELOOPCONSTANTS_H_ */
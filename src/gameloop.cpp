@@ -1,91 +1,241 @@
 #include "gameLoopConstants.h"
 #include "ODLGameLoop_private.h"
+#include <chrono>
+#include <thread>
+#include <atomic>
 
 
-ODLGameLoopState odlGameLoopState;
+FILE* statusOut = stdout;
 
-/* This function calucaltes and displays performance information such as ups (updates per second) and fps (frames per second)
+static vector<double> previousX; // Positions before the last fixed step of an idle call, for interpolation
+static vector<double> previousY;
+
+static FrameExchange frameExchange;       // Frames from the simulation thread to the render thread
+static thread simulationThread;
+static atomic<bool> simulationStopping( false );
+static atomic<int> framesDrawn( 0 );      // Frames the render thread drew since the simulation thread last counted
+static JobPool renderThreadJobs;          // The render thread's loops, on workers of their own so they never wait for the steps on jobPool
+
+/* This function returns a monotonic time in nanoseconds, unaffected by changes to the system clock
+ */
+long long ODLGameLoop_nowNs() {
+  return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* This function calucaltes and displays performance information such as ups (updates per second) and fps (frames per second),
+ * and how often the fixed steps did not fit in their time budget
  */
 void ODLGameLoop_updateMeasurements() {
-  double now = glutGet(GLUT_ELAPSED_TIME);
-  //printf("now:%d last:%d \n", (int) now, (int) odlGameLoopState.lastMeasurementTime);
-  double timeElapsedMs = ((now-odlGameLoopState.lastMeasurementTime)*1000000)/(CLOCKS_PER_SEC);
-  //printf("timeElapsed:%d \n", (int) timeElapsedMs);
+  long long now = ODLGameLoop_nowNs();
+  double timeElapsedMs = (now-odlGameLoopState().lastMeasurementTimeNs)/1e6;
   if(timeElapsedMs>=500) {
 
-    double ups = (odlGameLoopState.upsCount*1000)/timeElapsedMs;
-    double fps = (odlGameLoopState.fpsCount*1000)/timeElapsedMs;
-    char title[100];
-    printf("On Demand Game Loop. FPS:%d UPS:%d \n", (int) fps, (int)ups);
-    odlGameLoopState.upsCount = 0;
-    odlGameLoopState.fpsCount = 0;
-    odlGameLoopState.lastMeasurementTime = now;
+    double ups = (odlGameLoopState().upsCount*1000)/timeElapsedMs;
+    double fps = (odlGameLoopState().fpsCount*1000)/timeElapsedMs;
+    printf("On Demand Game Loop. FPS:%d UPS:%d Overruns:%d Capped:%d Dropped:%.1fms SlowestStep:%.3fms \n", (int) fps, (int)ups,
+      odlGameLoopState().overrunSteps, odlGameLoopState().cappedFrames, odlGameLoopState().droppedMs, odlGameLoopState().slowestStepNs/1e6);
+    odlGameLoopState().upsCount = 0;
+    odlGameLoopState().fpsCount = 0;
+    odlGameLoopState().overrunSteps = 0;
+    odlGameLoopState().cappedFrames = 0;
+    odlGameLoopState().droppedMs = 0;
+    odlGameLoopState().slowestStepNs = 0;
+    odlGameLoopState().lastMeasurementTimeNs = now;
   }
 }
 
-/* This function initializes variables defining the state of the game loop
+/* This function runs one fixed step, counts it and hands the result to the trace recorder and
+ * the stream server
+ *
+ * @param (float dt) the fixed timestep in milliseconds
  */
-void ODLGameLoop_initGameLoopState() {
-
-  odlGameLoopState.lastLoopTime = glutGet(GLUT_ELAPSED_TIME);
-  odlGameLoopState.lastMeasurementTime = glutGet(GLUT_ELAPSED_TIME);
-
-  odlGameLoopState.desiredStateUpdatesPerSecond = DESIRED_STATE_UPDATES_PER_SECOND;
-  odlGameLoopState.desiredStateUpdateDurationMs = DESIRED_STATE_UPDATE_DURATION_MS;
-
-  odlGameLoopState.upsCount = 0;
-  odlGameLoopState.fpsCount = 0;
-
-  odlGameLoopState.timeAccumulatedMs = glutGet(GLUT_ELAPSED_TIME);
+void ODLGameLoop_runFixedUpdate(float dt) {
+  if (odlGameLoopState().fixedUpdate != NULL) odlGameLoopState().fixedUpdate(dt);
+  else Component::fixedUpdateAll(dt);
+  if (odlGameLoopState().stopRequested) return;
+  odlGameLoopState().simulatedTimeMs += dt;
+  odlGameLoopState().stepCount++;
+  if (traceRecorder != NULL) traceRecorder->record(odlGameLoopState().stepCount, bodyStore(), Collider::contacts());
+  if (streamServer != NULL) streamServer->publish(odlGameLoopState().stepCount, bodyStore());
+  PROFILE_END_STEP();
+}
 
-  //printf("lastLoop:%d lastMeasure:%d time timeAccumulated:%d \n", (int) odlGameLoopState.lastLoopTime, (int) odlGameLoopState.lastMeasurementTime, (int) odlGameLoopState.timeAccumulatedMs);
+/* This function initializes variables defining the state of the game loop
+ *
+ * @param (double dtMs) the fixed timestep in milliseconds
+ * @param (int maxCatchUpSteps) the most fixed steps run per frame
+ * @param (int interpolate) non zero to draw bodies between their last two fixed step positions
+ * @param (int renderThread) non zero to simulate on a thread of its own, see ODLGameLoop_runSimulationThread
+ */
+void ODLGameLoop_initGameLoopState(double dtMs, int maxCatchUpSteps, int interpolate, int renderThread) {
+
+  odlGameLoopState().lastLoopTimeNs = ODLGameLoop_nowNs();
+  odlGameLoopState().lastMeasurementTimeNs = odlGameLoopState().lastLoopTimeNs;
+
+  odlGameLoopState().desiredStateUpdatesPerSecond = (int) (1000/dtMs + .5);
+  odlGameLoopState().desiredStateUpdateDurationMs = dtMs;
+  odlGameLoopState().maxCatchUpSteps = maxCatchUpSteps > 0 ? maxCatchUpSteps : 1;
+  odlGameLoopState().interpolate = interpolate;
+  odlGameLoopState().interpolationAlpha = 1;
+  odlGameLoopState().renderThread = renderThread;
+
+  odlGameLoopState().upsCount = 0;
+  odlGameLoopState().fpsCount = 0;
+  odlGameLoopState().overrunSteps = 0;
+  odlGameLoopState().cappedFrames = 0;
+  odlGameLoopState().droppedMs = 0;
+  odlGameLoopState().slowestStepNs = 0;
+
+  // Any accumulated time restored from a snapshot is kept, as are the step counters
 }
 
-/* This function handles refreshing the display window
+/* This function handles refreshing the display window. Bodies are drawn interpolationAlpha of the
+ * way from where they were before the last fixed step to where they are now.
  */
 void ODLGameLoop_onOpenGLDisplay() {
 
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT); // Clear Screen
-  double now = glutGet(GLUT_ELAPSED_TIME);
-  double dt = now - odlGameLoopState.lastLoopTime;
-  //printf("lastLoop:%f now:%f dt:%f \n", odlGameLoopState.lastLoopTime, now, dt);
+  if (odlGameLoopState().interpolate) {
+    renderInterpolation.previousX = previousX.data();
+    renderInterpolation.previousY = previousY.data();
+    renderInterpolation.rows = (int) min(previousX.size(), (size_t) bodyStore().size());
+    renderInterpolation.alpha = odlGameLoopState().interpolationAlpha;
+  }
+  double dt = odlGameLoopState().timeAccumulatedMs; // Time since the last fixed step
   Component::updateAll(dt);
-  odlGameLoopState.fpsCount++;
+  renderInterpolation.rows = 0;
+  odlGameLoopState().fpsCount++;
   glutSwapBuffers();
 }
 
-/* This function controls the speed of fixedUpdates and ensures they run at a fixed interval.
+/* This function draws the latest frame published by the simulation thread, in place of
+ * ODLGameLoop_onOpenGLDisplay when the simulation runs on a thread of its own. It reads only
+ * the frame, never the live world, so it can run while a step is in progress. Bodies are drawn
+ * the fraction of a fixed step of wall time that has passed since the frame's state was due
+ * of the way from their positions before its step. Variable updates of scripted components
+ * are not run in this mode, since they would read the world while it is being stepped.
  */
-void ODLGameLoop_onOpenGLIdle() {
+void ODLGameLoop_onOpenGLDisplayFrame() {
 
-  double now = glutGet(GLUT_ELAPSED_TIME);
-  double timeElapsedMs = ((now-odlGameLoopState.lastLoopTime)*1000000)/(CLOCKS_PER_SEC);
-
-
-  odlGameLoopState.timeAccumulatedMs += timeElapsedMs;
-
-  while(odlGameLoopState.timeAccumulatedMs >= DESIRED_STATE_UPDATE_DURATION_MS) { //
-  	  //printf("dt:%f \n", odlGameLoopState.timeAccumulatedMs);
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT); // Clear Screen
+  const renderFrame_t& frame = frameExchange.latest();
+  if (odlGameLoopState().interpolate && !frame.previousX.empty()) {
+    double alpha = (ODLGameLoop_nowNs() - frame.timeNs)/(odlGameLoopState().desiredStateUpdateDurationMs*1e6);
+    renderInterpolation.previousX = frame.previousX.data();
+    renderInterpolation.previousY = frame.previousY.data();
+    renderInterpolation.rows = (int) min(frame.previousX.size(), (size_t) frame.bodies.size());
+    renderInterpolation.alpha = min(1.0, max(0.0, alpha));
+  }
+  renderBackend->drawCircles(frame.bodies);
+  renderInterpolation.rows = 0;
+  framesDrawn++;
+  glutSwapBuffers();
+}
 
+/* This function asks for the next frame to be drawn when the simulation runs on a thread of its
+ * own. Without interpolation the picture only changes when a new frame is published, so until
+ * then it waits a little instead of drawing the same frame again.
+ */
+void ODLGameLoop_onOpenGLIdleFrame() {
+  if (odlGameLoopState().interpolate || frameExchange.fresh()) glutPostRedisplay();
+  else this_thread::sleep_for(chrono::milliseconds(1));
+}
 
-      Component::fixedUpdateAll( (float) odlGameLoopState.timeAccumulatedMs);
-      //ODLGameLoop_updateState();
-      odlGameLoopState.timeAccumulatedMs -= DESIRED_STATE_UPDATE_DURATION_MS;
+/* This function catches the simulation up with the wall clock. Wall time from a monotonic
+ * nanosecond clock is accumulated and spent in steps of exactly desiredStateUpdateDurationMs.
+ * At most maxCatchUpSteps run per call: when the simulation cannot keep up, the rest of the
+ * backlog is dropped rather than growing every frame (the spiral of death), so the world runs
+ * slower than real time instead of freezing. Steps that take longer than their own duration of
+ * wall time are counted as overruns. Returns the number of steps run.
+ */
+long ODLGameLoop_advance() {
+
+  long long now = ODLGameLoop_nowNs();
+  odlGameLoopState().timeAccumulatedMs += (now-odlGameLoopState().lastLoopTimeNs)/1e6;
+  odlGameLoopState().lastLoopTimeNs = now;
+
+  double dt = odlGameLoopState().desiredStateUpdateDurationMs;
+  long steps = (long) (odlGameLoopState().timeAccumulatedMs/dt);
+  if (steps > odlGameLoopState().maxCatchUpSteps) {
+    double dropped = (steps - odlGameLoopState().maxCatchUpSteps)*dt;
+    odlGameLoopState().timeAccumulatedMs -= dropped;
+    odlGameLoopState().droppedMs += dropped;
+    odlGameLoopState().cappedFrames++;
+    steps = odlGameLoopState().maxCatchUpSteps;
+  }
 
-      odlGameLoopState.upsCount++;
-      ODLGameLoop_updateMeasurements();
+  for (long i = 0; i < steps && !odlGameLoopState().stopRequested; i++) {
+    if (i == steps-1 && odlGameLoopState().interpolate) {
+      // Remove destroyed rows first so every row left keeps its index through the step
+      Component::removeDestroyed();
+      previousX.assign(bodyStore().x.data(), bodyStore().x.data() + bodyStore().size());
+      previousY.assign(bodyStore().y.data(), bodyStore().y.data() + bodyStore().size());
+    }
+    long long stepStart = ODLGameLoop_nowNs();
+    ODLGameLoop_runFixedUpdate( (float) dt);
+    long long stepNs = ODLGameLoop_nowNs() - stepStart;
+    if (stepNs > dt*1e6) odlGameLoopState().overrunSteps++;
+    odlGameLoopState().slowestStepNs = max(odlGameLoopState().slowestStepNs, stepNs);
+    odlGameLoopState().timeAccumulatedMs -= dt;
+    odlGameLoopState().upsCount++;
+  }
+  odlGameLoopState().interpolationAlpha = min(1.0, max(0.0, odlGameLoopState().timeAccumulatedMs/dt));
+  return steps;
+}
 
-      glutPostRedisplay();
+/* This function runs the fixed steps due since the last call and asks for a redraw, see
+ * ODLGameLoop_advance.
+ */
+void ODLGameLoop_onOpenGLIdle() {
+  long steps = ODLGameLoop_advance();
+  ODLGameLoop_updateMeasurements();
+  if (steps > 0 || odlGameLoopState().interpolate) glutPostRedisplay();
+}
 
+/* This function is the body of the simulation thread. It keeps the simulation caught up with
+ * the wall clock exactly as the idle handler does, and after every call that ran steps
+ * publishes a frame of the render state for the render thread. Between steps it sleeps until
+ * the next one is due, so a slow frame never holds up the physics and a long catch up never
+ * holds up the frames.
+ */
+void ODLGameLoop_runSimulationThread() {
+  static const vector<double> none;
+  while (!simulationStopping) {
+    long steps = ODLGameLoop_advance();
+    if (steps > 0) {
+      long long dueNs = odlGameLoopState().lastLoopTimeNs - (long long) (odlGameLoopState().timeAccumulatedMs*1e6);
+      bool interpolate = odlGameLoopState().interpolate;
+      frameExchange.capture(bodyStore(), interpolate ? previousX : none, interpolate ? previousY : none, odlGameLoopState().stepCount, dueNs);
+    }
+    odlGameLoopState().fpsCount += framesDrawn.exchange(0);
+    ODLGameLoop_updateMeasurements();
+
+    double waitMs = odlGameLoopState().desiredStateUpdateDurationMs - odlGameLoopState().timeAccumulatedMs;
+    if (waitMs > 0) this_thread::sleep_for(chrono::nanoseconds((long long) (waitMs*1e6)));
   }
+}
 
-  odlGameLoopState.lastLoopTime = now;
+/* This function runs when the window loop exits the program. It stops and joins the simulation
+ * thread and the render thread's workers, if they are running, then closes the trace being
+ * recorded so its last chunk and its index are written.
+ */
+void ODLGameLoop_onExit() {
+  simulationStopping = true;
+  if (simulationThread.joinable()) simulationThread.join();
+  renderThreadJobs.stop();
+  if (traceRecorder != NULL) traceRecorder->close();
 }
 
 
-/* This function initializes glut and begins the game loop
+/* This function initializes glut and begins the game loop. With renderThread set the fixed
+ * steps run on a thread of their own and the GLUT thread only draws the frames they publish.
+ *
+ * @param (double dtMs) the fixed timestep in milliseconds
+ * @param (int maxCatchUpSteps) the most fixed steps run per frame
+ * @param (int interpolate) non zero to draw bodies between their last two fixed step positions
+ * @param (int renderThread) non zero to simulate and draw on separate threads
  */
-void ODLGameLoop_initOpenGL() {
+void ODLGameLoop_initOpenGL(double dtMs, int maxCatchUpSteps, int interpolate, int renderThread) {
     char title[] = "Test Window";  // Windowed mode's title
     int windowWidth  = VIEW_WIDTH;     // Windowed mode's width
     int windowHeight = VIEW_HEIGHT;     // Windowed mode's height
@@ -112,10 +262,63 @@ void ODLGameLoop_initOpenGL() {
 
     glutInitDisplayMode(GLUT_RGB | GLUT_DOUBLE | GLUT_DEPTH);
 
-    glutDisplayFunc(ODLGameLoop_onOpenGLDisplay); //set function that displays things
-    glutIdleFunc(ODLGameLoop_onOpenGLIdle); //set function to update state
-
-    ODLGameLoop_initGameLoopState();
+    ODLGameLoop_initGameLoopState(dtMs, maxCatchUpSteps, interpolate, renderThread);
+    atexit(ODLGameLoop_onExit); // glutMainLoop only returns through exit()
+
+    if (renderThread) {
+      glutDisplayFunc(ODLGameLoop_onOpenGLDisplayFrame); //draw the frames published by the simulation thread
+      glutIdleFunc(ODLGameLoop_onOpenGLIdleFrame);
+      // As many threads draw as run the steps; the workers of each pool sleep while it is idle
+      renderThreadJobs.start(jobPool.threadCount());
+      renderJobPool = &renderThreadJobs;
+      simulationThread = thread(ODLGameLoop_runSimulationThread);
+    } else {
+      glutDisplayFunc(ODLGameLoop_onOpenGLDisplay); //set function that displays things
+      glutIdleFunc(ODLGameLoop_onOpenGLIdle); //set function to update state
+    }
 
     glutMainLoop();
 }
+
+/* This function advances the simulation without a window. It runs fixedUpdateAll a set number of
+ * times at a fixed dt as fast as possible, using a simulated clock instead of the wall clock so
+ * the same inputs always produce the same world. No GL or GLUT functions are called, so frames
+ * can only be produced when renderBackend is an offscreen backend.
+ *
+ * @param (long steps) the number of fixed updates to run
+ * @param (double dtMs) the fixed timestep in milliseconds passed to every fixedUpdate
+ * @param (int renderEvery) render and end a frame after every this many steps; 0 never renders
+ */
+void ODLGameLoop_runHeadless(long steps, double dtMs, int renderEvery) {
+  odlGameLoopState().desiredStateUpdatesPerSecond = (int) (1000/dtMs + .5);
+  odlGameLoopState().desiredStateUpdateDurationMs = dtMs;
+  long firstStep = odlGameLoopState().stepCount; // Non zero when resuming from a snapshot
+  double firstSimulatedMs = odlGameLoopState().simulatedTimeMs;
+
+  long frames = 0;
+  double renderSeconds = 0;
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  for (long i = 0; i < steps && !odlGameLoopState().stopRequested; i++) {
+    ODLGameLoop_runFixedUpdate( (float) dtMs );
+
+    if (renderEvery > 0 && odlGameLoopState().stepCount % renderEvery == 0) {
+      chrono::steady_clock::time_point renderStart = chrono::steady_clock::now();
+      Component::updateAll( (float) (dtMs * renderEvery) );
+      renderBackend->endFrame();
+      renderSeconds += chrono::duration<double>(chrono::steady_clock::now() - renderStart).count();
+      frames++;
+    }
+  }
+  chrono::steady_clock::time_point end = chrono::steady_clock::now();
+
+  double wallSeconds = chrono::duration<double>(end - start).count();
+  long stepsRun = odlGameLoopState().stepCount - firstStep;
+  double stepsPerSecond = wallSeconds > 0 ? stepsRun / wallSeconds : 0;
+  fprintf(statusOut, "Headless run. Steps:%ld dt:%.3fms Simulated:%.3fs Wall:%.6fs Steps/sec:%.1f Kernel:%s \n",
+    stepsRun, dtMs, (odlGameLoopState().simulatedTimeMs - firstSimulatedMs) / 1000,
+    wallSeconds, stepsPerSecond, activeStepKernel.name);
+  if (frames > 0) {
+    fprintf(statusOut, "Rendered %ld frames. Render time:%.6fs FPS:%.1f \n", frames, renderSeconds,
+      renderSeconds > 0 ? frames / renderSeconds : 0);
+  }
+}
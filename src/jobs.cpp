@@ -0,0 +1,162 @@
+/*-------------------------------------------------------
+
+Implements the work stealing thread pool used to run the
+fixed step in parallel.
+
+---------------------------------------------------------*/
+
+#include "jobs.h"
+#include <algorithm>
+
+JobPool jobPool;
+
+static thread_local bool inChunk = false; // Whether this thread is running a chunk
+
+/*Begin JobPool-------------------------------------------------------*/
+
+/* The constructor for a JobPool. The pool starts with no workers, so parallelFor runs every
+ * chunk on the calling thread until start() is called.
+ */
+JobPool::JobPool() : pending( 0 ), generation( 0 ), stopping( false ) {
+  queues.push_back( new Queue() );
+}
+
+/* The destructor for a JobPool. Joins the workers.
+ */
+JobPool::~JobPool() {
+  stop();
+  for (Queue* q: queues) delete q;
+}
+
+/* This function starts the worker threads, replacing any that are already running
+ *
+ * @param (int threadCount) total number of threads that run chunks, including the caller
+ */
+void JobPool::start( int threadCount ) {
+  stop();
+  stopping = false;
+  for (int i = 1; i < threadCount; i++) queues.push_back( new Queue() );
+  for (int i = 1; i < threadCount; i++) workers.push_back( thread( &JobPool::workerLoop, this, i ) );
+}
+
+/* This function stops and joins the worker threads
+ */
+void JobPool::stop() {
+  {
+    lock_guard<mutex> lk( wakeLock );
+    stopping = true;
+  }
+  wake.notify_all();
+  for (thread& t: workers) t.join();
+  workers.clear();
+  while (queues.size() > 1) {
+    delete queues.back();
+    queues.pop_back();
+  }
+}
+
+/* This function takes the next chunk for a thread: the front of its own queue, or else the
+ * back of another thread's queue.
+ *
+ * @param (int self) index of the calling thread's queue
+ * @param (Task& task) receives the chunk
+ */
+bool JobPool::take( int self, Task& task ) {
+  int n = (int) queues.size();
+  for (int k = 0; k < n; k++) {
+    Queue* q = queues[(self + k) % n];
+    lock_guard<mutex> lk( q->lock );
+    if (q->tasks.empty()) continue;
+    if (k == 0) {
+      task = q->tasks.front();
+      q->tasks.pop_front();
+    } else {
+      task = q->tasks.back();
+      q->tasks.pop_back();
+    }
+    return true;
+  }
+  return false;
+}
+
+/* This function runs chunks until every queue is empty
+ *
+ * @param (int self) index of the calling thread's queue
+ */
+void JobPool::runTasks( int self ) {
+  World* own = World::current;
+  bool nested = inChunk;
+  inChunk = true;
+  Task task;
+  while (take( self, task )) {
+    World::current = task.world;
+    (*task.func)( task.begin, task.end );
+    pending--;
+  }
+  World::current = own;
+  inChunk = nested;
+}
+
+/* This function is the body of a worker thread. It sleeps until a parallelFor is posted, helps
+ * run it, and goes back to sleep.
+ *
+ * @param (int self) index of this worker's queue
+ */
+void JobPool::workerLoop( int self ) {
+  unsigned int seen = 0;
+  while (true) {
+    {
+      unique_lock<mutex> lk( wakeLock );
+      wake.wait( lk, [&]{ return stopping || generation != seen; } );
+      if (stopping) return;
+      seen = generation;
+    }
+    runTasks( self );
+  }
+}
+
+/* This function runs func over [0, count) split into chunks of at most grain items, and
+ * returns when all chunks are done. Chunks run in any order on any thread, so func must only
+ * write state that belongs to its own range. Each runs with the caller's World current.
+ *
+ * @param (int count) number of items
+ * @param (int grain) largest number of items in one chunk
+ * @param (const rangeFunc& func) called once per chunk with [begin, end)
+ */
+void JobPool::parallelFor( int count, int grain, const rangeFunc& func ) {
+  if (count <= 0) return;
+  if (grain < 1) grain = 1;
+  if (workers.empty() || count <= grain || inChunk) {
+    func( 0, count );
+    return;
+  }
+  unique_lock<mutex> posting( postLock, try_to_lock );
+  if (!posting.owns_lock()) {
+    func( 0, count );
+    return;
+  }
+
+  int chunks = (count + grain - 1) / grain;
+  pending = chunks;
+  int n = (int) queues.size();
+  for (int c = 0; c < chunks; c++) {
+    Task task;
+    task.func = &func;
+    task.begin = c * grain;
+    task.end = min( count, task.begin + grain );
+    task.world = World::current;
+    Queue* q = queues[c % n];
+    lock_guard<mutex> lk( q->lock );
+    q->tasks.push_back( task );
+  }
+  {
+    lock_guard<mutex> lk( wakeLock );
+    generation++;
+  }
+  wake.notify_all();
+
+  runTasks( 0 );
+  while (pending > 0) this_thread::yield();
+}
+
+/*End JobPool-------------------------------------------------------*/
@@ -0,0 +1,63 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+using namespace std;
+
+class World;
+
+typedef function<void ( int begin, int end )> rangeFunc; // Runs one chunk [begin, end) of a parallelFor
+
+/* A fixed set of worker threads that run chunks of parallelFor loops. Every thread (the
+ * caller included) has its own queue; chunks are dealt round robin and a thread that runs
+ * out of work steals from the back of the other queues.
+ *
+ * A chunk runs in the World that was current on the thread that called parallelFor. One loop
+ * is spread over the pool at a time: a parallelFor called from inside a chunk, or while another
+ * thread's loop is running, runs on its own thread.
+ */
+class JobPool {
+  private:
+    struct Task {
+      const rangeFunc* func;
+      int begin;
+      int end;
+      World* world;                 // World::current of the thread that posted it
+    };
+    struct Queue {
+      mutex lock;
+      deque<Task> tasks;
+    };
+
+    vector<thread> workers;
+    vector<Queue*> queues;          // queues[0] belongs to the calling thread
+    mutex postLock;                 // Held by the thread whose loop is spread over the pool
+    atomic<int> pending;            // Chunks of the current loop not finished yet
+    mutex wakeLock;
+    condition_variable wake;
+    unsigned int generation;        // Bumped for every parallelFor so workers know to look for work
+    bool stopping;
+
+    bool take( int self, Task& task );
+    void runTasks( int self );
+    void workerLoop( int self );
+
+  public:
+    JobPool();
+    ~JobPool();
+    void start( int threadCount );  // Start threadCount - 1 workers; the caller is the last thread
+    void stop();
+    int threadCount() const { return (int) queues.size(); }
+    void parallelFor( int count, int grain, const rangeFunc& func ); // Run func over [0, count) in chunks of grain and wait for all of them
+};
+
+extern JobPool jobPool;
+
+#endif
@@ -0,0 +1,424 @@
+/*-------------------------------------------------------
+
+Implements the vectorized integration and wall bounce
+kernels, and picks one at runtime from the CPU features.
+
+---------------------------------------------------------*/
+
+#include "kernels.h"
+#include <math.h>
+#include <string.h>
+#include <immintrin.h>
+
+#define STEP_NEEDS_PHYSICS BODY_HAS( PHYSICS_TYPE )
+#define STEP_NEEDS_WALL ( BODY_HAS( WALL_BOUNCE_TYPE ) | BODY_HAS( PHYSICS_TYPE ) )
+// Mask bits compared with the above, so sleeping bodies are neither moved nor bounced
+#define STEP_CHECK_PHYSICS ( STEP_NEEDS_PHYSICS | BODY_SLEEPING )
+#define STEP_CHECK_WALL ( STEP_NEEDS_WALL | BODY_SLEEPING )
+
+/*Begin Scalar-------------------------------------------------------*/
+
+/* This function is the reference kernel. It is also used for the rows left over after the
+ * vector kernels have consumed all full lanes.
+ */
+void stepKernelScalar( scalar_t* x, scalar_t* y, scalar_t* dx, scalar_t* dy,
+  const scalar_t* wallRadius, const unsigned int* mask, int begin, int end, double dt ) {
+  const scalar_t step = toScalar( dt );
+  const scalar_t one = toScalar( 1 );
+  for (int i = begin; i < end; i++) {
+    if ((mask[i] & STEP_CHECK_PHYSICS) != STEP_NEEDS_PHYSICS) continue;
+    x[i] += dx[i] * step;
+    y[i] += dy[i] * step;
+    if ((mask[i] & STEP_CHECK_WALL) != STEP_NEEDS_WALL) continue;
+    scalar_t r = wallRadius[i];
+    if (x[i] + r >= one) dx[i] = -scalarAbs( dx[i] );
+    if (x[i] - r <= -one) dx[i] = scalarAbs( dx[i] );
+    if (y[i] + r >= one) dy[i] = -scalarAbs( dy[i] );
+    if (y[i] - r <= -one) dy[i] = scalarAbs( dy[i] );
+  }
+}
+
+/*End Scalar-------------------------------------------------------*/
+
+#if !defined( SCALAR_FIXED ) && !defined( SCALAR_FLOAT )
+
+/*Begin SSE2-------------------------------------------------------*/
+
+/* This function reflects one velocity component for two lanes.
+ * Lanes in hi get -|v|, then lanes in lo get |v|, matching the order of the scalar tests.
+ */
+static inline __m128d reflectSSE2( __m128d v, __m128d hi, __m128d lo ) {
+  const __m128d sign = _mm_set1_pd( -0.0 );
+  __m128d negAbs = _mm_or_pd( v, sign );
+  __m128d posAbs = _mm_andnot_pd( sign, v );
+  v = _mm_or_pd( _mm_and_pd( hi, negAbs ), _mm_andnot_pd( hi, v ) );
+  return _mm_or_pd( _mm_and_pd( lo, posAbs ), _mm_andnot_pd( lo, v ) );
+}
+
+/* This function is the SSE2 kernel, two rows per iteration. SSE2 is part of x86-64 so it is
+ * always available there.
+ */
+void stepKernelSSE2( double* x, double* y, double* dx, double* dy,
+  const double* wallRadius, const unsigned int* mask, int begin, int end, double dt ) {
+  const __m128d vdt = _mm_set1_pd( dt );
+  const __m128d one = _mm_set1_pd( 1 );
+  const __m128d minusOne = _mm_set1_pd( -1 );
+  const __m128i needPhysics = _mm_set1_epi32( STEP_NEEDS_PHYSICS );
+  const __m128i needWall = _mm_set1_epi32( STEP_NEEDS_WALL );
+  const __m128i checkPhysics = _mm_set1_epi32( (int) STEP_CHECK_PHYSICS );
+  const __m128i checkWall = _mm_set1_epi32( (int) STEP_CHECK_WALL );
+
+  int i = begin;
+  for (; i + 2 <= end; i += 2) {
+    __m128i m = _mm_loadl_epi64( (const __m128i*) (mask + i) );
+    __m128i hasPhysics = _mm_cmpeq_epi32( _mm_and_si128( m, checkPhysics ), needPhysics );
+    __m128i hasWall = _mm_cmpeq_epi32( _mm_and_si128( m, checkWall ), needWall );
+    __m128d physicsLanes = _mm_castsi128_pd( _mm_unpacklo_epi32( hasPhysics, hasPhysics ) );
+    __m128d wallLanes = _mm_castsi128_pd( _mm_unpacklo_epi32( hasWall, hasWall ) );
+
+    __m128d px = _mm_loadu_pd( x + i );
+    __m128d py = _mm_loadu_pd( y + i );
+    __m128d vx = _mm_loadu_pd( dx + i );
+    __m128d vy = _mm_loadu_pd( dy + i );
+    __m128d nx = _mm_add_pd( px, _mm_mul_pd( vx, vdt ) );
+    __m128d ny = _mm_add_pd( py, _mm_mul_pd( vy, vdt ) );
+    px = _mm_or_pd( _mm_and_pd( physicsLanes, nx ), _mm_andnot_pd( physicsLanes, px ) );
+    py = _mm_or_pd( _mm_and_pd( physicsLanes, ny ), _mm_andnot_pd( physicsLanes, py ) );
+    _mm_storeu_pd( x + i, px );
+    _mm_storeu_pd( y + i, py );
+
+    __m128d r = _mm_loadu_pd( wallRadius + i );
+    vx = reflectSSE2( vx,
+      _mm_and_pd( wallLanes, _mm_cmpge_pd( _mm_add_pd( px, r ), one ) ),
+      _mm_and_pd( wallLanes, _mm_cmple_pd( _mm_sub_pd( px, r ), minusOne ) ) );
+    vy = reflectSSE2( vy,
+      _mm_and_pd( wallLanes, _mm_cmpge_pd( _mm_add_pd( py, r ), one ) ),
+      _mm_and_pd( wallLanes, _mm_cmple_pd( _mm_sub_pd( py, r ), minusOne ) ) );
+    _mm_storeu_pd( dx + i, vx );
+    _mm_storeu_pd( dy + i, vy );
+  }
+  stepKernelScalar( x, y, dx, dy, wallRadius, mask, i, end, dt );
+}
+
+/*End SSE2-------------------------------------------------------*/
+
+/*Begin AVX2-------------------------------------------------------*/
+
+/* This function reflects one velocity component for four lanes.
+ */
+__attribute__(( target( "avx2" ) ))
+static inline __m256d reflectAVX2( __m256d v, __m256d hi, __m256d lo ) {
+  const __m256d sign = _mm256_set1_pd( -0.0 );
+  v = _mm256_blendv_pd( v, _mm256_or_pd( v, sign ), hi );
+  return _mm256_blendv_pd( v, _mm256_andnot_pd( sign, v ), lo );
+}
+
+/* This function is the AVX2 kernel, four rows per iteration.
+ */
+__attribute__(( target( "avx2" ) ))
+void stepKernelAVX2( double* x, double* y, double* dx, double* dy,
+  const double* wallRadius, const unsigned int* mask, int begin, int end, double dt ) {
+  const __m256d vdt = _mm256_set1_pd( dt );
+  const __m256d one = _mm256_set1_pd( 1 );
+  const __m256d minusOne = _mm256_set1_pd( -1 );
+  const __m128i needPhysics = _mm_set1_epi32( STEP_NEEDS_PHYSICS );
+  const __m128i needWall = _mm_set1_epi32( STEP_NEEDS_WALL );
+  const __m128i checkPhysics = _mm_set1_epi32( (int) STEP_CHECK_PHYSICS );
+  const __m128i checkWall = _mm_set1_epi32( (int) STEP_CHECK_WALL );
+
+  int i = begin;
+  for (; i + 4 <= end; i += 4) {
+    __m128i m = _mm_loadu_si128( (const __m128i*) (mask + i) );
+    __m256d physicsLanes = _mm256_castsi256_pd( _mm256_cvtepi32_epi64(
+      _mm_cmpeq_epi32( _mm_and_si128( m, checkPhysics ), needPhysics ) ) );
+    __m256d wallLanes = _mm256_castsi256_pd( _mm256_cvtepi32_epi64(
+      _mm_cmpeq_epi32( _mm_and_si128( m, checkWall ), needWall ) ) );
+
+    __m256d px = _mm256_loadu_pd( x + i );
+    __m256d py = _mm256_loadu_pd( y + i );
+    __m256d vx = _mm256_loadu_pd( dx + i );
+    __m256d vy = _mm256_loadu_pd( dy + i );
+    px = _mm256_blendv_pd( px, _mm256_add_pd( px, _mm256_mul_pd( vx, vdt ) ), physicsLanes );
+    py = _mm256_blendv_pd( py, _mm256_add_pd( py, _mm256_mul_pd( vy, vdt ) ), physicsLanes );
+    _mm256_storeu_pd( x + i, px );
+    _mm256_storeu_pd( y + i, py );
+
+    __m256d r = _mm256_loadu_pd( wallRadius + i );
+    vx = reflectAVX2( vx,
+      _mm256_and_pd( wallLanes, _mm256_cmp_pd( _mm256_add_pd( px, r ), one, _CMP_GE_OQ ) ),
+      _mm256_and_pd( wallLanes, _mm256_cmp_pd( _mm256_sub_pd( px, r ), minusOne, _CMP_LE_OQ ) ) );
+    vy = reflectAVX2( vy,
+      _mm256_and_pd( wallLanes, _mm256_cmp_pd( _mm256_add_pd( py, r ), one, _CMP_GE_OQ ) ),
+      _mm256_and_pd( wallLanes, _mm256_cmp_pd( _mm256_sub_pd( py, r ), minusOne, _CMP_LE_OQ ) ) );
+    _mm256_storeu_pd( dx + i, vx );
+    _mm256_storeu_pd( dy + i, vy );
+  }
+  stepKernelScalar( x, y, dx, dy, wallRadius, mask, i, end, dt );
+}
+
+/*End AVX2-------------------------------------------------------*/
+
+/*Begin AVX-512-------------------------------------------------------*/
+
+/* This function is the AVX-512 kernel, eight rows per iteration, using mask registers for
+ * the per-lane component checks.
+ */
+__attribute__(( target( "avx512f" ) ))
+void stepKernelAVX512( double* x, double* y, double* dx, double* dy,
+  const double* wallRadius, const unsigned int* mask, int begin, int end, double dt ) {
+  const __m512d vdt = _mm512_set1_pd( dt );
+  const __m512d one = _mm512_set1_pd( 1 );
+  const __m512d minusOne = _mm512_set1_pd( -1 );
+  const __m512i sign = _mm512_set1_epi64( (long long) 0x8000000000000000ull );
+  const __m512i needPhysics = _mm512_set1_epi64( STEP_NEEDS_PHYSICS );
+  const __m512i needWall = _mm512_set1_epi64( STEP_NEEDS_WALL );
+  const __m512i checkPhysics = _mm512_set1_epi64( STEP_CHECK_PHYSICS );
+  const __m512i checkWall = _mm512_set1_epi64( STEP_CHECK_WALL );
+
+  int i = begin;
+  for (; i + 8 <= end; i += 8) {
+    __m512i m = _mm512_cvtepu32_epi64( _mm256_loadu_si256( (const __m256i*) (mask + i) ) );
+    __mmask8 physicsLanes = _mm512_cmpeq_epi64_mask( _mm512_and_si512( m, checkPhysics ), needPhysics );
+    __mmask8 wallLanes = _mm512_cmpeq_epi64_mask( _mm512_and_si512( m, checkWall ), needWall );
+
+    __m512d px = _mm512_loadu_pd( x + i );
+    __m512d py = _mm512_loadu_pd( y + i );
+    __m512d vx = _mm512_loadu_pd( dx + i );
+    __m512d vy = _mm512_loadu_pd( dy + i );
+    px = _mm512_mask_add_pd( px, physicsLanes, px, _mm512_mul_pd( vx, vdt ) );
+    py = _mm512_mask_add_pd( py, physicsLanes, py, _mm512_mul_pd( vy, vdt ) );
+    _mm512_storeu_pd( x + i, px );
+    _mm512_storeu_pd( y + i, py );
+
+    __m512d r = _mm512_loadu_pd( wallRadius + i );
+    __m512i ix = _mm512_castpd_si512( vx );
+    __m512i iy = _mm512_castpd_si512( vy );
+    ix = _mm512_mask_or_epi64( ix, _mm512_mask_cmp_pd_mask( wallLanes, _mm512_add_pd( px, r ), one, _CMP_GE_OQ ), ix, sign );
+    ix = _mm512_mask_andnot_epi64( ix, _mm512_mask_cmp_pd_mask( wallLanes, _mm512_sub_pd( px, r ), minusOne, _CMP_LE_OQ ), sign, ix );
+    iy = _mm512_mask_or_epi64( iy, _mm512_mask_cmp_pd_mask( wallLanes, _mm512_add_pd( py, r ), one, _CMP_GE_OQ ), iy, sign );
+    iy = _mm512_mask_andnot_epi64( iy, _mm512_mask_cmp_pd_mask( wallLanes, _mm512_sub_pd( py, r ), minusOne, _CMP_LE_OQ ), sign, iy );
+    _mm512_storeu_pd( dx + i, _mm512_castsi512_pd( ix ) );
+    _mm512_storeu_pd( dy + i, _mm512_castsi512_pd( iy ) );
+  }
+  stepKernelScalar( x, y, dx, dy, wallRadius, mask, i, end, dt );
+}
+
+/*End AVX-512-------------------------------------------------------*/
+
+#endif
+
+#ifdef SCALAR_FLOAT
+
+/*Begin SSE2 float-------------------------------------------------------*/
+
+/* This function reflects one velocity component for four float lanes.
+ * Lanes in hi get -|v|, then lanes in lo get |v|, matching the order of the scalar tests.
+ */
+static inline __m128 reflectFloatSSE2( __m128 v, __m128 hi, __m128 lo ) {
+  const __m128 sign = _mm_set1_ps( -0.0f );
+  __m128 negAbs = _mm_or_ps( v, sign );
+  __m128 posAbs = _mm_andnot_ps( sign, v );
+  v = _mm_or_ps( _mm_and_ps( hi, negAbs ), _mm_andnot_ps( hi, v ) );
+  return _mm_or_ps( _mm_and_ps( lo, posAbs ), _mm_andnot_ps( lo, v ) );
+}
+
+/* This function is the SSE2 kernel of float builds, four rows per iteration. A mask lane and
+ * a float lane are the same width, so the component checks need no widening.
+ */
+void stepKernelFloatSSE2( float* x, float* y, float* dx, float* dy,
+  const float* wallRadius, const unsigned int* mask, int begin, int end, double dt ) {
+  const __m128 vdt = _mm_set1_ps( (float) dt );
+  const __m128 one = _mm_set1_ps( 1 );
+  const __m128 minusOne = _mm_set1_ps( -1 );
+  const __m128i needPhysics = _mm_set1_epi32( STEP_NEEDS_PHYSICS );
+  const __m128i needWall = _mm_set1_epi32( STEP_NEEDS_WALL );
+  const __m128i checkPhysics = _mm_set1_epi32( (int) STEP_CHECK_PHYSICS );
+  const __m128i checkWall = _mm_set1_epi32( (int) STEP_CHECK_WALL );
+
+  int i = begin;
+  for (; i + 4 <= end; i += 4) {
+    __m128i m = _mm_loadu_si128( (const __m128i*) (mask + i) );
+    __m128 physicsLanes = _mm_castsi128_ps( _mm_cmpeq_epi32( _mm_and_si128( m, checkPhysics ), needPhysics ) );
+    __m128 wallLanes = _mm_castsi128_ps( _mm_cmpeq_epi32( _mm_and_si128( m, checkWall ), needWall ) );
+
+    __m128 px = _mm_loadu_ps( x + i );
+    __m128 py = _mm_loadu_ps( y + i );
+    __m128 vx = _mm_loadu_ps( dx + i );
+    __m128 vy = _mm_loadu_ps( dy + i );
+    __m128 nx = _mm_add_ps( px, _mm_mul_ps( vx, vdt ) );
+    __m128 ny = _mm_add_ps( py, _mm_mul_ps( vy, vdt ) );
+    px = _mm_or_ps( _mm_and_ps( physicsLanes, nx ), _mm_andnot_ps( physicsLanes, px ) );
+    py = _mm_or_ps( _mm_and_ps( physicsLanes, ny ), _mm_andnot_ps( physicsLanes, py ) );
+    _mm_storeu_ps( x + i, px );
+    _mm_storeu_ps( y + i, py );
+
+    __m128 r = _mm_loadu_ps( wallRadius + i );
+    vx = reflectFloatSSE2( vx,
+      _mm_and_ps( wallLanes, _mm_cmpge_ps( _mm_add_ps( px, r ), one ) ),
+      _mm_and_ps( wallLanes, _mm_cmple_ps( _mm_sub_ps( px, r ), minusOne ) ) );
+    vy = reflectFloatSSE2( vy,
+      _mm_and_ps( wallLanes, _mm_cmpge_ps( _mm_add_ps( py, r ), one ) ),
+      _mm_and_ps( wallLanes, _mm_cmple_ps( _mm_sub_ps( py, r ), minusOne ) ) );
+    _mm_storeu_ps( dx + i, vx );
+    _mm_storeu_ps( dy + i, vy );
+  }
+  stepKernelScalar( x, y, dx, dy, wallRadius, mask, i, end, dt );
+}
+
+/*End SSE2 float-------------------------------------------------------*/
+
+/*Begin AVX2 float-------------------------------------------------------*/
+
+/* This function reflects one velocity component for eight float lanes.
+ */
+__attribute__(( target( "avx2" ) ))
+static inline __m256 reflectFloatAVX2( __m256 v, __m256 hi, __m256 lo ) {
+  const __m256 sign = _mm256_set1_ps( -0.0f );
+  v = _mm256_blendv_ps( v, _mm256_or_ps( v, sign ), hi );
+  return _mm256_blendv_ps( v, _mm256_andnot_ps( sign, v ), lo );
+}
+
+/* This function is the AVX2 kernel of float builds, eight rows per iteration.
+ */
+__attribute__(( target( "avx2" ) ))
+void stepKernelFloatAVX2( float* x, float* y, float* dx, float* dy,
+  const float* wallRadius, const unsigned int* mask, int begin, int end, double dt ) {
+  const __m256 vdt = _mm256_set1_ps( (float) dt );
+  const __m256 one = _mm256_set1_ps( 1 );
+  const __m256 minusOne = _mm256_set1_ps( -1 );
+  const __m256i needPhysics = _mm256_set1_epi32( STEP_NEEDS_PHYSICS );
+  const __m256i needWall = _mm256_set1_epi32( STEP_NEEDS_WALL );
+  const __m256i checkPhysics = _mm256_set1_epi32( (int) STEP_CHECK_PHYSICS );
+  const __m256i checkWall = _mm256_set1_epi32( (int) STEP_CHECK_WALL );
+
+  int i = begin;
+  for (; i + 8 <= end; i += 8) {
+    __m256i m = _mm256_loadu_si256( (const __m256i*) (mask + i) );
+    __m256 physicsLanes = _mm256_castsi256_ps( _mm256_cmpeq_epi32( _mm256_and_si256( m, checkPhysics ), needPhysics ) );
+    __m256 wallLanes = _mm256_castsi256_ps( _mm256_cmpeq_epi32( _mm256_and_si256( m, checkWall ), needWall ) );
+
+    __m256 px = _mm256_loadu_ps( x + i );
+    __m256 py = _mm256_loadu_ps( y + i );
+    __m256 vx = _mm256_loadu_ps( dx + i );
+    __m256 vy = _mm256_loadu_ps( dy + i );
+    px = _mm256_blendv_ps( px, _mm256_add_ps( px, _mm256_mul_ps( vx, vdt ) ), physicsLanes );
+    py = _mm256_blendv_ps( py, _mm256_add_ps( py, _mm256_mul_ps( vy, vdt ) ), physicsLanes );
+    _mm256_storeu_ps( x + i, px );
+    _mm256_storeu_ps( y + i, py );
+
+    __m256 r = _mm256_loadu_ps( wallRadius + i );
+    vx = reflectFloatAVX2( vx,
+      _mm256_and_ps( wallLanes, _mm256_cmp_ps( _mm256_add_ps( px, r ), one, _CMP_GE_OQ ) ),
+      _mm256_and_ps( wallLanes, _mm256_cmp_ps( _mm256_sub_ps( px, r ), minusOne, _CMP_LE_OQ ) ) );
+    vy = reflectFloatAVX2( vy,
+      _mm256_and_ps( wallLanes, _mm256_cmp_ps( _mm256_add_ps( py, r ), one, _CMP_GE_OQ ) ),
+      _mm256_and_ps( wallLanes, _mm256_cmp_ps( _mm256_sub_ps( py, r ), minusOne, _CMP_LE_OQ ) ) );
+    _mm256_storeu_ps( dx + i, vx );
+    _mm256_storeu_ps( dy + i, vy );
+  }
+  stepKernelScalar( x, y, dx, dy, wallRadius, mask, i, end, dt );
+}
+
+/*End AVX2 float-------------------------------------------------------*/
+
+/*Begin AVX-512 float-------------------------------------------------------*/
+
+/* This function is the AVX-512 kernel of float builds, sixteen rows per iteration.
+ */
+__attribute__(( target( "avx512f" ) ))
+void stepKernelFloatAVX512( float* x, float* y, float* dx, float* dy,
+  const float* wallRadius, const unsigned int* mask, int begin, int end, double dt ) {
+  const __m512 vdt = _mm512_set1_ps( (float) dt );
+  const __m512 one = _mm512_set1_ps( 1 );
+  const __m512 minusOne = _mm512_set1_ps( -1 );
+  const __m512i sign = _mm512_set1_epi32( (int) 0x80000000u );
+  const __m512i needPhysics = _mm512_set1_epi32( STEP_NEEDS_PHYSICS );
+  const __m512i needWall = _mm512_set1_epi32( STEP_NEEDS_WALL );
+  const __m512i checkPhysics = _mm512_set1_epi32( (int) STEP_CHECK_PHYSICS );
+  const __m512i checkWall = _mm512_set1_epi32( (int) STEP_CHECK_WALL );
+
+  int i = begin;
+  for (; i + 16 <= end; i += 16) {
+    __m512i m = _mm512_loadu_si512( (const void*) (mask + i) );
+    __mmask16 physicsLanes = _mm512_cmpeq_epi32_mask( _mm512_and_si512( m, checkPhysics ), needPhysics );
+    __mmask16 wallLanes = _mm512_cmpeq_epi32_mask( _mm512_and_si512( m, checkWall ), needWall );
+
+    __m512 px = _mm512_loadu_ps( x + i );
+    __m512 py = _mm512_loadu_ps( y + i );
+    __m512 vx = _mm512_loadu_ps( dx + i );
+    __m512 vy = _mm512_loadu_ps( dy + i );
+    px = _mm512_mask_add_ps( px, physicsLanes, px, _mm512_mul_ps( vx, vdt ) );
+    py = _mm512_mask_add_ps( py, physicsLanes, py, _mm512_mul_ps( vy, vdt ) );
+    _mm512_storeu_ps( x + i, px );
+    _mm512_storeu_ps( y + i, py );
+
+    __m512 r = _mm512_loadu_ps( wallRadius + i );
+    __m512i ix = _mm512_castps_si512( vx );
+    __m512i iy = _mm512_castps_si512( vy );
+    ix = _mm512_mask_or_epi32( ix, _mm512_mask_cmp_ps_mask( wallLanes, _mm512_add_ps( px, r ), one, _CMP_GE_OQ ), ix, sign );
+    ix = _mm512_mask_andnot_epi32( ix, _mm512_mask_cmp_ps_mask( wallLanes, _mm512_sub_ps( px, r ), minusOne, _CMP_LE_OQ ), sign, ix );
+    iy = _mm512_mask_or_epi32( iy, _mm512_mask_cmp_ps_mask( wallLanes, _mm512_add_ps( py, r ), one, _CMP_GE_OQ ), iy, sign );
+    iy = _mm512_mask_andnot_epi32( iy, _mm512_mask_cmp_ps_mask( wallLanes, _mm512_sub_ps( py, r ), minusOne, _CMP_LE_OQ ), sign, iy );
+    _mm512_storeu_ps( dx + i, _mm512_castsi512_ps( ix ) );
+    _mm512_storeu_ps( dy + i, _mm512_castsi512_ps( iy ) );
+  }
+  stepKernelScalar( x, y, dx, dy, wallRadius, mask, i, end, dt );
+}
+
+/*End AVX-512 float-------------------------------------------------------*/
+
+#endif
+
+/*Begin Dispatch-------------------------------------------------------*/
+
+// Kernels from widest to narrowest; "auto" takes the first one the CPU supports
+static const stepKernelInfo_t stepKernels[] = {
+#if defined( SCALAR_FLOAT )
+  { "avx512", stepKernelFloatAVX512 },
+  { "avx2", stepKernelFloatAVX2 },
+  { "sse2", stepKernelFloatSSE2 },
+#elif !defined( SCALAR_FIXED )
+  { "avx512", stepKernelAVX512 },
+  { "avx2", stepKernelAVX2 },
+  { "sse2", stepKernelSSE2 },
+#endif
+  { "scalar", stepKernelScalar },
+};
+
+/* This function reports whether the CPU can run a kernel
+ *
+ * @param (const char* name) the kernel name
+ */
+static bool stepKernelSupported( const char* name ) {
+  __builtin_cpu_init();
+  if (strcmp( name, "avx512" ) == 0) return __builtin_cpu_supports( "avx512f" );
+  if (strcmp( name, "avx2" ) == 0) return __builtin_cpu_supports( "avx2" );
+  return true;
+}
+
+/* This function returns the widest kernel the CPU supports
+ */
+static stepKernelInfo_t defaultStepKernel() {
+  for (const stepKernelInfo_t& info: stepKernels) {
+    if (stepKernelSupported( info.name )) return info;
+  }
+  return stepKernels[sizeof( stepKernels ) / sizeof( stepKernels[0] ) - 1];
+}
+
+stepKernelInfo_t activeStepKernel = defaultStepKernel();
+
+/* This function chooses the kernel used by BodyStore::integrateAndBounce
+ *
+ * @param (const char* name) "auto", "avx512", "avx2", "sse2" or "scalar"
+ */
+bool selectStepKernel( const char* name ) {
+  for (const stepKernelInfo_t& info: stepKernels) {
+    if (strcmp( name, "auto" ) != 0 && strcmp( name, info.name ) != 0) continue;
+    if (!stepKernelSupported( info.name )) continue;
+    activeStepKernel = info;
+    return true;
+  }
+  return false;
+}
+
+/*End Dispatch-------------------------------------------------------*/
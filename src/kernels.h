@@ -0,0 +1,23 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include "scalar.h"
+
+/* Fused Physics + WallBounceScript kernel: for rows [begin, end) with a Physics component,
+ * position += velocity * dt, then rows that also have a WallBounceScript get their velocity
+ * pointed away from any +-1 wall they touch. Every variant gives bit-identical results.
+ * The vector variants exist for double and float builds; fixed point builds only have "scalar".
+ */
+typedef void ( * stepKernel_t ) ( scalar_t* x, scalar_t* y, scalar_t* dx, scalar_t* dy,
+  const scalar_t* wallRadius, const unsigned int* mask, int begin, int end, double dt );
+
+struct stepKernelInfo_t {
+  const char* name;
+  stepKernel_t kernel;
+};
+
+extern stepKernelInfo_t activeStepKernel;
+
+bool selectStepKernel( const char* name ); // "auto" picks the widest kernel this CPU supports; returns false if unknown or unsupported
+
+#endif
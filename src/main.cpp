@@ -1,104 +1,420 @@
 #include "components.h"
 #include "components.cpp"
 #include "gameloop.cpp"
+#include "balls.cpp"
+#include <string.h>
 
-/* trigger function that will print to the terminal when called
+const char* profilePath = NULL;
+
+/* Writes the Chrome trace and prints the profile summary; registered with atexit so it also
+ * runs when the window is closed.
+*/
+void writeProfile() {
+#ifdef ENABLE_PROFILING
+  Profiler::printSummary(statusOut);
+  if (!Profiler::writeChromeTrace(profilePath)) fprintf(stderr, "could not write profile %s\n", profilePath);
+#endif
+}
+
+TraceReader replayReader;
+traceFrame_t replayFrame;
+
+/* Fixed update used while replaying a trace: copies the next recorded frame into the bodies
+ * instead of simulating. Bodies that appear in the trace are created as plain circles.
+ *
+ * @param (float dt) the fixed timestep in milliseconds (unused, the trace sets the state)
+*/
+void replayStep(float dt) {
+  if (!replayReader.readFrame(replayFrame)) {
+    odlGameLoopState().stopRequested = 1;
+    return;
+  }
+  int n = (int) replayFrame.x.size();
+  while (bodyStore().size() < n) {
+    int i = bodyStore().size();
+    CircleRender* circle = new CircleRender(new GameObject(0, 0), i < (int) replayReader.radius.size() ? replayReader.radius[i] : .01);
+    if (i < (int) replayReader.color.size()) circle->setColor(replayReader.color[i].R, replayReader.color[i].G, replayReader.color[i].B);
+  }
+  for (int i = 0; i < n; i++) {
+    bodyStore().x[i] = toScalar(replayFrame.x[i]);
+    bodyStore().y[i] = toScalar(replayFrame.y[i]);
+    bodyStore().dx[i] = toScalar(replayFrame.dx[i]);
+    bodyStore().dy[i] = toScalar(replayFrame.dy[i]);
+  }
+}
+
+/* Watches a live stream: rebuilds the bodies from its frames for a while, then prints how many
+ * frames and bytes arrived and how old the frames were on arrival
  *
- * @param (Collider* c1) first collider involved in collision
- * @param (Collider* cc) first second involved in collision
+ * @param (const char* address) the server as host:port
+ * @param (double seconds) how long to watch
+ * @param (int fps) the frames per second to ask for, 0 for the server's rate
 */
-void printOnCollide(Collider* c1, Collider* c2){
-  printf("collide");
+int watchStream(const char* address, double seconds, int fps) {
+  string host(address);
+  size_t colon = host.rfind(':');
+  if (colon == string::npos) {
+    fprintf(stderr, "--watch needs host:port\n");
+    return 1;
+  }
+  int port = atoi(host.c_str() + colon + 1);
+  host.resize(colon);
+  StreamClient client;
+  if (!client.connect(host.c_str(), port, fps)) {
+    fprintf(stderr, "could not connect to %s\n", address);
+    return 1;
+  }
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  double elapsed = 0, latencySum = 0, latencyMax = 0;
+  long bodyFrames = 0;
+  uint64_t deltaBytes = 0;
+  long deltaBodies = 0;
+  while (elapsed < seconds) {
+    uint64_t before = client.bytesReceived;
+    long keyframes = client.keyframes;
+    if (!client.readFrame()) break;
+    double latencyMs = (streamClockNs() - client.captureNs) / 1e6;
+    latencySum += latencyMs;
+    latencyMax = max(latencyMax, latencyMs);
+    bodyFrames += client.x.size();
+    if (client.keyframes == keyframes) {
+      deltaBytes += client.bytesReceived - before;
+      deltaBodies += client.x.size();
+    }
+    elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  }
+  long frames = max(1L, client.frames);
+  printf("Watched %s. Frames:%ld Keyframes:%ld Bodies:%d Step:%ld Bytes:%llu Bandwidth:%.1fKB/s "
+    "Bytes/body/frame:%.2f (deltas %.2f) Latency mean:%.3fms max:%.3fms \n",
+    address, client.frames, client.keyframes, (int) client.x.size(), client.step, (unsigned long long) client.bytesReceived,
+    elapsed > 0 ? client.bytesReceived / elapsed / 1024 : 0, bodyFrames > 0 ? (double) client.bytesReceived / bodyFrames : 0,
+    deltaBodies > 0 ? (double) deltaBytes / deltaBodies : 0, latencySum / frames, latencyMax);
+  return client.frames > 0 ? 0 : 1;
 }
 
-/* trigger function that will freeze the colliding balls and change their colors when called
+/* Creates the six balls of the default world
  *
- * @param (Collider* c1) first collider involved in collision
- * @param (Collider* cc) first second involved in collision
+ * @param (double speed) factor applied to every starting velocity
 */
-void freezeTag(Collider* c1, Collider* c2){
-  // Freeze both objects
-  Physics* p1 = (Physics*) c1->parent->getComponent("Physics").front();
-  Physics* p2 = (Physics*) c2->parent->getComponent("Physics").front();
-  p1->dx = 0;
-  p1->dy = 0;
-  p2->dx = 0;
-  p2->dy = 0;
-
-  // Change their color to red
-  CircleRender* cr1 = (CircleRender*) c1->parent->getComponent("CircleRender").front();
-  CircleRender* cr2 = (CircleRender*) c2->parent->getComponent("CircleRender").front();
-  cr1->setColor(1, 0, 0);
-  cr2->setColor(1, 0, 0);
+void createDefaultBalls(double speed) {
+  createBall(.5, .5, -.00045 * speed, 0, .1);
+  createBall(-.25, .5, .00045 * speed, 0, .2);
+  createBall(-.75, .45, .0001 * speed, .0002 * speed, .1);
+  createBall(0, 0, .0007 * speed, -.00005 * speed, .15);
+  createBall(.6, -.45, .0003 * speed, -.0002 * speed, .05);
+  createBall(-.35, -.45, .0003 * speed, -.0002 * speed, .05);
 }
 
-/* trigger function that cause the balls to "bounce" when called
+/* Builds world number n of an ensemble run: the default balls with their velocities scaled by
+ * 0.5 + (n mod 101) / 100, a sweep of the starting speed from half to one and a half times the
+ * default.
  *
- * @param (Collider* c1) first collider involved in collision
- * @param (Collider* cc) first second involved in collision
+ * @param (int world) the number of the world
 */
-void Bounce(Collider* c1, Collider* c2, float dt){
-  // Access the physics components of both balls
-  Physics* p1 = (Physics*) c1->parent->getComponent("Physics").front();
-  Physics* p2 = (Physics*) c2->parent->getComponent("Physics").front();
-
-  // Calculate new velocities
-  float newv1x = (p1->dx * (p1->mass - p2->mass) +
-    (2 * p2->mass * p2->dx)) / (p1->mass + p2->mass);
-  float newv1y = (p1->dy * (p1->mass - p2->mass) +
-    (2 * p2->mass * p2->dy)) / (p1->mass + p2->mass);
-
-  float newv2x = (p2->dx * (p2->mass - p1->mass) +
-    (2 * p1->mass * p1->dx)) / (p1->mass + p2->mass);
-  float newv2y = (p2->dy * (p2->mass - p1->mass) +
-    (2 * p1->mass * p1->dy)) / (p1->mass + p2->mass);
-
-    // Assign velocities
-    p1->dx = newv1x;
-    p1->dy = newv1y;
-
-    p2->dx = newv2x;
-    p2->dy = newv2y;
-
-    // Back the balls off by one step of their new velocities so that collision does not register twice
-    p1->parent->x += newv1x * dt;
-    p1->parent->y += newv1y * dt;
-
-    p2->parent->x += newv2x * dt;
-    p2->parent->y += newv2y * dt;
+void createSweepWorld(int world) {
+  createDefaultBalls(0.5 + world % 101 / 100.0);
 }
 
-/* Creates a ball GameObject and associated components
+/* Decodes every frame of a trace and prints a summary
  *
- * @param (double x) the starting x position of the ball
- * @param (double y) the starting y position of the ball
- * @param (double dx) the starting x speed of the ball
- * @param (double dy) the starting y speed of the ball
- * @param (double radius) the starting radius of the ball
+ * @param (const char* path) the trace file
 */
-GameObject* createBall(double x, double y, double dx, double dy, double radius) {
-  float mass = PI * pow(radius, 2);
-  GameObject* obj = new GameObject(x, y);
-  CircleRender* circleRender = new CircleRender(obj, radius);
-  Collider* collider = new Collider(obj, radius);
-  Physics* physics = new Physics(obj, dx, dy, mass);
-  WallBounceScript* wallBounceScript = new WallBounceScript(obj, radius);
-  collider->addTrigger(Bounce);
-  return obj;
+int printTraceInfo(const char* path) {
+  TraceReader reader;
+  if (!reader.open(path)) {
+    fprintf(stderr, "could not read trace %s\n", path);
+    return 1;
+  }
+  traceFrame_t frame;
+  long frames = 0, contacts = 0;
+  double maxSpeed = 0;
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  while (reader.readFrame(frame)) {
+    frames++;
+    contacts += frame.contactA.size();
+    for (size_t i = 0; i < frame.dx.size(); i++) maxSpeed = max(maxSpeed, sqrt(frame.dx[i] * frame.dx[i] + frame.dy[i] * frame.dy[i]));
+  }
+  double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  printf("Trace %s. Steps:%ld-%ld Frames:%ld Chunks:%d Quantized:%d Bodies:%d Contacts:%ld MaxSpeed:%g Decode:%.1f frames/sec \n",
+    path, reader.firstStep(), reader.lastStep(), frames, reader.chunkCount(), (int) reader.isQuantized(),
+    (int) frame.x.size(), contacts, maxSpeed, seconds > 0 ? frames / seconds : 0);
+  return 0;
 }
 
 /* Creates a number of balls and starts the game loop
  *
+ * Passing "--headless <steps>" runs that many fixed updates without opening a window
+ * and prints the wall time and steps per second. "--dt <ms>" overrides the fixed step.
+ * "--kernel <name>" forces one integration kernel instead of the widest the CPU supports.
+ * "--threads <n>" sets how many threads run the fixed step (default: one per core).
+ * "--frames <target>" renders headless runs on the CPU and writes the frames: a pattern with
+ * "%" writes numbered PPM images, "|command" pipes raw RGBA into command, anything else is a
+ * raw RGBA file ("-" for stdout, which sends the summaries to stderr). "--size <w>x<h>" sets
+ * the frame size and "--render-every <n>" renders after every n steps.
+ * "--record <trace>" writes every step to a trace file (quantized unless "--record-raw" is
+ * given), "--replay <trace>" plays one back instead of simulating, starting at "--seek <step>",
+ * and "--trace-info <trace>" prints a summary of a trace.
+ * "--restore <snapshot>" resumes a saved world instead of creating the balls, and "--save
+ * <snapshot>" saves the world at the end of a headless run.
+ * "--scene <file>" loads the balls of a CSV or binary scene file instead of creating the default
+ * ones, and "--save-scene <file>" writes the balls at the end of a headless run (CSV if the name
+ * ends in ".csv").
+ * "--profile <trace.json>" writes the zones and counters recorded by a profiling build
+ * (make -B PROFILE=1) as a Chrome trace on exit and prints a summary of the last steps.
+ * In a window, "--dt" sets the physics rate, "--max-catch-up <n>" the most fixed steps run per
+ * frame before falling behind real time, and "--no-interpolation" draws the bodies where the last
+ * fixed step left them instead of between the last two steps. "--render-thread" runs the fixed
+ * steps on a thread of their own, so drawing and simulating never hold each other up.
+ * "--ccd <substeps>" finds every impact from the velocities and resolves it at the time of
+ * impact, splitting each step into at most that many substeps, so fast balls cannot pass
+ * through each other or the walls even at a large "--dt".
+ * "--sleep" lets balls that have rested for a while fall asleep until something hits them, so
+ * settled worlds only pay for the balls still moving.
+ * "--collision-stats" counts the pairs of balls that start and stop touching during a headless
+ * run and prints the totals at the end.
+ * "--domains <n>" splits a headless run between n worker processes, each simulating one vertical
+ * strip of the world, and ends with the same world a single process would.
+ * "--ensemble <worlds>" runs that many small worlds instead, each for the "--headless" steps:
+ * the default balls with their starting speed swept from half to one and a half times the
+ * default. They are stepped on "--threads" threads at a time, the throughput in world steps
+ * per second is printed, and "--ensemble-out <file.csv>" writes a summary of every world.
+ * "--stream <port>" serves the bodies live to viewers on other machines, at most "--stream-fps
+ * <n>" frames per second to each (default 30). "--watch <host:port>" is such a viewer: it
+ * rebuilds the bodies for "--watch-seconds <s>" (default 5) and prints the bandwidth and latency.
 */
-int main() {
-  // Set up objects
-  createBall(.5, .5, -.00045, 0, .1);
-  createBall(-.25, .5, .00045, 0, .2);
-  createBall(-.75, .45, .0001, .0002, .1);
-  createBall(0, 0, .0007, -.00005, .15);
-  createBall(.6, -.45, .0003, -.0002, .05);
-  createBall(-.35, -.45, .0003, -.0002, .05);
+int main(int argc, char** argv) {
+  long headlessSteps = -1;
+  double dtMs = DESIRED_STATE_UPDATE_DURATION_MS;
+  int threads = thread::hardware_concurrency();
+  const char* framesTarget = NULL;
+  int frameWidth = VIEW_WIDTH;
+  int frameHeight = VIEW_HEIGHT;
+  int renderEvery = 1;
+  const char* recordPath = NULL;
+  bool recordQuantized = true;
+  const char* replayPath = NULL;
+  long seekStep = -1;
+  const char* restorePath = NULL;
+  const char* savePath = NULL;
+  const char* scenePath = NULL;
+  const char* saveScenePath = NULL;
+  bool dtGiven = false;
+  int maxCatchUpSteps = MAX_CATCH_UP_STEPS;
+  int interpolate = 1;
+  int renderThread = 0;
+  bool collisionStats = false;
+  int domains = 0;
+  int ensembleWorlds = 0;
+  const char* ensembleOutPath = NULL;
+  int streamPort = -1;
+  int streamFps = 0;
+  const char* watchAddress = NULL;
+  double watchSeconds = 5;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--headless") == 0 && i + 1 < argc) headlessSteps = atol(argv[++i]);
+    else if (strcmp(argv[i], "--dt") == 0 && i + 1 < argc) {
+      dtMs = atof(argv[++i]);
+      dtGiven = true;
+    }
+    else if (strcmp(argv[i], "--kernel") == 0 && i + 1 < argc) {
+      if (!selectStepKernel(argv[++i])) {
+        fprintf(stderr, "kernel %s is unknown or not supported by this CPU\n", argv[i]);
+        return 1;
+      }
+    }
+    else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) threads = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) framesTarget = argv[++i];
+    else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc) sscanf(argv[++i], "%dx%d", &frameWidth, &frameHeight);
+    else if (strcmp(argv[i], "--render-every") == 0 && i + 1 < argc) renderEvery = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) recordPath = argv[++i];
+    else if (strcmp(argv[i], "--record-raw") == 0) recordQuantized = false;
+    else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) replayPath = argv[++i];
+    else if (strcmp(argv[i], "--seek") == 0 && i + 1 < argc) seekStep = atol(argv[++i]);
+    else if (strcmp(argv[i], "--trace-info") == 0 && i + 1 < argc) return printTraceInfo(argv[++i]);
+    else if (strcmp(argv[i], "--restore") == 0 && i + 1 < argc) restorePath = argv[++i];
+    else if (strcmp(argv[i], "--save") == 0 && i + 1 < argc) savePath = argv[++i];
+    else if (strcmp(argv[i], "--scene") == 0 && i + 1 < argc) scenePath = argv[++i];
+    else if (strcmp(argv[i], "--save-scene") == 0 && i + 1 < argc) saveScenePath = argv[++i];
+    else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) profilePath = argv[++i];
+    else if (strcmp(argv[i], "--max-catch-up") == 0 && i + 1 < argc) maxCatchUpSteps = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--no-interpolation") == 0) interpolate = 0;
+    else if (strcmp(argv[i], "--render-thread") == 0) renderThread = 1;
+    else if (strcmp(argv[i], "--sleep") == 0) sleepSettings().enabled = true;
+    else if (strcmp(argv[i], "--ccd") == 0 && i + 1 < argc) Collider::continuousSubsteps() = max(1, atoi(argv[++i]));
+    else if (strcmp(argv[i], "--collision-stats") == 0) collisionStats = true;
+    else if (strcmp(argv[i], "--domains") == 0 && i + 1 < argc) domains = max(1, atoi(argv[++i]));
+    else if (strcmp(argv[i], "--ensemble") == 0 && i + 1 < argc) ensembleWorlds = max(1, atoi(argv[++i]));
+    else if (strcmp(argv[i], "--ensemble-out") == 0 && i + 1 < argc) ensembleOutPath = argv[++i];
+    else if (strcmp(argv[i], "--stream") == 0 && i + 1 < argc) streamPort = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--stream-fps") == 0 && i + 1 < argc) streamFps = max(0, atoi(argv[++i]));
+    else if (strcmp(argv[i], "--watch") == 0 && i + 1 < argc) watchAddress = argv[++i];
+    else if (strcmp(argv[i], "--watch-seconds") == 0 && i + 1 < argc) watchSeconds = atof(argv[++i]);
+    else {
+      fprintf(stderr, "usage: %s [--headless <steps>] [--dt <ms>] [--kernel auto|avx512|avx2|sse2|scalar] [--threads <n>]\n"
+        "          [--frames <out%%05d.ppm|file.rgba|-|\"|command\">] [--size <w>x<h>] [--render-every <steps>]\n"
+        "          [--record <trace> [--record-raw]] [--replay <trace> [--seek <step>]] [--trace-info <trace>]\n"
+        "          [--restore <snapshot>] [--save <snapshot>] [--scene <file>] [--save-scene <file>]\n"
+        "          [--profile <trace.json>] [--max-catch-up <steps>] [--no-interpolation] [--render-thread]\n"
+        "          [--ccd <substeps>] [--sleep] [--collision-stats] [--domains <n>]\n"
+        "          [--ensemble <worlds> [--ensemble-out <file.csv>]] [--stream <port>] [--stream-fps <n>]\n"
+        "          [--watch <host:port> [--watch-seconds <s>]]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  if (watchAddress != NULL) return watchStream(watchAddress, watchSeconds, streamFps);
+
+#ifndef ENABLE_PROFILING
+  if (profilePath != NULL) {
+    fprintf(stderr, "--profile needs a profiling build: make -B PROFILE=1\n");
+    return 1;
+  }
+#endif
+  if (profilePath != NULL) atexit(writeProfile);
+
+  if (domains > 0) {
+    if (headlessSteps < 0) {
+      fprintf(stderr, "--domains needs --headless\n");
+      return 1;
+    }
+    if (Collider::continuousSubsteps() > 0 || sleepSettings().enabled || recordPath != NULL || replayPath != NULL ||
+        framesTarget != NULL || collisionStats) {
+      fprintf(stderr, "--domains cannot be used with --ccd, --sleep, --record, --replay, --frames or --collision-stats\n");
+      return 1;
+    }
+  }
+  if (streamPort >= 0 && (domains > 0 || ensembleWorlds > 0)) {
+    fprintf(stderr, "--stream cannot be used with --domains or --ensemble\n");
+    return 1;
+  }
+  if (ensembleWorlds > 0) {
+    if (headlessSteps < 0) {
+      fprintf(stderr, "--ensemble needs --headless\n");
+      return 1;
+    }
+    if (domains > 0 || scenePath != NULL || restorePath != NULL || savePath != NULL || saveScenePath != NULL ||
+        recordPath != NULL || replayPath != NULL || framesTarget != NULL || collisionStats) {
+      fprintf(stderr, "--ensemble cannot be used with --domains, --scene, --restore, --save, --save-scene, --record, --replay, --frames or --collision-stats\n");
+      return 1;
+    }
+    if (threads > 1) jobPool.start(min(threads, ensembleWorlds));
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    vector<worldSummary_t> summaries;
+    runEnsemble(ensembleWorlds, headlessSteps, dtMs, createSweepWorld, summaries);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    double drift = 0;
+    for (const worldSummary_t& summary: summaries) drift = max(drift, fabs(summary.energyEnd - summary.energyStart) / summary.energyStart);
+    printf("Ensemble run. Worlds:%d Steps:%ld Threads:%d Wall:%.6fs World steps/sec:%.0f Max energy drift:%.3e \n",
+      ensembleWorlds, headlessSteps, jobPool.threadCount(), seconds,
+      seconds > 0 ? ensembleWorlds * (double) headlessSteps / seconds : 0, drift);
+    if (ensembleOutPath != NULL && !saveEnsembleCsv(ensembleOutPath, summaries)) {
+      fprintf(stderr, "could not save ensemble summary %s\n", ensembleOutPath);
+      return 1;
+    }
+    return 0;
+  }
+
+  // The workers of a domain decomposed run start their own threads after they are forked
+  if (threads > 1 && domains == 0) jobPool.start(threads);
+  Collider::registerTrigger("Bounce", Bounce);
+  if (collisionStats) Collider::subscribe(countCollisions);
+
+  if ((savePath != NULL || saveScenePath != NULL) && headlessSteps < 0) {
+    fprintf(stderr, "--save and --save-scene need --headless\n");
+    return 1;
+  }
+
+  SoftwareRenderBackend* softwareBackend = NULL;
+  if (framesTarget != NULL) {
+    if (headlessSteps < 0) {
+      fprintf(stderr, "--frames needs --headless\n");
+      return 1;
+    }
+    softwareBackend = new SoftwareRenderBackend(frameWidth, frameHeight);
+    if (!softwareBackend->open(framesTarget)) {
+      fprintf(stderr, "could not open %s\n", framesTarget);
+      return 1;
+    }
+    renderBackend = softwareBackend;
+    if (strcmp(framesTarget, "-") == 0) statusOut = stderr; // Keep the frames on stdout clean
+  }
+
+  if (replayPath != NULL) {
+    // Replay a recorded trace instead of simulating
+    if (!replayReader.open(replayPath) || (seekStep >= 0 && !replayReader.seek(seekStep))) {
+      fprintf(stderr, "could not read trace %s\n", replayPath);
+      return 1;
+    }
+    odlGameLoopState().fixedUpdate = replayStep;
+  } else if (restorePath != NULL) {
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    if (!loadSnapshot(restorePath)) {
+      fprintf(stderr, "could not restore snapshot %s\n", restorePath);
+      return 1;
+    }
+    // Keep the saved step length unless one was given
+    if (!dtGiven && odlGameLoopState().desiredStateUpdateDurationMs > 0) dtMs = odlGameLoopState().desiredStateUpdateDurationMs;
+    fprintf(statusOut, "Restored %s. Bodies:%d Step:%ld Load:%.6fs \n", restorePath, bodyStore().size(), odlGameLoopState().stepCount,
+      chrono::duration<double>(chrono::steady_clock::now() - start).count());
+  } else if (scenePath != NULL) {
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    long balls = loadScene(scenePath, vector<triggerFunc>(1, Bounce));
+    if (balls < 0) {
+      fprintf(stderr, "could not load scene %s\n", scenePath);
+      return 1;
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    fprintf(statusOut, "Loaded %s. Balls:%ld Load:%.6fs Balls/sec:%.0f \n", scenePath, balls, seconds, seconds > 0 ? balls / seconds : 0);
+  } else {
+    // Set up objects
+    createDefaultBalls(1);
+  }
+
+  TraceRecorder recorder;
+  if (recordPath != NULL) {
+    if (!recorder.open(recordPath, bodyStore(), recordQuantized)) {
+      fprintf(stderr, "could not create trace %s\n", recordPath);
+      return 1;
+    }
+    traceRecorder = &recorder;
+  }
+
+  if (streamPort >= 0) {
+    streamServer = new StreamServer();
+    if (!streamServer->open(streamPort, streamFps > 0 ? streamFps : STREAM_DEFAULT_FPS)) {
+      fprintf(stderr, "could not listen on port %d\n", streamPort);
+      return 1;
+    }
+  }
 
   // Run loop
-  ODLGameLoop_initOpenGL();
+  if (headlessSteps >= 0) {
+    if (domains > 0) {
+      if (!startDomains(domains, headlessSteps, dtMs, threads)) {
+        fprintf(stderr, "could not start %d domain workers\n", domains);
+        return 1;
+      }
+      odlGameLoopState().fixedUpdate = domainCoordinatorStep;
+    }
+    ODLGameLoop_runHeadless(headlessSteps, dtMs, softwareBackend != NULL ? renderEvery : 0);
+    if (domains > 0) finishDomains();
+    if (streamServer != NULL) {
+      streamServer->close();
+      fprintf(statusOut, "Streamed. Frames:%ld Skipped:%ld Bytes:%llu \n", streamServer->framesSent, streamServer->framesSkipped,
+        (unsigned long long) streamServer->bytesSent);
+    }
+    if (collisionStats) fprintf(statusOut, "Collisions entered:%ld exited:%ld \n", collisionsEntered, collisionsExited);
+    recorder.close();
+    if (savePath != NULL && !saveSnapshot(savePath)) {
+      fprintf(stderr, "could not save snapshot %s\n", savePath);
+      return 1;
+    }
+    if (saveScenePath != NULL && !saveScene(saveScenePath)) {
+      fprintf(stderr, "could not save scene %s\n", saveScenePath);
+      return 1;
+    }
+    delete softwareBackend;
+    return 0;
+  }
+  ODLGameLoop_initOpenGL(dtMs, maxCatchUpSteps, interpolate, renderThread);
 }
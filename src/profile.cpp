@@ -0,0 +1,227 @@
+/*-------------------------------------------------------
+
+Implements the profiler behind the PROFILE_ macros.
+Compiles to nothing unless ENABLE_PROFILING is defined.
+
+---------------------------------------------------------*/
+
+#include "profile.h"
+
+#ifdef ENABLE_PROFILING
+
+#include <string.h>
+#include <chrono>
+#include <mutex>
+#include <unordered_map>
+#include <algorithm>
+
+// Per step totals of one zone name over the rolling window
+struct profileZoneWindow_t {
+  const char* name;
+  double ms[PROFILE_SUMMARY_STEPS];
+  int calls[PROFILE_SUMMARY_STEPS];
+};
+
+// Counter values of one finished step
+struct profileStep_t {
+  uint64_t end; // ns since the profiler started
+  uint64_t counters[PROFILE_COUNTERS];
+};
+
+static const char* profileCounterNames[PROFILE_COUNTERS] = { "pairTests", "contacts", "triggers", "allocations" };
+
+static chrono::steady_clock::time_point profileEpoch = chrono::steady_clock::now();
+static mutex profileLock;                    // Guards the lists below, not the buffers themselves
+static vector<ProfileBuffer*> profileBuffers;
+static thread_local ProfileBuffer* threadBuffer = NULL;
+static unordered_map<string, const char*> profileNames;
+static vector<profileZoneWindow_t> profileZones;
+static vector<profileStep_t> profileSteps;   // Ring of the last PROFILE_RING_STEPS steps
+static uint64_t profileStepCount = 0;
+
+/*Begin Profiler-------------------------------------------------------*/
+
+/* This function returns the time since the profiler started in nanoseconds
+ */
+uint64_t Profiler::now() {
+  return (uint64_t) chrono::duration_cast<chrono::nanoseconds>( chrono::steady_clock::now() - profileEpoch ).count();
+}
+
+/* This function returns the ring buffer of the calling thread, creating it the first time the
+ * thread records anything.
+ */
+ProfileBuffer* Profiler::buffer() {
+  if (threadBuffer != NULL) return threadBuffer;
+  ProfileBuffer* b = new ProfileBuffer();
+  b->events.resize( PROFILE_RING_EVENTS );
+  b->written = 0;
+  b->stepCursor = 0;
+  memset( b->counters, 0, sizeof( b->counters ) );
+  lock_guard<mutex> hold( profileLock );
+  b->thread = (int) profileBuffers.size();
+  profileBuffers.push_back( b );
+  threadBuffer = b;
+  return b;
+}
+
+/* This function returns a copy of a name that lives as long as the program, so zones can be
+ * named after strings that may be freed, such as the type of a destroyed component.
+ *
+ * @param (const string& name) the name
+ */
+const char* Profiler::intern( const string& name ) {
+  lock_guard<mutex> hold( profileLock );
+  unordered_map<string, const char*>::iterator found = profileNames.find( name );
+  if (found != profileNames.end()) return found->second;
+  char* copy = strdup( name.c_str() );
+  profileNames[name] = copy;
+  return copy;
+}
+
+/* This function closes the current step. It adds the zones every thread recorded since the
+ * last call to the rolling window, and stores and clears the counters. Each buffer is locked
+ * while it is read, so other threads may go on recording.
+ */
+void Profiler::endStep() {
+  buffer();
+  lock_guard<mutex> hold( profileLock );
+  int slot = (int) (profileStepCount % PROFILE_SUMMARY_STEPS);
+  for (profileZoneWindow_t& zone: profileZones) {
+    zone.ms[slot] = 0;
+    zone.calls[slot] = 0;
+  }
+
+  profileStep_t step;
+  step.end = now();
+  memset( step.counters, 0, sizeof( step.counters ) );
+  for (ProfileBuffer* b: profileBuffers) {
+    lock_guard<mutex> holdBuffer( b->lock );
+    // Zones overwritten before this step ended are lost
+    if (b->written - b->stepCursor > PROFILE_RING_EVENTS) b->stepCursor = b->written - PROFILE_RING_EVENTS;
+    for (; b->stepCursor < b->written; b->stepCursor++) {
+      const profileEvent_t& event = b->events[b->stepCursor % PROFILE_RING_EVENTS];
+      profileZoneWindow_t* zone = NULL;
+      for (profileZoneWindow_t& z: profileZones) {
+        if (z.name == event.name) {
+          zone = &z;
+          break;
+        }
+      }
+      if (zone == NULL) {
+        profileZones.push_back( profileZoneWindow_t() );
+        zone = &profileZones.back();
+        memset( zone, 0, sizeof( *zone ) );
+        zone->name = event.name;
+      }
+      zone->ms[slot] += event.duration / 1e6;
+      zone->calls[slot]++;
+    }
+    for (int c = 0; c < PROFILE_COUNTERS; c++) {
+      step.counters[c] += b->counters[c];
+      b->counters[c] = 0;
+    }
+  }
+
+  if (profileSteps.size() < PROFILE_RING_STEPS) profileSteps.push_back( step );
+  else profileSteps[profileStepCount % PROFILE_RING_STEPS] = step;
+  profileStepCount++;
+}
+
+/* This function writes a JSON string, escaping quotes and backslashes
+ *
+ * @param (FILE* out) where to write
+ * @param (const char* text) the string
+ */
+static void writeJsonString( FILE* out, const char* text ) {
+  fputc( '"', out );
+  for (const char* c = text; *c; c++) {
+    if (*c == '"' || *c == '\\') fputc( '\\', out );
+    if ((unsigned char) *c >= 0x20) fputc( *c, out );
+  }
+  fputc( '"', out );
+}
+
+/* This function writes every zone and step counter still held in the ring buffers as Chrome
+ * trace event JSON, which chrome://tracing and Perfetto can open. Zones become complete ("X")
+ * events on the thread that recorded them; counters become one counter ("C") event per step.
+ *
+ * @param (const char* path) the file to create
+ */
+bool Profiler::writeChromeTrace( const char* path ) {
+  FILE* out = fopen( path, "w" );
+  if (out == NULL) return false;
+  lock_guard<mutex> hold( profileLock );
+  fprintf( out, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n" );
+  bool first = true;
+  for (ProfileBuffer* b: profileBuffers) {
+    fprintf( out, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"thread %d\"}}",
+      first ? "" : ",\n", b->thread, b->thread );
+    first = false;
+    lock_guard<mutex> holdBuffer( b->lock );
+    uint64_t begin = b->written > PROFILE_RING_EVENTS ? b->written - PROFILE_RING_EVENTS : 0;
+    for (uint64_t i = begin; i < b->written; i++) {
+      const profileEvent_t& event = b->events[i % PROFILE_RING_EVENTS];
+      fprintf( out, ",\n{\"name\": " );
+      writeJsonString( out, event.name );
+      fprintf( out, ", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+        b->thread, event.start / 1e3, event.duration / 1e3 );
+    }
+  }
+  uint64_t steps = profileSteps.size();
+  for (uint64_t i = profileStepCount - steps; i < profileStepCount; i++) {
+    const profileStep_t& step = profileSteps[i % PROFILE_RING_STEPS];
+    fprintf( out, "%s{\"name\": \"counters\", \"ph\": \"C\", \"pid\": 1, \"ts\": %.3f, \"args\": {", first ? "" : ",\n", step.end / 1e3 );
+    first = false;
+    for (int c = 0; c < PROFILE_COUNTERS; c++) {
+      fprintf( out, "%s\"%s\": %llu", c == 0 ? "" : ", ", profileCounterNames[c], (unsigned long long) step.counters[c] );
+    }
+    fprintf( out, "}}" );
+  }
+  fprintf( out, "\n]}\n" );
+  return fclose( out ) == 0;
+}
+
+/* This function prints the mean and largest time per step of every zone, slowest first, and
+ * of every counter, over the last PROFILE_SUMMARY_STEPS steps.
+ *
+ * @param (FILE* out) where to print
+ */
+void Profiler::printSummary( FILE* out ) {
+  lock_guard<mutex> hold( profileLock );
+  int window = (int) min( profileStepCount, (uint64_t) PROFILE_SUMMARY_STEPS );
+  if (window == 0) return;
+  vector< pair<double, const profileZoneWindow_t*> > order;
+  for (const profileZoneWindow_t& zone: profileZones) {
+    double total = 0;
+    for (int s = 0; s < window; s++) total += zone.ms[s];
+    order.push_back( make_pair( total, &zone ) );
+  }
+  sort( order.begin(), order.end(), []( const pair<double, const profileZoneWindow_t*>& a, const pair<double, const profileZoneWindow_t*>& b ) {
+    return a.first > b.first;
+  });
+
+  fprintf( out, "Profile of the last %d steps (ms per step):\n", window );
+  for (const pair<double, const profileZoneWindow_t*>& entry: order) {
+    const profileZoneWindow_t& zone = *entry.second;
+    double most = 0;
+    long calls = 0;
+    for (int s = 0; s < window; s++) {
+      most = max( most, zone.ms[s] );
+      calls += zone.calls[s];
+    }
+    fprintf( out, "  %-28s mean:%9.4f max:%9.4f calls/step:%9.1f\n", zone.name, entry.first / window, most, (double) calls / window );
+  }
+  for (int c = 0; c < PROFILE_COUNTERS; c++) {
+    double total = 0, most = 0;
+    for (int s = 0; s < window; s++) {
+      double value = (double) profileSteps[(profileStepCount - 1 - s) % PROFILE_RING_STEPS].counters[c];
+      total += value;
+      most = max( most, value );
+    }
+    fprintf( out, "  %-28s mean:%9.1f max:%9.0f per step\n", profileCounterNames[c], total / window, most );
+  }
+}
+
+/*End Profiler-------------------------------------------------------*/
+
+#endif
@@ -0,0 +1,107 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Values summed over each fixed step
+enum profileCounter_t {
+  PROFILE_PAIR_TESTS,   // Candidate pairs tested for overlap
+  PROFILE_CONTACTS,     // Overlapping pairs found
+  PROFILE_TRIGGERS,     // Trigger functions called
+  PROFILE_ALLOCATIONS,  // GameObjects and components allocated
+  PROFILE_COUNTERS,
+};
+
+/* Instrumentation is only compiled in when ENABLE_PROFILING is defined (make PROFILE=1).
+ * Otherwise the macros below expand to nothing, including their arguments.
+ *
+ *   PROFILE_SCOPE( name )             time the rest of the enclosing block as a zone called name
+ *   PROFILE_COUNT( counter, amount )  add to a profileCounter_t for the current step
+ *   PROFILE_END_STEP()                close the current step; call once per fixed step
+ */
+#ifdef ENABLE_PROFILING
+
+#include <mutex>
+
+#define PROFILE_RING_EVENTS 65536   // Zones kept per thread; older ones are overwritten
+#define PROFILE_RING_STEPS 4096     // Steps of counter values kept
+#define PROFILE_SUMMARY_STEPS 120   // Steps covered by the rolling summary
+
+struct profileEvent_t {
+  const char* name;
+  uint64_t start;     // ns since the profiler started
+  uint64_t duration;  // ns
+};
+
+/* Zones and counters of one thread. Only the owning thread records into it, holding lock, so
+ * endStep() and the export can read it while other threads, such as the render thread, keep
+ * recording. The lock is only ever contended during those reads.
+ */
+struct ProfileBuffer {
+  int thread;                     // Chrome trace tid
+  mutex lock;
+  vector<profileEvent_t> events;  // Ring of the last PROFILE_RING_EVENTS zones
+  uint64_t written;               // Zones ever written; the next goes in events[written % PROFILE_RING_EVENTS]
+  uint64_t stepCursor;            // Zones already counted by endStep()
+  uint64_t counters[PROFILE_COUNTERS];
+};
+
+/* Collects zones and counters from every thread into per thread ring buffers, keeps a rolling
+ * window of per step totals, and exports Chrome trace event JSON.
+ */
+class Profiler {
+  public:
+    static uint64_t now(); // ns since the profiler started
+    static ProfileBuffer* buffer(); // The calling thread's buffer, created on first use
+    static void count( int counter, uint64_t amount ) {
+      ProfileBuffer* b = buffer();
+      lock_guard<mutex> hold( b->lock );
+      b->counters[counter] += amount;
+    }
+    static const char* intern( const string& name ); // A name that stays valid after the string is gone
+    static void endStep();
+    static bool writeChromeTrace( const char* path ); // Write every zone and step still in the buffers
+    static void printSummary( FILE* out ); // Mean and max per step over the last PROFILE_SUMMARY_STEPS steps
+};
+
+/* Records a zone from its construction to the end of its scope
+ */
+class ProfileScope {
+  private:
+    const char* name;
+    uint64_t start;
+
+  public:
+    ProfileScope( const char* name ) : name( name ), start( Profiler::now() ) {}
+    ~ProfileScope() {
+      uint64_t end = Profiler::now();
+      ProfileBuffer* b = Profiler::buffer();
+      lock_guard<mutex> hold( b->lock );
+      profileEvent_t& event = b->events[b->written % PROFILE_RING_EVENTS];
+      event.name = name;
+      event.start = start;
+      event.duration = end - start;
+      b->written++;
+    }
+};
+
+#define PROFILE_CONCAT2( a, b ) a##b
+#define PROFILE_CONCAT( a, b ) PROFILE_CONCAT2( a, b )
+#define PROFILE_SCOPE( name ) ProfileScope PROFILE_CONCAT( profileScope, __LINE__ )( name )
+#define PROFILE_COUNT( counter, amount ) Profiler::count( counter, amount )
+#define PROFILE_END_STEP() Profiler::endStep()
+
+#else
+
+#define PROFILE_SCOPE( name )
+#define PROFILE_COUNT( counter, amount )
+#define PROFILE_END_STEP()
+
+#endif
+
+#endif
@@ -0,0 +1,55 @@
+/*-------------------------------------------------------
+
+Implements the lock free exchange of render frames
+between the simulation and render threads.
+
+---------------------------------------------------------*/
+
+#include "publish.h"
+
+/*Begin FrameExchange-------------------------------------------------------*/
+
+/* This function copies the columns drawn by the render backends into the frame being written
+ * and publishes it. Row i of the frame is row i of bodies.
+ *
+ * @param (const BodyStore& bodies) the world after the step
+ * @param (const vector<double>& previousX) positions before the step, or empty to draw without interpolation
+ * @param (const vector<double>& previousY)
+ * @param (long step) steps taken so far
+ * @param (long long timeNs) wall time the state belongs to
+ */
+void FrameExchange::capture( const BodyStore& bodies, const vector<double>& previousX, const vector<double>& previousY, long step, long long timeNs ) {
+  renderFrame_t& frame = writing();
+  size_t n = (size_t) bodies.size();
+  frame.bodies.objects.resize( n, NULL );
+  frame.bodies.mask.assign( bodies.mask.data(), n );
+  frame.bodies.x.assign( bodies.x.data(), n );
+  frame.bodies.y.assign( bodies.y.data(), n );
+  frame.bodies.renderRadius.assign( bodies.renderRadius.data(), n );
+  frame.bodies.color.assign( bodies.color.data(), n );
+  frame.previousX = previousX;
+  frame.previousY = previousY;
+  frame.step = step;
+  frame.timeNs = timeNs;
+  publish();
+}
+
+/* This function makes the frame being written the latest one. The frame it replaces in the
+ * middle becomes the next one to write, whether or not it was ever drawn.
+ */
+void FrameExchange::publish() {
+  back = middle.exchange( back | FRAME_FRESH, memory_order_acq_rel ) & ~FRAME_FRESH;
+}
+
+/* This function returns the newest published frame. If one was published since the last call
+ * it is swapped in; otherwise the frame from the last call is returned again. The frame stays
+ * untouched until the next call.
+ */
+const renderFrame_t& FrameExchange::latest() {
+  if (middle.load( memory_order_acquire ) & FRAME_FRESH) {
+    front = middle.exchange( front, memory_order_acq_rel ) & ~FRAME_FRESH;
+  }
+  return frames[front];
+}
+
+/*End FrameExchange-------------------------------------------------------*/
@@ -0,0 +1,49 @@
+#ifndef PUBLISH_H
+#define PUBLISH_H
+
+#include <vector>
+#include <atomic>
+#include "bodies.h"
+
+using namespace std;
+
+#define FRAME_FRESH 4 // Set in FrameExchange::middle when the middle frame has not been taken by the reader yet
+
+/* Render state of one finished fixed step. bodies is a BodyStore holding only the columns the
+ * backends draw from (mask, x, y, renderRadius and color), so any RenderBackend draws it as
+ * it would draw the live world.
+ */
+struct renderFrame_t {
+  BodyStore bodies;
+  vector<double> previousX; // Positions before the step, for interpolation; may be empty
+  vector<double> previousY;
+  long step;                // Steps taken when the frame was captured
+  long long timeNs;         // Wall time the state belongs to, on the ODLGameLoop_nowNs() clock; streamClockNs() for StreamServer
+};
+
+/* Hands render frames from the simulation thread to the render thread without locks, through
+ * three frames: one being written, one being drawn and the latest finished one in between.
+ * publish() swaps the written frame with the middle one and latest() swaps the drawn one with
+ * the middle one when it is newer, each with a single atomic exchange. Neither side ever waits
+ * for the other, and a frame is never changed while it is being drawn.
+ *
+ * Only one thread may call writing() and publish(), and only one other thread latest().
+ */
+class FrameExchange {
+  private:
+    renderFrame_t frames[3];
+    atomic<int> middle; // Index of the middle frame, plus FRAME_FRESH while the reader has not taken it
+    int back;           // Frame being written; owned by the writer
+    int front;          // Frame being drawn; owned by the reader
+    FrameExchange( const FrameExchange& );
+
+  public:
+    FrameExchange() : middle( 1 ), back( 0 ), front( 2 ) {}
+    renderFrame_t& writing() { return frames[back]; }
+    void capture( const BodyStore& bodies, const vector<double>& previousX, const vector<double>& previousY, long step, long long timeNs ); // Copy the render state into writing() and publish it
+    void publish();                // Make writing() the latest frame and start writing another
+    const renderFrame_t& latest(); // The newest published frame; empty before the first
+    bool fresh() const { return (middle.load( memory_order_acquire ) & FRAME_FRESH) != 0; } // Whether latest() would return a new frame
+};
+
+#endif
@@ -0,0 +1,253 @@
+/*-------------------------------------------------------
+
+Implements batched drawing of every CircleRender.
+
+---------------------------------------------------------*/
+
+#include "render.h"
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/*Begin CircleBatch-------------------------------------------------------*/
+
+/* This function picks how many segments a circle needs so each edge is about
+ * CIRCLE_PIXELS_PER_SEGMENT pixels long, clamped to [CIRCLE_MIN_SEGMENTS, CIRCLE_MAX_SEGMENTS].
+ *
+ * @param (double pixelRadius) the radius of the circle in pixels
+ */
+int CircleBatch::segmentsFor( double pixelRadius ) {
+  int segments = (int) ceil( 2 * PI * pixelRadius / CIRCLE_PIXELS_PER_SEGMENT );
+  if (segments < CIRCLE_MIN_SEGMENTS) return CIRCLE_MIN_SEGMENTS;
+  if (segments > CIRCLE_MAX_SEGMENTS) return CIRCLE_MAX_SEGMENTS;
+  return segments;
+}
+
+/* This function returns the points of a radius 1 circle as x, y pairs. The last point repeats
+ * the first. Each segment count is computed on first use and kept for the rest of the run.
+ *
+ * @param (int segments) number of segments, between CIRCLE_MIN_SEGMENTS and CIRCLE_MAX_SEGMENTS
+ */
+const vector<GLfloat>& CircleBatch::unitCircle( int segments ) {
+  static vector<GLfloat> circles[CIRCLE_MAX_SEGMENTS + 1];
+  vector<GLfloat>& circle = circles[segments];
+  if (circle.empty()) {
+    for (int i = 0; i <= segments; i++) {
+      GLfloat angle = (i * 2.0f * PI) / segments;
+      circle.push_back( cos( angle ) );
+      circle.push_back( sin( angle ) );
+    }
+  }
+  return circle;
+}
+
+/* Generic attribute slots of the circle shader
+ */
+#define CIRCLE_CORNER_ATTRIBUTE 0 // Point of the unit circle fan, per vertex
+#define CIRCLE_DISC_ATTRIBUTE 1   // Center x, y and radius, per instance
+#define CIRCLE_COLOR_ATTRIBUTE 2  // R, G, B, per instance
+
+static const char* circleVertexShader =
+  "#version 120\n"
+  "attribute vec2 corner;\n"
+  "attribute vec3 disc;\n"
+  "attribute vec3 color;\n"
+  "varying vec3 shade;\n"
+  "void main() {\n"
+  "  shade = color;\n"
+  "  gl_Position = gl_ModelViewProjectionMatrix * vec4( disc.xy + corner * disc.z, 0.0, 1.0 );\n"
+  "}\n";
+
+static const char* circleFragmentShader =
+  "#version 120\n"
+  "varying vec3 shade;\n"
+  "void main() {\n"
+  "  gl_FragColor = vec4( shade, 1.0 );\n"
+  "}\n";
+
+/* This function compiles one stage of the circle shader, and stops the program with the
+ * compiler's log if it fails.
+ *
+ * @param (GLenum stage) GL_VERTEX_SHADER or GL_FRAGMENT_SHADER
+ * @param (const char* source) the GLSL source
+ */
+static GLuint compileCircleShader( GLenum stage, const char* source ) {
+  GLuint shader = glCreateShader( stage );
+  glShaderSource( shader, 1, &source, NULL );
+  glCompileShader( shader );
+  GLint compiled = GL_FALSE;
+  glGetShaderiv( shader, GL_COMPILE_STATUS, &compiled );
+  if (compiled != GL_TRUE) {
+    char log[1024] = "";
+    glGetShaderInfoLog( shader, sizeof( log ), NULL, log );
+    fprintf( stderr, "render: circle shader does not compile: %s\n", log );
+    exit( 1 );
+  }
+  return shader;
+}
+
+/* This function creates the GL objects of the batch in the current context: the circle shader
+ * and one buffer holding a triangle fan for every segment count, the center followed by the
+ * segments + 1 points of unitCircle. It stops the program if the context is older than 3.3.
+ */
+void CircleBatch::setUp() {
+  int major = 0;
+  int minor = 0;
+  const char* version = (const char*) glGetString( GL_VERSION );
+  if (version == NULL || sscanf( version, "%d.%d", &major, &minor ) != 2 || major * 10 + minor < 33) {
+    fprintf( stderr, "render: instanced circles need OpenGL 3.3, the context has %s\n", version != NULL ? version : "none" );
+    exit( 1 );
+  }
+
+  program = glCreateProgram();
+  GLuint vertexShader = compileCircleShader( GL_VERTEX_SHADER, circleVertexShader );
+  GLuint fragmentShader = compileCircleShader( GL_FRAGMENT_SHADER, circleFragmentShader );
+  glAttachShader( program, vertexShader );
+  glAttachShader( program, fragmentShader );
+  glBindAttribLocation( program, CIRCLE_CORNER_ATTRIBUTE, "corner" );
+  glBindAttribLocation( program, CIRCLE_DISC_ATTRIBUTE, "disc" );
+  glBindAttribLocation( program, CIRCLE_COLOR_ATTRIBUTE, "color" );
+  glLinkProgram( program );
+  glDeleteShader( vertexShader ); // Freed with the program
+  glDeleteShader( fragmentShader );
+  GLint linked = GL_FALSE;
+  glGetProgramiv( program, GL_LINK_STATUS, &linked );
+  if (linked != GL_TRUE) {
+    char log[1024] = "";
+    glGetProgramInfoLog( program, sizeof( log ), NULL, log );
+    fprintf( stderr, "render: circle shader does not link: %s\n", log );
+    exit( 1 );
+  }
+
+  vector<GLfloat> mesh;
+  for (int s = CIRCLE_MIN_SEGMENTS; s <= CIRCLE_MAX_SEGMENTS; s++) {
+    firstMeshVertex[s] = (int) mesh.size() / 2;
+    const vector<GLfloat>& circle = unitCircle( s );
+    mesh.push_back( 0 );
+    mesh.push_back( 0 );
+    mesh.insert( mesh.end(), circle.begin(), circle.end() );
+  }
+  glGenBuffers( 1, &meshBuffer );
+  glBindBuffer( GL_ARRAY_BUFFER, meshBuffer );
+  glBufferData( GL_ARRAY_BUFFER, mesh.size() * sizeof( GLfloat ), &mesh[0], GL_STATIC_DRAW );
+  glGenBuffers( 1, &instanceBuffer );
+  glBindBuffer( GL_ARRAY_BUFFER, 0 );
+}
+
+/* This function collects the center, radius and color of every body with a CircleRender,
+ * grouped by segment count. A counting pass gives every row its slot, so the instances can
+ * then be filled in parallel on renderJobPool.
+ *
+ * @param (const BodyStore& bodies) the bodies to draw
+ * @param (double pixelsPerUnit) pixels covered by one unit of world space, used for the segment count
+ */
+void CircleBatch::build( const BodyStore& bodies, double pixelsPerUnit ) {
+  int n = bodies.size();
+  slot.resize( n );
+  for (int s = 0; s <= CIRCLE_MAX_SEGMENTS + 1; s++) firstInstance[s] = 0;
+  for (int i = 0; i < n; i++) {
+    slot[i] = -1;
+    if (bodies.mask[i] & BODY_HAS( CIRCLE_RENDER_TYPE )) {
+      int segments = segmentsFor( bodies.renderRadius[i] * pixelsPerUnit );
+      slot[i] = firstInstance[segments + 1]++; // Index within its segment count for now
+    }
+  }
+  for (int s = 1; s <= CIRCLE_MAX_SEGMENTS + 1; s++) firstInstance[s] += firstInstance[s - 1];
+  instances.resize( firstInstance[CIRCLE_MAX_SEGMENTS + 1] );
+
+  renderJobPool->parallelFor( n, 4096, [this, &bodies, pixelsPerUnit]( int begin, int end ) {
+    for (int i = begin; i < end; i++) {
+      if (slot[i] < 0) continue;
+      int segments = segmentsFor( bodies.renderRadius[i] * pixelsPerUnit );
+      const color_t& color = bodies.color[i];
+      Instance instance = { (GLfloat) renderX( bodies, i ), (GLfloat) renderY( bodies, i ), (GLfloat) bodies.renderRadius[i], color.R, color.G, color.B };
+      instances[firstInstance[segments] + slot[i]] = instance;
+    }
+  });
+}
+
+/* This function uploads the instances from the last build and draws them, one instanced call
+ * per segment count in use.
+ */
+void CircleBatch::draw() {
+  if (instances.empty()) return;
+  if (program == 0) setUp();
+  glMatrixMode(GL_MODELVIEW);
+  glLoadIdentity();
+  glUseProgram( program );
+
+  glBindBuffer( GL_ARRAY_BUFFER, meshBuffer );
+  glVertexAttribPointer( CIRCLE_CORNER_ATTRIBUTE, 2, GL_FLOAT, GL_FALSE, 0, 0 );
+  glEnableVertexAttribArray( CIRCLE_CORNER_ATTRIBUTE );
+
+  glBindBuffer( GL_ARRAY_BUFFER, instanceBuffer );
+  glBufferData( GL_ARRAY_BUFFER, instances.size() * sizeof( Instance ), &instances[0], GL_STREAM_DRAW );
+  glEnableVertexAttribArray( CIRCLE_DISC_ATTRIBUTE );
+  glEnableVertexAttribArray( CIRCLE_COLOR_ATTRIBUTE );
+  glVertexAttribDivisor( CIRCLE_DISC_ATTRIBUTE, 1 );
+  glVertexAttribDivisor( CIRCLE_COLOR_ATTRIBUTE, 1 );
+  for (int s = CIRCLE_MIN_SEGMENTS; s <= CIRCLE_MAX_SEGMENTS; s++) {
+    int count = firstInstance[s + 1] - firstInstance[s];
+    if (count == 0) continue;
+    size_t first = firstInstance[s] * sizeof( Instance ); // Byte offset into instanceBuffer
+    glVertexAttribPointer( CIRCLE_DISC_ATTRIBUTE, 3, GL_FLOAT, GL_FALSE, sizeof( Instance ), (const GLvoid*) (first + offsetof( Instance, x )) );
+    glVertexAttribPointer( CIRCLE_COLOR_ATTRIBUTE, 3, GL_FLOAT, GL_FALSE, sizeof( Instance ), (const GLvoid*) (first + offsetof( Instance, R )) );
+    glDrawArraysInstanced( GL_TRIANGLE_FAN, firstMeshVertex[s], s + 2, count );
+  }
+
+  glVertexAttribDivisor( CIRCLE_DISC_ATTRIBUTE, 0 ); // Leave the fixed function state as it was found
+  glVertexAttribDivisor( CIRCLE_COLOR_ATTRIBUTE, 0 );
+  glDisableVertexAttribArray( CIRCLE_COLOR_ATTRIBUTE );
+  glDisableVertexAttribArray( CIRCLE_DISC_ATTRIBUTE );
+  glDisableVertexAttribArray( CIRCLE_CORNER_ATTRIBUTE );
+  glBindBuffer( GL_ARRAY_BUFFER, 0 );
+  glUseProgram( 0 );
+}
+
+/*End CircleBatch-------------------------------------------------------*/
+
+/*Begin GLRenderBackend-------------------------------------------------------*/
+
+GLRenderBackend glRenderBackend;
+RenderBackend* renderBackend = &glRenderBackend;
+renderInterpolation_t renderInterpolation = { NULL, NULL, 0, 1 };
+JobPool* renderJobPool = &jobPool;
+
+/* These functions return where row i is drawn: between its position before the last fixed step
+ * and its current one, as set by renderInterpolation.
+ *
+ * @param (const BodyStore& bodies) the bodies being drawn
+ * @param (int i) the row
+ */
+double renderX( const BodyStore& bodies, int i ) {
+  const renderInterpolation_t& view = renderInterpolation;
+  if (i >= view.rows) return bodies.x[i];
+  return view.previousX[i] + (bodies.x[i] - view.previousX[i]) * view.alpha;
+}
+
+double renderY( const BodyStore& bodies, int i ) {
+  const renderInterpolation_t& view = renderInterpolation;
+  if (i >= view.rows) return bodies.y[i];
+  return view.previousY[i] + (bodies.y[i] - view.previousY[i]) * view.alpha;
+}
+
+/* This function returns how many pixels one unit of world space covers in the current viewport
+ */
+double glPixelsPerUnit() {
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  return viewport[2] / 2.0;
+}
+
+/* This function draws every CircleRender with a single draw call
+ *
+ * @param (const BodyStore& bodies) the bodies to draw
+ */
+void GLRenderBackend::drawCircles( const BodyStore& bodies ) {
+  PROFILE_SCOPE( "CircleRender gl" );
+  batch.build( bodies, glPixelsPerUnit() );
+  batch.draw();
+}
+
+/*End GLRenderBackend-------------------------------------------------------*/
@@ -0,0 +1,93 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <vector>
+#define GL_GLEXT_PROTOTYPES // Shaders, buffers and instancing are linked from libGL directly
+#include <GL/gl.h>
+
+using namespace std;
+
+class BodyStore;
+class JobPool;
+
+#define CIRCLE_MIN_SEGMENTS 8
+#define CIRCLE_MAX_SEGMENTS 100
+#define CIRCLE_PIXELS_PER_SEGMENT 3.0 // Target length of one circle edge on screen
+
+/* Draws every CircleRender in bodyStore with instanced draw calls. The unit circle for each
+ * segment count is uploaded once as a triangle fan and shared by every ball, and every frame
+ * only the center, radius and color of each ball go into one instance buffer. The instances
+ * are grouped by segment count, so there is one draw call per segment count in use. Needs
+ * OpenGL 3.3 with the compatibility profile, which Mesa's software rasterizer provides.
+ */
+class CircleBatch {
+  private:
+    struct Instance {
+      GLfloat x;
+      GLfloat y;
+      GLfloat radius;
+      GLfloat R;
+      GLfloat G;
+      GLfloat B;
+    };
+    vector<Instance> instances; // One per ball, grouped by segment count, rebuilt every frame
+    vector<int> slot;           // Per body row: its index in instances, -1 without a CircleRender
+    int firstInstance[CIRCLE_MAX_SEGMENTS + 2]; // Instances with s segments are [firstInstance[s], firstInstance[s + 1])
+    int firstMeshVertex[CIRCLE_MAX_SEGMENTS + 1]; // Where the fan with s segments starts in meshBuffer
+    GLuint program;        // 0 until the first draw sets up the GL objects
+    GLuint meshBuffer;     // Every unit circle fan, built once
+    GLuint instanceBuffer; // instances, uploaded every draw
+
+    void setUp(); // Compile the shaders and upload the unit circles in the current context
+
+  public:
+    CircleBatch() : program( 0 ), meshBuffer( 0 ), instanceBuffer( 0 ) {}
+    static int segmentsFor( double pixelRadius );           // Segment count for a circle of this size on screen
+    static const vector<GLfloat>& unitCircle( int segments ); // Cached cos/sin pairs, segments + 1 points
+    void build( const BodyStore& bodies, double pixelsPerUnit ); // Collect one instance per CircleRender
+    void draw();                                            // Draw the instances from the last build
+    int instanceCount() const { return (int) instances.size(); }
+};
+
+/* Something that can draw the circles of a BodyStore. CircleRender::renderAll draws through
+ * the active backend, so the same components can be shown in a window or rendered offscreen.
+ */
+class RenderBackend {
+  public:
+    virtual ~RenderBackend() {}
+    virtual void drawCircles( const BodyStore& bodies ) = 0; // Draw every CircleRender row
+    virtual void endFrame() {}                               // Finish the frame, eg write it out
+};
+
+/* Draws into the current OpenGL context with a CircleBatch
+ */
+class GLRenderBackend : public RenderBackend {
+  private:
+    CircleBatch batch;
+
+  public:
+    void drawCircles( const BodyStore& bodies );
+};
+
+/* Positions the state had before the last fixed step. When set, the backends draw each row at
+ * previous + (current - previous) * alpha, so the picture moves smoothly between fixed steps
+ * even when the physics rate is lower than the frame rate. Rows at or past rows are drawn
+ * where they are, eg bodies created during the step.
+ */
+struct renderInterpolation_t {
+  const double* previousX;
+  const double* previousY;
+  int rows;     // 0 draws the current positions
+  double alpha; // Fraction of a fixed step of time accumulated since the last one, 0 to 1
+};
+
+double glPixelsPerUnit(); // Pixels covered by one unit of world space in the current GL viewport
+
+extern RenderBackend* renderBackend; // Backend used by CircleRender::renderAll; the GL one by default
+extern renderInterpolation_t renderInterpolation;
+extern JobPool* renderJobPool;      // Pool the render backends run their parallel loops on; jobPool unless drawing on a thread of its own
+
+double renderX( const BodyStore& bodies, int i ); // Where to draw row i, see renderInterpolation_t
+double renderY( const BodyStore& bodies, int i );
+
+#endif
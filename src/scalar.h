@@ -0,0 +1,116 @@
+#ifndef SCALAR_H
+#define SCALAR_H
+
+#include <stdint.h>
+#include <math.h>
+
+/* The type every position, velocity, mass and radius in the BodyStore is kept in, picked for the
+ * whole build:
+ *
+ *   default           double
+ *   -DSCALAR_FLOAT    float, half the memory per column and twice the lanes per SIMD register
+ *   -DSCALAR_FIXED    Fixed, a 64 bit fixed point number, whose arithmetic does not depend on
+ *                     the floating point unit
+ *
+ * Everything that changes the state of a step computes in scalar_t: integration, the wall
+ * bounce, the contact test, the sleep test, Bounce, the ball masses of createBall and, in fixed
+ * point builds, continuous collision. So a fixed point build steps bit for bit the same whatever
+ * the compiler, its optimization level or the CPU; make test checks -O0 against -O2. The code
+ * around it, such as rendering, scenes, contact normals and the broadphase grid, which only
+ * picks candidate pairs with a margin, reads values through toDouble() and writes them back
+ * through toScalar(), and may round as the compiler decides.
+ *
+ * The precision is picked when building rather than when running on purpose: it sets the
+ * layout of every column, the SIMD kernels and the snapshot format, and a run time choice would
+ * put a branch or a template parameter on every one of them.
+ */
+
+#define FIXED_FRACTION_BITS 40 // Q23.40: about 1e-12 resolution for values up to +-8 million
+
+/* A signed fixed point number with FIXED_FRACTION_BITS bits after the point. Sums are exact,
+ * products and quotients are rounded through 128 bit integers, so the result never depends on
+ * the floating point unit. It converts to double on its own, so it can be printed or passed to
+ * code that takes a double, but a double only becomes a Fixed through toScalar(), so code
+ * meant to stay in fixed point cannot slip into floating point when written back.
+ */
+struct Fixed {
+  int64_t raw; // The value times 2^FIXED_FRACTION_BITS
+
+  Fixed() = default;
+  explicit Fixed( double v ) : raw( (int64_t) llround( ldexp( v, FIXED_FRACTION_BITS ) ) ) {}
+  static Fixed fromRaw( int64_t raw ) { Fixed f; f.raw = raw; return f; }
+  operator double() const { return ldexp( (double) raw, -FIXED_FRACTION_BITS ); }
+
+  Fixed operator-() const { return fromRaw( -raw ); }
+  Fixed& operator+=( Fixed v ) { raw += v.raw; return *this; }
+  Fixed& operator-=( Fixed v ) { raw -= v.raw; return *this; }
+  Fixed& operator*=( Fixed v ) { return *this = *this * v; }
+
+  friend Fixed operator+( Fixed a, Fixed b ) { return fromRaw( a.raw + b.raw ); }
+  friend Fixed operator-( Fixed a, Fixed b ) { return fromRaw( a.raw - b.raw ); }
+  friend Fixed operator*( Fixed a, Fixed b ) {
+    __int128 product = (__int128) a.raw * b.raw;
+    return fromRaw( (int64_t) ((product + ((__int128) 1 << (FIXED_FRACTION_BITS - 1))) >> FIXED_FRACTION_BITS) );
+  }
+  // Quotients out of range saturate, as the floating point types go to +-inf, and 0 / 0 gives 0;
+  // neither traps like an integer division by zero would
+  friend Fixed operator/( Fixed a, Fixed b ) {
+    if (b.raw == 0) return fromRaw( a.raw > 0 ? INT64_MAX : a.raw < 0 ? -INT64_MAX : 0 );
+    __int128 quotient = (__int128) a.raw * ((__int128) 1 << FIXED_FRACTION_BITS) / b.raw;
+    return fromRaw( quotient > INT64_MAX ? INT64_MAX : quotient < -INT64_MAX ? -INT64_MAX : (int64_t) quotient );
+  }
+  friend bool operator==( Fixed a, Fixed b ) { return a.raw == b.raw; }
+  friend bool operator!=( Fixed a, Fixed b ) { return a.raw != b.raw; }
+  friend bool operator<( Fixed a, Fixed b ) { return a.raw < b.raw; }
+  friend bool operator<=( Fixed a, Fixed b ) { return a.raw <= b.raw; }
+  friend bool operator>( Fixed a, Fixed b ) { return a.raw > b.raw; }
+  friend bool operator>=( Fixed a, Fixed b ) { return a.raw >= b.raw; }
+};
+
+#if defined( SCALAR_FIXED )
+typedef Fixed scalar_t;
+#define SCALAR_NAME "fixed"
+#define SCALAR_SNAPSHOT_TAG 'q' // Last but one byte of the snapshot magic, so precisions never load each other's files
+#elif defined( SCALAR_FLOAT )
+typedef float scalar_t;
+#define SCALAR_NAME "float"
+#define SCALAR_SNAPSHOT_TAG 'f'
+#else
+typedef double scalar_t;
+#define SCALAR_NAME "double"
+#define SCALAR_SNAPSHOT_TAG 0
+#endif
+
+inline double toDouble( scalar_t v ) { return (double) v; }
+inline scalar_t toScalar( double v ) { return (scalar_t) v; }
+#if defined( SCALAR_FIXED )
+inline scalar_t toScalar( Fixed v ) { return v; } // Already in the build's precision, so no trip through double
+#endif
+
+// |v| without leaving the type; the floating point ones clear the sign bit like the SIMD kernels do
+inline double scalarAbs( double v ) { return fabs( v ); }
+inline float scalarAbs( float v ) { return fabsf( v ); }
+inline Fixed scalarAbs( Fixed v ) { return v.raw < 0 ? -v : v; }
+
+// Square root; the fixed point one is rounded down and found from the integers alone, one bit
+// at a time, and gives 0 for values below 0
+inline double scalarSqrt( double v ) { return sqrt( v ); }
+inline float scalarSqrt( float v ) { return sqrtf( v ); }
+inline Fixed scalarSqrt( Fixed v ) {
+  if (v.raw <= 0) return Fixed::fromRaw( 0 );
+  unsigned __int128 rest = (unsigned __int128) v.raw << FIXED_FRACTION_BITS;
+  unsigned __int128 root = 0;
+  unsigned __int128 bit = (unsigned __int128) 1 << 126;
+  while (bit > rest) bit >>= 2;
+  for (; bit != 0; bit >>= 2) {
+    if (rest >= root + bit) {
+      rest -= root + bit;
+      root = (root >> 1) + bit;
+    } else {
+      root >>= 1;
+    }
+  }
+  return Fixed::fromRaw( (int64_t) root );
+}
+
+#endif
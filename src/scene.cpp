@@ -0,0 +1,282 @@
+/*-------------------------------------------------------
+
+Implements streaming scene files that add balls to the
+BodyStore in bulk.
+
+---------------------------------------------------------*/
+
+#include "scene.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+static const char sceneMagic[8] = { 'B', 'B', 'S', 'C', 'E', 'N', 'E', 0 };
+
+/*Begin Loading-------------------------------------------------------*/
+
+/* This function appends one ball as a BodyStore row. No GameObject or component is created;
+ * bodyStore.object() makes them the first time they are needed.
+ *
+ * @param (const sceneBall_t& ball) the ball to add
+ * @param (unsigned int triggers) the trigger set of its Collider
+ */
+static void addSceneBall( const sceneBall_t& ball, unsigned int triggers ) {
+  int i = bodyStore().add( NULL );
+  bodyStore().mask[i] = BODY_HAS( CIRCLE_RENDER_TYPE ) | BODY_HAS( COLLIDER_TYPE ) | BODY_HAS( PHYSICS_TYPE ) | BODY_HAS( WALL_BOUNCE_TYPE );
+  bodyStore().x[i] = toScalar( ball.x );
+  bodyStore().y[i] = toScalar( ball.y );
+  bodyStore().dx[i] = toScalar( ball.dx );
+  bodyStore().dy[i] = toScalar( ball.dy );
+  bodyStore().colliderRadius[i] = toScalar( ball.radius );
+  bodyStore().mass[i] = toScalar( PI ) * bodyStore().colliderRadius[i] * bodyStore().colliderRadius[i]; // The same math as createBall
+  bodyStore().wallRadius[i] = toScalar( ball.radius );
+  bodyStore().renderRadius[i] = toScalar( ball.radius );
+  bodyStore().color[i].R = ball.R;
+  bodyStore().color[i].G = ball.G;
+  bodyStore().color[i].B = ball.B;
+  bodyStore().triggerSet[i] = triggers;
+}
+
+/* This function reads the balls of a binary scene a block at a time. The header gives the
+ * ball count, so the BodyStore is sized once before reading. A regular file must be large
+ * enough to hold that many balls; from a pipe the store grows as balls are read instead.
+ *
+ * @param (FILE* file) the scene, positioned after the magic
+ * @param (unsigned int triggers) the trigger set of every ball
+ */
+static long loadBinaryScene( FILE* file, unsigned int triggers ) {
+  sceneHeader_t header;
+  memcpy( header.magic, sceneMagic, sizeof( sceneMagic ) );
+  size_t rest = sizeof( header ) - sizeof( header.magic );
+  if (fread( (char*) &header + sizeof( header.magic ), 1, rest, file ) != rest || header.version > SCENE_VERSION) return -1;
+
+  struct stat st;
+  long at = ftell( file );
+  if (fstat( fileno( file ), &st ) == 0 && S_ISREG( st.st_mode ) && at >= 0) {
+    uint64_t room = st.st_size > at ? (uint64_t) (st.st_size - at) / sizeof( sceneBall_t ) : 0;
+    if (header.balls > room) {
+      fprintf( stderr, "scene: header gives %lu balls but the file holds at most %lu\n", (unsigned long) header.balls, (unsigned long) room );
+      return -1;
+    }
+    if (header.balls > (uint64_t) (INT_MAX - bodyStore().size())) return -1;
+    bodyStore().reserve( bodyStore().size() + (int) header.balls );
+  }
+  static sceneBall_t block[SCENE_BUFFER_BYTES / sizeof( sceneBall_t )];
+  uint64_t loaded = 0;
+  while (loaded < header.balls) {
+    size_t wanted = (size_t) min( (uint64_t) (sizeof( block ) / sizeof( block[0] )), header.balls - loaded );
+    size_t got = fread( block, sizeof( block[0] ), wanted, file );
+    for (size_t k = 0; k < got; k++) addSceneBall( block[k], triggers );
+    loaded += got;
+    if (got < wanted) {
+      fprintf( stderr, "scene: file ends after %lu of %lu balls\n", (unsigned long) loaded, (unsigned long) header.balls );
+      return -1;
+    }
+  }
+  return (long) loaded;
+}
+
+/* This function parses a decimal number. Numbers with at most 15 significant digits and a small
+ * exponent are converted exactly with one multiply or divide; the rest go through strtod, so
+ * the result always matches strtod.
+ *
+ * @param (const char* at) the start of the number
+ * @param (char** end) receives the first character after the number, or at if there is none
+ */
+static double parseSceneNumber( const char* at, char** end ) {
+  static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+  const char* c = at;
+  while (*c == ' ' || *c == '\t') c++;
+  bool negative = *c == '-';
+  if (*c == '-' || *c == '+') c++;
+  uint64_t mantissa = 0;
+  int digits = 0;
+  int exponent = 0;
+  for (; *c >= '0' && *c <= '9'; c++, digits++) mantissa = mantissa * 10 + (*c - '0');
+  if (*c == '.') {
+    for (c++; *c >= '0' && *c <= '9'; c++, digits++, exponent--) mantissa = mantissa * 10 + (*c - '0');
+  }
+  if (digits == 0 || digits > 15 || exponent < -22 || *c == 'e' || *c == 'E') return strtod( at, end );
+  *end = (char*) c;
+  double value = (double) mantissa / powers[-exponent];
+  return negative ? -value : value;
+}
+
+/* This function parses one CSV line into a ball
+ *
+ * @param (const char* line) the line, ending in a newline or NUL
+ * @param (sceneBall_t& ball) receives the ball
+ */
+static bool parseSceneLine( const char* line, sceneBall_t& ball ) {
+  double values[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+  int count = 0;
+  const char* at = line;
+  while (count < 8) {
+    char* end;
+    values[count] = parseSceneNumber( at, &end );
+    if (end == at) break;
+    count++;
+    while (*end == ' ' || *end == '\t') end++;
+    if (*end != ',') break;
+    at = end + 1;
+  }
+  if (count != 5 && count != 8) return false;
+  ball.x = values[0];
+  ball.y = values[1];
+  ball.dx = values[2];
+  ball.dy = values[3];
+  ball.radius = values[4];
+  ball.R = (float) values[5];
+  ball.G = (float) values[6];
+  ball.B = (float) values[7];
+  ball.reserved = 0;
+  return true;
+}
+
+/* This function reads the balls of a CSV scene a buffer at a time, parsing every complete line
+ * in the buffer and carrying a partial last line over to the next read. When the file size is
+ * known, the BodyStore is sized from the average line length of the first buffer.
+ *
+ * @param (FILE* file) the scene
+ * @param (const char* start) bytes already read from the start of the file
+ * @param (size_t startBytes) the number of those bytes
+ * @param (long fileBytes) the size of the file, or -1 when unknown (eg a pipe)
+ * @param (unsigned int triggers) the trigger set of every ball
+ */
+static long loadCsvScene( FILE* file, const char* start, size_t startBytes, long fileBytes, unsigned int triggers ) {
+  static char buffer[SCENE_BUFFER_BYTES + 1];
+  memcpy( buffer, start, startBytes );
+  size_t filled = startBytes;
+  bool atEnd = false;
+  bool sized = fileBytes < 0;
+  long line = 0;
+  long loaded = 0;
+
+  while (true) {
+    if (!atEnd) {
+      size_t got = fread( buffer + filled, 1, SCENE_BUFFER_BYTES - filled, file );
+      filled += got;
+      atEnd = filled < SCENE_BUFFER_BYTES;
+    }
+    if (atEnd && filled > 0 && buffer[filled - 1] != '\n') buffer[filled++] = '\n'; // Finish a last line with no newline
+    buffer[filled] = 0;
+
+    char* lineStart = buffer;
+    char* lineEnd;
+    if (!sized) {
+      int lines = 0;
+      for (char* c = buffer; c < buffer + filled; c++) lines += *c == '\n';
+      if (lines > 0) bodyStore().reserve( bodyStore().size() + (int) (fileBytes / ((double) filled / lines) * 1.02) + 16 );
+      sized = true;
+    }
+    while ((lineEnd = (char*) memchr( lineStart, '\n', buffer + filled - lineStart )) != NULL) {
+      line++;
+      char first = *lineStart;
+      bool number = (first >= '0' && first <= '9') || first == '-' || first == '+' || first == '.';
+      if (first != '#' && first != '\n' && first != '\r' && (number || line > 1)) {
+        sceneBall_t ball;
+        if (!parseSceneLine( lineStart, ball )) {
+          fprintf( stderr, "scene: line %ld: expected x,y,dx,dy,radius[,R,G,B]\n", line );
+          return -1;
+        }
+        addSceneBall( ball, triggers );
+        loaded++;
+      }
+      lineStart = lineEnd + 1;
+    }
+
+    size_t partial = buffer + filled - lineStart;
+    if (atEnd) break;
+    if (partial == SCENE_BUFFER_BYTES) {
+      fprintf( stderr, "scene: line %ld is too long\n", line + 1 );
+      return -1;
+    }
+    memmove( buffer, lineStart, partial );
+    filled = partial;
+  }
+  return loaded;
+}
+
+/* This function adds every ball of a scene file to the world. Balls are written straight into
+ * the BodyStore columns, a buffer at a time, without allocating any object per ball. The
+ * format is found from the first bytes of the file.
+ *
+ * @param (const char* path) the scene file, or "-" to read a CSV scene from stdin
+ * @param (const vector<triggerFunc>& triggers) the triggers of every ball's Collider
+ */
+long loadScene( const char* path, const vector<triggerFunc>& triggers ) {
+  bool useStdin = strcmp( path, "-" ) == 0;
+  FILE* file = useStdin ? stdin : fopen( path, "rb" );
+  if (file == NULL) return -1;
+  long fileBytes = -1;
+  struct stat info;
+  if (!useStdin && fstat( fileno( file ), &info ) == 0 && S_ISREG( info.st_mode )) fileBytes = (long) info.st_size;
+
+  unsigned int triggerSet = Collider::internTriggerSet( triggers );
+  char magic[sizeof( sceneMagic )];
+  size_t got = fread( magic, 1, sizeof( magic ), file );
+  long loaded;
+  if (got == sizeof( magic ) && memcmp( magic, sceneMagic, sizeof( magic ) ) == 0) loaded = loadBinaryScene( file, triggerSet );
+  else loaded = loadCsvScene( file, magic, got, fileBytes, triggerSet );
+  if (!useStdin) fclose( file );
+  return loaded;
+}
+
+/*End Loading-------------------------------------------------------*/
+
+/*Begin Saving-------------------------------------------------------*/
+
+/* This function writes every body of the world as a ball, using its CircleRender radius and
+ * color. Other components and triggers are not saved; use saveSnapshot for a full checkpoint.
+ *
+ * @param (const char* path) the scene file to create
+ */
+bool saveScene( const char* path ) {
+  FILE* file = fopen( path, "wb" );
+  if (file == NULL) return false;
+  size_t length = strlen( path );
+  bool csv = length >= 4 && strcmp( path + length - 4, ".csv" ) == 0;
+  int n = bodyStore().size();
+
+  bool ok = true;
+  if (csv) {
+    fprintf( file, "x,y,dx,dy,radius,R,G,B\n" );
+    for (int i = 0; i < n; i++) {
+      const color_t& color = bodyStore().color[i];
+      fprintf( file, "%.17g,%.17g,%.17g,%.17g,%.17g,%.9g,%.9g,%.9g\n", toDouble( bodyStore().x[i] ), toDouble( bodyStore().y[i] ),
+        toDouble( bodyStore().dx[i] ), toDouble( bodyStore().dy[i] ), toDouble( bodyStore().renderRadius[i] ), color.R, color.G, color.B );
+    }
+  } else {
+    sceneHeader_t header;
+    memcpy( header.magic, sceneMagic, sizeof( sceneMagic ) );
+    header.version = SCENE_VERSION;
+    header.reserved = 0;
+    header.balls = n;
+    ok = fwrite( &header, sizeof( header ), 1, file ) == 1;
+    vector<sceneBall_t> block;
+    for (int first = 0; ok && first < n; first += SCENE_BUFFER_BYTES / sizeof( sceneBall_t )) {
+      int last = min( n, first + (int) (SCENE_BUFFER_BYTES / sizeof( sceneBall_t )) );
+      block.resize( last - first );
+      for (int i = first; i < last; i++) {
+        sceneBall_t& ball = block[i - first];
+        ball.x = bodyStore().x[i];
+        ball.y = bodyStore().y[i];
+        ball.dx = bodyStore().dx[i];
+        ball.dy = bodyStore().dy[i];
+        ball.radius = bodyStore().renderRadius[i];
+        ball.R = bodyStore().color[i].R;
+        ball.G = bodyStore().color[i].G;
+        ball.B = bodyStore().color[i].B;
+        ball.reserved = 0;
+      }
+      ok = fwrite( block.data(), sizeof( sceneBall_t ), block.size(), file ) == block.size();
+    }
+  }
+  ok = !ferror( file ) && ok;
+  return fclose( file ) == 0 && ok;
+}
+
+/*End Saving-------------------------------------------------------*/
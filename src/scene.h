@@ -0,0 +1,51 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <stdint.h>
+#include <vector>
+#include "bodies.h"
+
+using namespace std;
+
+class Collider;
+typedef void ( * triggerFunc ) ( Collider* c1, Collider* c2, float dt );
+
+#define SCENE_VERSION 1
+#define SCENE_BUFFER_BYTES ( 1 << 20 ) // Bytes read from the scene file at a time
+
+/* A scene lists balls, each made of the same components createBall adds: CircleRender,
+ * Collider, Physics and WallBounceScript with one radius, and a mass of PI * radius^2.
+ *
+ * CSV scenes hold one ball per line as "x,y,dx,dy,radius" with an optional ",R,G,B" color
+ * (0 to 1, blue when left out). Empty lines, lines starting with "#" and a first line that
+ * does not start with a number are skipped.
+ *
+ * Binary scenes (all values little endian):
+ *
+ *   header:  "BBSCENE\0", version, reserved, ball count
+ *   balls:   sceneBall_t records, one after another
+ */
+
+struct sceneHeader_t {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+  uint64_t balls;
+};
+
+struct sceneBall_t {
+  double x;
+  double y;
+  double dx;
+  double dy;
+  double radius;
+  float R;
+  float G;
+  float B;
+  uint32_t reserved;
+};
+
+long loadScene( const char* path, const vector<triggerFunc>& triggers ); // Add the balls of a scene ("-" reads CSV from stdin), giving each these triggers; -1 on error
+bool saveScene( const char* path ); // Write every body as a ball; CSV if path ends in ".csv", binary otherwise
+
+#endif
@@ -0,0 +1,203 @@
+/*-------------------------------------------------------
+
+Implements sleeping bodies: resting islands are taken out
+of integration and contact generation until disturbed.
+
+---------------------------------------------------------*/
+
+#include "sleep.h"
+#include <algorithm>
+#include <unordered_map>
+
+// The sleep state of the current World
+static vector<unsigned int>& islandsToWake() { return World::current->islandsToWake; } // Islands of bodies passed to wakeBody since the last updateSleep
+static vector<int>& awakeList() { return World::current->awakeList; }                  // Rows without BODY_SLEEPING, in row order
+static unordered_map< unsigned int, vector<int> >& islandRows() { return World::current->islandRows; } // Rows of every sleeping island, by island
+static unsigned long& trackedVersion() { return World::current->trackedVersion; }      // bodyStore.version the lists were last brought up to date with
+static int& trackedRows() { return World::current->trackedRows; }                      // Rows the lists cover; rows added since are taken in by trackRows
+
+/*Begin Tracking-------------------------------------------------------*/
+
+/* This function brings awakeList and islandRows up to date. Rows added since the last call are
+ * appended; after bodyStore.version changed, such as when rows were removed or a snapshot
+ * loaded, both are built again from the columns.
+ */
+static void trackRows() {
+  if (trackedVersion() != bodyStore().version) {
+    awakeList().clear();
+    islandRows().clear();
+    trackedRows() = 0;
+    trackedVersion() = bodyStore().version;
+  }
+  for (; trackedRows() < bodyStore().size(); trackedRows()++) {
+    // A row passed to wakeBody is awake but still in its island until the island wakes
+    if (!(bodyStore().mask[trackedRows()] & BODY_SLEEPING)) awakeList().push_back( trackedRows() );
+    if (bodyStore().island[trackedRows()] != 0) islandRows()[bodyStore().island[trackedRows()]].push_back( trackedRows() );
+  }
+}
+
+/* This function returns every row of bodyStore that is not asleep, in row order
+ */
+const vector<int>& awakeRows() {
+  trackRows();
+  return awakeList();
+}
+
+/* This function merges rows that just woke up into awakeList
+ *
+ * @param (vector<int>& woken) the rows, which must not be in awakeList; left sorted
+ */
+static void addAwake( vector<int>& woken ) {
+  sort( woken.begin(), woken.end() );
+  size_t middle = awakeList().size();
+  awakeList().insert( awakeList().end(), woken.begin(), woken.end() );
+  inplace_merge( awakeList().begin(), awakeList().begin() + middle, awakeList().end() );
+}
+
+/*End Tracking-------------------------------------------------------*/
+
+/*Begin Islands-------------------------------------------------------*/
+
+/* This function returns the representative row of a body's island, flattening the path to it
+ *
+ * @param (vector<int>& parent) the union find forest, by row
+ * @param (int row) the body row
+ */
+static int islandRoot( vector<int>& parent, int row ) {
+  while (parent[row] != row) {
+    parent[row] = parent[parent[row]];
+    row = parent[row];
+  }
+  return row;
+}
+
+/* This function returns whether a body moves at least as fast as sleepSettings.speed
+ *
+ * @param (int row) the body row
+ */
+static bool bodyMoving( int row ) {
+  scalar_t speed = toScalar( sleepSettings().speed );
+  return bodyStore().dx[row] * bodyStore().dx[row] + bodyStore().dy[row] * bodyStore().dy[row] >= speed * speed;
+}
+
+/* This function wakes a sleeping body. Its island is woken at the next updateSleep, so the
+ * body can be given a velocity right away.
+ *
+ * @param (int row) the body row
+ */
+void wakeBody( int row ) {
+  if (bodyStore().island[row] == 0) return;
+  islandsToWake().push_back( bodyStore().island[row] );
+  if (!(bodyStore().mask[row] & BODY_SLEEPING)) return;
+  trackRows();
+  bodyStore().mask[row] &= ~BODY_SLEEPING;
+  awakeList().insert( upper_bound( awakeList().begin(), awakeList().end(), row ), row );
+}
+
+/**
+ * This function runs at the end of every fixed step, after the contacts have been resolved.
+ * First every sleeping island that was disturbed this step is woken: one touched by a moving
+ * body, one of whose bodies a trigger set moving, or one passed to wakeBody. Then the rest
+ * time of every awake body is updated, the awake bodies are joined into islands along this
+ * step's contacts, and every island whose bodies have all rested for sleepSettings.delayMs
+ * falls asleep. Bodies without Physics never sleep and do not join islands.
+ *
+ * Everything is done in row and contact order, so the result does not depend on the number
+ * of threads. Only the awake rows and the rows of the islands woken are visited.
+ *
+ * @param (float dt) the fixed step in milliseconds
+ */
+void updateSleep( float dt ) {
+  if (!sleepSettings().enabled && sleepingBodies() == 0 && islandsToWake().empty()) return;
+  PROFILE_SCOPE( "updateSleep" );
+  static thread_local vector<int> parent;
+  static thread_local vector<int> awake;
+  static thread_local vector<float> islandRest;
+  static thread_local vector<int> woken;
+  int n = bodyStore().size();
+  const unsigned int physics = BODY_HAS( PHYSICS_TYPE );
+
+  for (const contact_t& contact: Collider::contacts()) {
+    int a = contact.bodyA;
+    int b = contact.bodyB;
+    bool disturbed = bodyMoving( a ) || bodyMoving( b );
+    // A trigger may have moved a sleeping body without waking it
+    if (bodyStore().mask[a] & BODY_SLEEPING) sleepersToIndex().push_back( a );
+    if (bodyStore().mask[b] & BODY_SLEEPING) sleepersToIndex().push_back( b );
+    if (bodyStore().island[a] != 0 && (disturbed || !(bodyStore().mask[a] & BODY_SLEEPING))) islandsToWake().push_back( bodyStore().island[a] );
+    if (bodyStore().island[b] != 0 && (disturbed || !(bodyStore().mask[b] & BODY_SLEEPING))) islandsToWake().push_back( bodyStore().island[b] );
+  }
+  trackRows();
+  if (!islandsToWake().empty()) {
+    sort( islandsToWake().begin(), islandsToWake().end() );
+    islandsToWake().erase( unique( islandsToWake().begin(), islandsToWake().end() ), islandsToWake().end() );
+    woken.clear();
+    for (unsigned int island: islandsToWake()) {
+      unordered_map< unsigned int, vector<int> >::iterator found = islandRows().find( island );
+      if (found == islandRows().end()) continue;
+      for (int i: found->second) {
+        if (bodyStore().mask[i] & BODY_SLEEPING) woken.push_back( i ); // Rows passed to wakeBody are in awakeList already
+        bodyStore().mask[i] &= ~BODY_SLEEPING;
+        bodyStore().island[i] = 0;
+        bodyStore().restMs[i] = 0;
+      }
+      islandRows().erase( found );
+    }
+    islandsToWake().clear();
+    addAwake( woken );
+  }
+
+  // Rest times of the awake bodies, each starting as an island of its own
+  parent.resize( n );
+  awake.clear();
+  sleepingBodies() = n - (int) awakeList().size();
+  for (int i: awakeList()) {
+    if (!(bodyStore().mask[i] & physics)) continue;
+    bodyStore().restMs[i] = bodyMoving( i ) ? 0 : bodyStore().restMs[i] + dt;
+    parent[i] = i;
+    awake.push_back( i );
+  }
+  if (!sleepSettings().enabled) return;
+
+  for (const contact_t& contact: Collider::contacts()) {
+    int a = contact.bodyA;
+    int b = contact.bodyB;
+    if ((bodyStore().mask[a] & (physics | BODY_SLEEPING)) != physics || (bodyStore().mask[b] & (physics | BODY_SLEEPING)) != physics) continue;
+    int rootA = islandRoot( parent, a );
+    int rootB = islandRoot( parent, b );
+    if (rootA != rootB) parent[max( rootA, rootB )] = min( rootA, rootB ); // The lowest row stays the root
+  }
+
+  // An island sleeps when its least rested body has rested long enough
+  islandRest.resize( n );
+  for (int i: awake) islandRest[i] = HUGE_VALF;
+  for (int i: awake) {
+    int root = islandRoot( parent, i );
+    islandRest[root] = min( islandRest[root], bodyStore().restMs[i] );
+  }
+  bool fellAsleep = false;
+  for (int i: awake) {
+    int root = islandRoot( parent, i );
+    if (islandRest[root] < sleepSettings().delayMs) continue;
+    bodyStore().mask[i] |= BODY_SLEEPING;
+    // Named after its lowest row; should a moved row make two islands share a name, waking
+    // one also wakes the other, which costs time but is never wrong
+    bodyStore().island[i] = (unsigned int) root + 1;
+    islandRows()[bodyStore().island[i]].push_back( i );
+    sleepersToIndex().push_back( i );
+    bodyStore().dx[i] = toScalar( 0 );
+    bodyStore().dy[i] = toScalar( 0 );
+    sleepingBodies()++;
+    fellAsleep = true;
+  }
+  if (fellAsleep) {
+    awakeList().erase( remove_if( awakeList().begin(), awakeList().end(), []( int row ) { return (bodyStore().mask[row] & BODY_SLEEPING) != 0; } ), awakeList().end() );
+  }
+  if ((int) sleepersToIndex().size() > 2 * n) {
+    // Nothing has taken them, as in a swept step; look for the sleeping colliders afresh instead
+    sleepersToIndex().clear();
+    bodyStore().version++;
+  }
+}
+
+/*End Islands-------------------------------------------------------*/
@@ -0,0 +1,41 @@
+#ifndef SLEEP_H
+#define SLEEP_H
+
+#include <vector>
+
+using namespace std;
+
+#define SLEEP_SPEED 0.00001   // Speed in units per ms under which a body counts as resting
+#define SLEEP_DELAY_MS 500    // Time every body of an island must rest before the island sleeps
+
+/* Bodies with a Physics component that stay slower than speed for delayMs fall asleep: their
+ * velocity is set to 0 and BODY_SLEEPING is set in their mask. Sleeping bodies are not moved
+ * or bounced off the walls, and only awake colliders look for contacts, so a sleeping body
+ * only costs something when an awake one comes near it.
+ *
+ * Bodies that touched each other during the step form an island and fall asleep together,
+ * once all of them have rested long enough. A sleeping island wakes up as a whole when an
+ * awake body hits one of its bodies while moving, or when a trigger gives one of them a
+ * velocity. Call wakeBody after changing the velocity of a sleeping body from a script.
+ *
+ * The awake rows and the rows of every sleeping island are kept in lists, so the passes over
+ * the bodies that only care about awake ones cost what the awake bodies cost. BODY_SLEEPING
+ * is only set and cleared here; anything else that changes the rows or their masks must change
+ * bodyStore.version, and the lists are built again from the columns.
+ */
+struct sleepSettings_t {
+  bool enabled;
+  double speed;
+  double delayMs;
+};
+
+// Sleep state of the current World, see world.h
+inline sleepSettings_t& sleepSettings();
+inline int& sleepingBodies(); // Bodies asleep after the last updateSleep
+inline vector<int>& sleepersToIndex(); // Rows that fell asleep, or were touched and maybe moved while asleep, since Collider::updateBroadphase last took them
+
+void updateSleep( float dt ); // Wake disturbed islands and put resting ones to sleep; runs at the end of every fixed step
+void wakeBody( int row );     // Wake a body now and the rest of its island at the next updateSleep
+const vector<int>& awakeRows(); // Every row of bodyStore not asleep, in row order
+
+#endif
@@ -0,0 +1,282 @@
+/*-------------------------------------------------------
+
+Implements saving the world to a snapshot file and
+restoring it by mapping the file into the BodyStore.
+
+---------------------------------------------------------*/
+
+#include "snapshot.h"
+#include "ODLGameLoop_private.h"
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const char snapshotMagic[8] = { 'B', 'B', 'S', 'N', 'A', 'P', SCALAR_SNAPSHOT_TAG, 0 };
+
+/*Begin Saving-------------------------------------------------------*/
+
+/* This function writes zero bytes until the file position is a multiple of SNAPSHOT_ALIGN
+ *
+ * @param (FILE* file) the snapshot being written
+ * @param (uint64_t& offset) the current file position; moved to the boundary
+ */
+static bool padToAlign( FILE* file, uint64_t& offset ) {
+  static const char zeros[SNAPSHOT_ALIGN] = { 0 };
+  uint64_t padding = (SNAPSHOT_ALIGN - offset % SNAPSHOT_ALIGN) % SNAPSHOT_ALIGN;
+  offset += padding;
+  return fwrite( zeros, 1, padding, file ) == padding;
+}
+
+/* This function appends the registered names of every trigger set to a buffer
+ *
+ * @param (vector<uint8_t>& out) the buffer to append to
+ */
+static bool encodeTriggerSets( vector<uint8_t>& out ) {
+  uint32_t sets = (uint32_t) Collider::triggerSets().size();
+  out.insert( out.end(), (const uint8_t*) &sets, (const uint8_t*) (&sets + 1) );
+  for (const vector<triggerFunc>& triggers: Collider::triggerSets()) {
+    uint32_t count = (uint32_t) triggers.size();
+    out.insert( out.end(), (const uint8_t*) &count, (const uint8_t*) (&count + 1) );
+    for (triggerFunc trigger: triggers) {
+      const string* name = Collider::triggerName( trigger );
+      if (name == NULL) {
+        fprintf( stderr, "snapshot: a Collider uses a trigger with no registered name\n" );
+        return false;
+      }
+      uint32_t length = (uint32_t) name->size();
+      out.insert( out.end(), (const uint8_t*) &length, (const uint8_t*) (&length + 1) );
+      out.insert( out.end(), name->begin(), name->end() );
+    }
+  }
+  return true;
+}
+
+/* This function writes every BodyStore column, the trigger sets and the game loop state to a
+ * snapshot file. The file is written next to the target and renamed over it at the end, so an
+ * interrupted save never leaves a broken snapshot behind. Components without a built in type
+ * are not saved.
+ *
+ * @param (const char* path) the snapshot file to create
+ */
+bool saveSnapshot( const char* path ) {
+  vector<uint8_t> triggers;
+  if (!encodeTriggerSets( triggers )) return false;
+
+  uint64_t n = (uint64_t) bodyStore().size();
+  const void* columnData[SNAPSHOT_COLUMNS] = {
+    bodyStore().mask.data(), bodyStore().x.data(), bodyStore().y.data(), bodyStore().dx.data(),
+    bodyStore().dy.data(), bodyStore().mass.data(), bodyStore().colliderRadius.data(),
+    bodyStore().wallRadius.data(), bodyStore().renderRadius.data(), bodyStore().color.data(),
+    bodyStore().triggerSet.data(), bodyStore().restMs.data(), bodyStore().island.data() };
+  const uint32_t elementBytes[SNAPSHOT_COLUMNS] = {
+    sizeof( unsigned int ), sizeof( scalar_t ), sizeof( scalar_t ), sizeof( scalar_t ),
+    sizeof( scalar_t ), sizeof( scalar_t ), sizeof( scalar_t ),
+    sizeof( scalar_t ), sizeof( scalar_t ), sizeof( color_t ),
+    sizeof( unsigned int ), sizeof( float ), sizeof( unsigned int ) };
+
+  snapshotHeader_t header;
+  memset( &header, 0, sizeof( header ) );
+  memcpy( header.magic, snapshotMagic, sizeof( header.magic ) );
+  header.version = SNAPSHOT_VERSION;
+  header.columnCount = SNAPSHOT_COLUMNS;
+  header.bodies = n;
+  header.timeAccumulatedMs = odlGameLoopState().timeAccumulatedMs;
+  header.simulatedTimeMs = odlGameLoopState().simulatedTimeMs;
+  header.stepDurationMs = odlGameLoopState().desiredStateUpdateDurationMs;
+  header.stepCount = odlGameLoopState().stepCount;
+
+  // Lay the columns out on page boundaries after the header and directory
+  snapshotColumn_t directory[SNAPSHOT_COLUMNS];
+  uint64_t offset = sizeof( header ) + sizeof( directory );
+  for (int c = 0; c < SNAPSHOT_COLUMNS; c++) {
+    offset += (SNAPSHOT_ALIGN - offset % SNAPSHOT_ALIGN) % SNAPSHOT_ALIGN;
+    directory[c].id = c;
+    directory[c].elementBytes = elementBytes[c];
+    directory[c].offset = offset;
+    directory[c].bytes = n * elementBytes[c];
+    offset += directory[c].bytes;
+  }
+  header.triggersOffset = offset;
+  header.triggersBytes = triggers.size();
+
+  string temporary = string( path ) + ".tmp";
+  FILE* file = fopen( temporary.c_str(), "wb" );
+  if (file == NULL) return false;
+  bool ok = fwrite( &header, sizeof( header ), 1, file ) == 1 &&
+    fwrite( directory, sizeof( directory ), 1, file ) == 1;
+  offset = sizeof( header ) + sizeof( directory );
+  for (int c = 0; ok && c < SNAPSHOT_COLUMNS; c++) {
+    ok = padToAlign( file, offset ) &&
+      fwrite( columnData[c], 1, directory[c].bytes, file ) == directory[c].bytes;
+    offset += directory[c].bytes;
+  }
+  ok = ok && fwrite( triggers.data(), 1, triggers.size(), file ) == triggers.size();
+  ok = fclose( file ) == 0 && ok;
+  if (ok) ok = rename( temporary.c_str(), path ) == 0;
+  if (!ok) remove( temporary.c_str() );
+  return ok;
+}
+
+/*End Saving-------------------------------------------------------*/
+
+/*Begin Loading-------------------------------------------------------*/
+
+static uint8_t* snapshotData = NULL; // The last loaded snapshot; columns may point into it until the process ends
+static size_t snapshotSize = 0;
+
+/* This function points a BodyStore column at its values in the mapped snapshot. A column the
+ * snapshot does not have is filled with the default instead.
+ *
+ * @param (BodyColumn<T>& column) the empty column to fill
+ * @param (const snapshotColumn_t* entry) the directory entry of the column, or NULL if missing
+ * @param (uint64_t n) the number of bodies
+ * @param (const T& fallback) the value of every row when the column is missing
+ */
+template <class T> static bool adoptColumn( BodyColumn<T>& column, const snapshotColumn_t* entry, uint64_t n, const T& fallback ) {
+  if (entry == NULL) {
+    column.reserve( (size_t) n );
+    for (uint64_t i = 0; i < n; i++) column.push_back( fallback );
+    return true;
+  }
+  // Divided rather than multiplied, so no size in the file can overflow the checks
+  if (entry->elementBytes != sizeof( T ) || entry->bytes % sizeof( T ) != 0 || entry->bytes / sizeof( T ) != n ||
+      entry->offset % alignof( T ) != 0 || entry->offset > snapshotSize || entry->bytes > snapshotSize - entry->offset) return false;
+  column.adopt( (T*) (snapshotData + entry->offset), (size_t) n );
+  return true;
+}
+
+/* This function reads the trigger sets of a snapshot, resolving every name to the trigger
+ * registered with it.
+ *
+ * @param (const snapshotHeader_t& header) the header of the mapped snapshot
+ * @param (vector< vector<triggerFunc> >& sets) receives the trigger sets
+ */
+static bool decodeTriggerSets( const snapshotHeader_t& header, vector< vector<triggerFunc> >& sets ) {
+  if (header.triggersOffset > snapshotSize || header.triggersBytes > snapshotSize - header.triggersOffset) return false;
+  const uint8_t* at = snapshotData + header.triggersOffset;
+  const uint8_t* end = at + header.triggersBytes;
+  uint32_t count;
+  if (end - at < (long) sizeof( count )) return false;
+  memcpy( &count, at, sizeof( count ) );
+  at += sizeof( count );
+  sets.assign( count, vector<triggerFunc>() );
+  for (uint32_t s = 0; s < count; s++) {
+    uint32_t length;
+    if (end - at < (long) sizeof( length )) return false;
+    memcpy( &length, at, sizeof( length ) );
+    at += sizeof( length );
+    for (uint32_t t = 0; t < length; t++) {
+      uint32_t nameBytes;
+      if (end - at < (long) sizeof( nameBytes )) return false;
+      memcpy( &nameBytes, at, sizeof( nameBytes ) );
+      at += sizeof( nameBytes );
+      if ((uint64_t) (end - at) < nameBytes) return false;
+      string name( (const char*) at, nameBytes );
+      at += nameBytes;
+      triggerFunc trigger = Collider::findTrigger( name );
+      if (trigger == NULL) {
+        fprintf( stderr, "snapshot: no trigger registered as %s\n", name.c_str() );
+        return false;
+      }
+      sets[s].push_back( trigger );
+    }
+  }
+  return count > 0 && sets[0].empty();
+}
+
+/* This function restores a world saved by saveSnapshot. The file is mapped copy on write and
+ * the BodyStore columns point straight into it, so loading does no work per body and the file
+ * is never changed. GameObjects and components are only created for a body when something
+ * asks for them through bodyStore.object(). The world must be empty.
+ *
+ * @param (const char* path) the snapshot file
+ */
+bool loadSnapshot( const char* path ) {
+  if (bodyStore().size() != 0 || snapshotData != NULL) return false;
+
+  int fd = ::open( path, O_RDONLY );
+  if (fd < 0) return false;
+  struct stat info;
+  if (fstat( fd, &info ) != 0 || info.st_size < (off_t) sizeof( snapshotHeader_t )) {
+    ::close( fd );
+    return false;
+  }
+  size_t size = (size_t) info.st_size;
+  void* mapped = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0 );
+  ::close( fd );
+  if (mapped == MAP_FAILED) return false;
+  snapshotData = (uint8_t*) mapped;
+  snapshotSize = size;
+
+  snapshotHeader_t header;
+  memcpy( &header, snapshotData, sizeof( header ) );
+  uint64_t directoryEnd = sizeof( header ) + (uint64_t) header.columnCount * sizeof( snapshotColumn_t );
+  vector< vector<triggerFunc> > sets;
+  bool ok = memcmp( header.magic, snapshotMagic, sizeof( snapshotMagic ) ) == 0 &&
+    header.version <= SNAPSHOT_VERSION && directoryEnd <= size && decodeTriggerSets( header, sets );
+
+  const snapshotColumn_t* entries[SNAPSHOT_COLUMNS] = { NULL };
+  const snapshotColumn_t* directory = (const snapshotColumn_t*) (snapshotData + sizeof( header ));
+  for (uint32_t c = 0; ok && c < header.columnCount; c++) {
+    if (directory[c].id < SNAPSHOT_COLUMNS) entries[directory[c].id] = &directory[c];
+  }
+
+  // Every body has a row in the mask column, so the file must be big enough to hold one; the
+  // columns missing from it are filled in with defaults, which must not be trusted to bound n
+  uint64_t n = header.bodies;
+  if (ok && (n > INT_MAX || (n > 0 && entries[SNAPSHOT_MASK] == NULL) || n > (size - directoryEnd) / sizeof( unsigned int ))) {
+    fprintf( stderr, "snapshot: %s claims %llu bodies, more than the file holds\n", path, (unsigned long long) n );
+    ok = false;
+  }
+  color_t blue = { 0, 0, 1 };
+  ok = ok && adoptColumn( bodyStore().mask, entries[SNAPSHOT_MASK], n, 0u ) &&
+    adoptColumn( bodyStore().x, entries[SNAPSHOT_X], n, toScalar( 0 ) ) &&
+    adoptColumn( bodyStore().y, entries[SNAPSHOT_Y], n, toScalar( 0 ) ) &&
+    adoptColumn( bodyStore().dx, entries[SNAPSHOT_DX], n, toScalar( 0 ) ) &&
+    adoptColumn( bodyStore().dy, entries[SNAPSHOT_DY], n, toScalar( 0 ) ) &&
+    adoptColumn( bodyStore().mass, entries[SNAPSHOT_MASS], n, toScalar( 1 ) ) &&
+    adoptColumn( bodyStore().colliderRadius, entries[SNAPSHOT_COLLIDER_RADIUS], n, toScalar( 0 ) ) &&
+    adoptColumn( bodyStore().wallRadius, entries[SNAPSHOT_WALL_RADIUS], n, toScalar( 0 ) ) &&
+    adoptColumn( bodyStore().renderRadius, entries[SNAPSHOT_RENDER_RADIUS], n, toScalar( 0 ) ) &&
+    adoptColumn( bodyStore().color, entries[SNAPSHOT_COLOR], n, blue ) &&
+    adoptColumn( bodyStore().triggerSet, entries[SNAPSHOT_TRIGGER_SET], n, 0u ) &&
+    adoptColumn( bodyStore().restMs, entries[SNAPSHOT_REST_MS], n, 0.0f ) &&
+    adoptColumn( bodyStore().island, entries[SNAPSHOT_ISLAND], n, 0u );
+  if (!ok) {
+    // Leave the world empty again
+    bodyStore().mask.adopt( NULL, 0 );
+    bodyStore().x.adopt( NULL, 0 );
+    bodyStore().y.adopt( NULL, 0 );
+    bodyStore().dx.adopt( NULL, 0 );
+    bodyStore().dy.adopt( NULL, 0 );
+    bodyStore().mass.adopt( NULL, 0 );
+    bodyStore().colliderRadius.adopt( NULL, 0 );
+    bodyStore().wallRadius.adopt( NULL, 0 );
+    bodyStore().renderRadius.adopt( NULL, 0 );
+    bodyStore().color.adopt( NULL, 0 );
+    bodyStore().triggerSet.adopt( NULL, 0 );
+    bodyStore().restMs.adopt( NULL, 0 );
+    bodyStore().island.adopt( NULL, 0 );
+    munmap( snapshotData, snapshotSize );
+    snapshotData = NULL;
+    return false;
+  }
+
+  Collider::triggerSets().swap( sets );
+  bodyStore().objects.assign( (size_t) n, NULL );
+  // Bodies saved asleep stay asleep, so updateSleep has to know about them even without
+  // --sleep to wake them when disturbed; the new version rebuilds the sleeping grid
+  sleepingBodies() = 0;
+  for (uint64_t i = 0; i < n; i++) sleepingBodies() += (bodyStore().mask[i] & BODY_SLEEPING) != 0;
+  bodyStore().version++;
+  odlGameLoopState().timeAccumulatedMs = header.timeAccumulatedMs;
+  odlGameLoopState().simulatedTimeMs = header.simulatedTimeMs;
+  odlGameLoopState().desiredStateUpdateDurationMs = header.stepDurationMs;
+  odlGameLoopState().stepCount = header.stepCount;
+  return true;
+}
+
+/*End Loading-------------------------------------------------------*/
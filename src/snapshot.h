@@ -0,0 +1,65 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+#include "bodies.h"
+
+using namespace std;
+
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_ALIGN 4096 // Columns start on page boundaries so they can be used in place once mapped
+
+// Columns a snapshot can hold. Readers skip ids they do not know, so new columns can be added
+// without a version bump as long as older worlds still load with the defaults.
+enum snapshotColumnId_t {
+  SNAPSHOT_MASK,
+  SNAPSHOT_X,
+  SNAPSHOT_Y,
+  SNAPSHOT_DX,
+  SNAPSHOT_DY,
+  SNAPSHOT_MASS,
+  SNAPSHOT_COLLIDER_RADIUS,
+  SNAPSHOT_WALL_RADIUS,
+  SNAPSHOT_RENDER_RADIUS,
+  SNAPSHOT_COLOR,
+  SNAPSHOT_TRIGGER_SET,
+  SNAPSHOT_REST_MS,
+  SNAPSHOT_ISLAND,
+  SNAPSHOT_COLUMNS,
+};
+
+/* Layout of a snapshot file (all values little endian):
+ *
+ *   header:    "BBSNAP\0\0", version, body count, loop state, column count, trigger table
+ *              offset and size; float builds write "BBSNAPf\0" and fixed point builds
+ *              "BBSNAPq\0", so a world only loads into a build of its own precision
+ *   directory: id, element size, file offset and byte size of every column
+ *   columns:   the raw BodyStore columns, each starting on a SNAPSHOT_ALIGN boundary
+ *   triggers:  set count, then for every trigger set its length and the registered name
+ *              (length, bytes) of each trigger
+ */
+
+struct snapshotHeader_t {
+  char magic[8];
+  uint32_t version;
+  uint32_t columnCount;
+  uint64_t bodies;
+  double timeAccumulatedMs;   // odlGameLoopState when the snapshot was taken
+  double simulatedTimeMs;
+  double stepDurationMs;
+  int64_t stepCount;
+  uint64_t triggersOffset;
+  uint64_t triggersBytes;
+};
+
+struct snapshotColumn_t {
+  uint32_t id;
+  uint32_t elementBytes;
+  uint64_t offset;
+  uint64_t bytes;
+};
+
+bool saveSnapshot( const char* path ); // Write the world and loop state; false if a trigger has no registered name or the file cannot be written
+bool loadSnapshot( const char* path ); // Map a snapshot into an empty world and resume its loop state
+
+#endif
@@ -0,0 +1,198 @@
+/*-------------------------------------------------------
+
+Implements the multithreaded CPU rasterizer used to render
+frames without an OpenGL context.
+
+---------------------------------------------------------*/
+
+#include "softraster.h"
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+/*Begin SoftwareRenderBackend-------------------------------------------------------*/
+
+/* The constructor for a SoftwareRenderBackend. The background is black, as in the GL window.
+ *
+ * @param (int width) framebuffer width in pixels
+ * @param (int height) framebuffer height in pixels
+ */
+SoftwareRenderBackend::SoftwareRenderBackend( int width, int height ) :
+width( width ), height( height ), stream( NULL ), isPipe( false ), frameCount( 0 ) {
+  tilesX = (width + SOFTRASTER_TILE - 1) / SOFTRASTER_TILE;
+  tilesY = (height + SOFTRASTER_TILE - 1) / SOFTRASTER_TILE;
+  pixels.assign( (size_t) width * height, 0 );
+  tileBins.resize( tilesX * tilesY );
+  background.R = 0;
+  background.G = 0;
+  background.B = 0;
+}
+
+/* The destructor for a SoftwareRenderBackend. Flushes and closes the output.
+ */
+SoftwareRenderBackend::~SoftwareRenderBackend() {
+  close();
+}
+
+/* This function chooses where endFrame writes frames
+ *
+ * @param (const char* target) a printf pattern containing '%' writes numbered PPM images,
+ *        "|command" pipes raw RGBA frames into command, "-" writes them to stdout, and any
+ *        other path receives every raw RGBA frame appended one after the other
+ */
+bool SoftwareRenderBackend::open( const char* target ) {
+  close();
+  if (strchr( target, '%' ) != NULL) {
+    pattern = target;
+    return true;
+  }
+  if (target[0] == '|') {
+    stream = popen( target + 1, "w" );
+    isPipe = true;
+  } else if (strcmp( target, "-" ) == 0) {
+    stream = stdout;
+  } else {
+    stream = fopen( target, "wb" );
+  }
+  return stream != NULL;
+}
+
+/* This function flushes and closes the output chosen with open()
+ */
+void SoftwareRenderBackend::close() {
+  if (stream != NULL && stream != stdout) {
+    if (isPipe) pclose( stream );
+    else fclose( stream );
+  } else if (stream == stdout) {
+    fflush( stdout );
+  }
+  stream = NULL;
+  isPipe = false;
+  pattern.clear();
+}
+
+/* This function packs a color into an RGBA pixel, clamping each channel to [0, 1]
+ *
+ * @param (const color_t& color) the color to pack
+ */
+static uint32_t packColor( const color_t& color ) {
+  float channels[3] = { color.R, color.G, color.B };
+  uint32_t pixel = 0xff000000u;
+  for (int c = 0; c < 3; c++) {
+    float v = channels[c] < 0 ? 0 : (channels[c] > 1 ? 1 : channels[c]);
+    pixel |= (uint32_t) (v * 255 + 0.5f) << (8 * c);
+  }
+  return pixel;
+}
+
+/* This function renders every CircleRender row into the framebuffer. The world's [-1, 1]
+ * square is stretched over the whole frame, as the GL viewport does.
+ *
+ * @param (const BodyStore& bodies) the bodies to draw
+ */
+void SoftwareRenderBackend::drawCircles( const BodyStore& bodies ) {
+  PROFILE_SCOPE( "CircleRender raster" );
+  for (vector<int>& bin: tileBins) bin.clear();
+
+  // Bin each circle into every tile its bounding box touches
+  for (int i = 0; i < bodies.size(); i++) {
+    if (!(bodies.mask[i] & BODY_HAS( CIRCLE_RENDER_TYPE ))) continue;
+    double cx = (renderX( bodies, i ) + 1) * 0.5 * width;
+    double cy = (1 - renderY( bodies, i )) * 0.5 * height;
+    double rx = bodies.renderRadius[i] * 0.5 * width;
+    double ry = bodies.renderRadius[i] * 0.5 * height;
+    int x0 = max( 0, (int) floor( cx - rx ) ) / SOFTRASTER_TILE;
+    int x1 = min( width - 1, (int) ceil( cx + rx ) ) / SOFTRASTER_TILE;
+    int y0 = max( 0, (int) floor( cy - ry ) ) / SOFTRASTER_TILE;
+    int y1 = min( height - 1, (int) ceil( cy + ry ) ) / SOFTRASTER_TILE;
+    if (cx + rx < 0 || cy + ry < 0 || cx - rx >= width || cy - ry >= height) continue;
+    for (int ty = y0; ty <= y1; ty++) {
+      for (int tx = x0; tx <= x1; tx++) tileBins[ty * tilesX + tx].push_back( i );
+    }
+  }
+
+  renderJobPool->parallelFor( tilesX * tilesY, 1, [this, &bodies]( int begin, int end ) {
+    PROFILE_SCOPE( "raster tiles" );
+    for (int tile = begin; tile < end; tile++) rasterizeTile( bodies, tile );
+  });
+}
+
+/* This function clears one tile and fills in the circles binned to it, one span per pixel row.
+ * A pixel is covered when its center lies inside the circle.
+ *
+ * @param (const BodyStore& bodies) the bodies to draw
+ * @param (int tile) index of the tile, row major
+ */
+void SoftwareRenderBackend::rasterizeTile( const BodyStore& bodies, int tile ) {
+  int tileX0 = (tile % tilesX) * SOFTRASTER_TILE;
+  int tileY0 = (tile / tilesX) * SOFTRASTER_TILE;
+  int tileX1 = min( width, tileX0 + SOFTRASTER_TILE );
+  int tileY1 = min( height, tileY0 + SOFTRASTER_TILE );
+
+  uint32_t clear = packColor( background );
+  for (int py = tileY0; py < tileY1; py++) {
+    uint32_t* row = &pixels[(size_t) py * width];
+    fill( row + tileX0, row + tileX1, clear );
+  }
+
+  for (int i: tileBins[tile]) {
+    double cx = (renderX( bodies, i ) + 1) * 0.5 * width;
+    double cy = (1 - renderY( bodies, i )) * 0.5 * height;
+    double rx = bodies.renderRadius[i] * 0.5 * width;
+    double ry = bodies.renderRadius[i] * 0.5 * height;
+    if (rx <= 0 || ry <= 0) continue;
+    uint32_t color = packColor( bodies.color[i] );
+
+    int rowBegin = max( tileY0, (int) ceil( cy - ry - 0.5 ) );
+    int rowEnd = min( tileY1, (int) floor( cy + ry - 0.5 ) + 1 );
+    for (int py = rowBegin; py < rowEnd; py++) {
+      double v = (py + 0.5 - cy) / ry;
+      double h = 1 - v * v;
+      if (h < 0) continue;
+      double halfWidth = rx * sqrt( h );
+      int spanBegin = max( tileX0, (int) ceil( cx - halfWidth - 0.5 ) );
+      int spanEnd = min( tileX1, (int) floor( cx + halfWidth - 0.5 ) + 1 );
+      if (spanBegin >= spanEnd) continue;
+      uint32_t* row = &pixels[(size_t) py * width];
+      fill( row + spanBegin, row + spanEnd, color );
+    }
+  }
+}
+
+/* This function writes the framebuffer as a binary PPM image
+ *
+ * @param (const char* path) the file to write
+ */
+bool SoftwareRenderBackend::writePPM( const char* path ) {
+  FILE* f = fopen( path, "wb" );
+  if (f == NULL) return false;
+  fprintf( f, "P6\n%d %d\n255\n", width, height );
+  rowBuffer.resize( (size_t) width * 3 );
+  for (int py = 0; py < height; py++) {
+    const unsigned char* src = (const unsigned char*) &pixels[(size_t) py * width];
+    for (int px = 0; px < width; px++) {
+      rowBuffer[3 * px] = src[4 * px];
+      rowBuffer[3 * px + 1] = src[4 * px + 1];
+      rowBuffer[3 * px + 2] = src[4 * px + 2];
+    }
+    fwrite( &rowBuffer[0], 1, rowBuffer.size(), f );
+  }
+  return fclose( f ) == 0;
+}
+
+/* This function writes the current frame to the target chosen with open(). Without a target
+ * the frame only stays in the framebuffer.
+ */
+void SoftwareRenderBackend::endFrame() {
+  PROFILE_SCOPE( "frame output" );
+  if (!pattern.empty()) {
+    char path[1024];
+    snprintf( path, sizeof( path ), pattern.c_str(), (int) frameCount );
+    if (!writePPM( path )) fprintf( stderr, "could not write frame %s\n", path );
+  } else if (stream != NULL) {
+    fwrite( &pixels[0], sizeof( uint32_t ), pixels.size(), stream );
+  }
+  frameCount++;
+}
+
+/*End SoftwareRenderBackend-------------------------------------------------------*/
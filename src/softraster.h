@@ -0,0 +1,52 @@
+#ifndef SOFTRASTER_H
+#define SOFTRASTER_H
+
+#include <vector>
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include "render.h"
+
+using namespace std;
+
+#define SOFTRASTER_TILE 64 // Edge length in pixels of the square tiles rasterized by one job
+
+/* Renders the circles into an RGBA framebuffer in memory, without OpenGL. Circles are binned
+ * into square tiles and the tiles are rasterized in parallel on renderJobPool; within a tile
+ * circles are drawn in body order, so later bodies cover earlier ones as in the GL path.
+ * Each finished frame can be written as a numbered PPM image, or appended as raw RGBA to a
+ * file or to the stdin of an external command (eg an encoder).
+ */
+class SoftwareRenderBackend : public RenderBackend {
+  private:
+    int width;
+    int height;
+    int tilesX;
+    int tilesY;
+    vector<uint32_t> pixels;        // Row 0 is the top of the image; bytes are R, G, B, A
+    vector< vector<int> > tileBins; // Body rows overlapping each tile, in row order
+    color_t background;
+
+    string pattern;                 // printf pattern for numbered PPM files, if writing images
+    FILE* stream;                   // Raw RGBA output file or pipe, if any
+    bool isPipe;
+    vector<unsigned char> rowBuffer;
+    long frameCount;
+
+    void rasterizeTile( const BodyStore& bodies, int tile );
+    bool writePPM( const char* path );
+
+  public:
+    SoftwareRenderBackend( int width, int height );
+    ~SoftwareRenderBackend();
+    bool open( const char* target ); // "frames/%05d.ppm" for images, "|cmd" to pipe raw RGBA into cmd, "-" for stdout, else a raw RGBA file
+    void close();
+    void drawCircles( const BodyStore& bodies );
+    void endFrame();                  // Write the frame to the target given to open()
+    const uint32_t* framebuffer() const { return &pixels[0]; }
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    long framesWritten() const { return frameCount; }
+};
+
+#endif
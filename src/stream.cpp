@@ -0,0 +1,464 @@
+/*-------------------------------------------------------
+
+Implements live streaming of the body state to viewers
+on other machines, and a client that rebuilds it.
+
+---------------------------------------------------------*/
+
+#include "stream.h"
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <chrono>
+
+StreamServer* streamServer = NULL;
+
+/* This function returns the time on the system clock in ns. Unlike the steady clock it means the
+ * same on every machine whose clock is synchronized, so viewers can tell how old a frame is.
+ */
+long long streamClockNs() {
+  return chrono::duration_cast<chrono::nanoseconds>( chrono::system_clock::now().time_since_epoch() ).count();
+}
+
+/* This function returns the time on the steady clock in ns. Frames are paced by it, since unlike
+ * the system clock it never jumps when the clock is set.
+ */
+static long long streamPaceNs() {
+  return chrono::duration_cast<chrono::nanoseconds>( chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+/*Begin Quantization-------------------------------------------------------*/
+
+/* This function maps a value to 16 bits, clamping it to the range covered
+ *
+ * @param (double v) the value
+ * @param (double offset) added before scaling, so that -offset maps to 0
+ * @param (double scale) units per world unit
+ */
+static uint16_t quantizeUnits( double v, double offset, double scale ) {
+  double q = floor( (v + offset) * scale + 0.5 );
+  return (uint16_t) (q < 0 ? 0 : q > 65535 ? 65535 : q);
+}
+
+/* This function maps a color channel from 0..1 to 0..255
+ *
+ * @param (float c) the channel
+ */
+static uint8_t quantizeChannel( float c ) {
+  return (uint8_t) (c <= 0 ? 0 : c >= 1 ? 255 : (int) (c * 255 + 0.5f));
+}
+
+/*End Quantization-------------------------------------------------------*/
+
+/*Begin StreamServer-------------------------------------------------------*/
+
+/* The constructor for a StreamServer. It does nothing until open().
+ */
+StreamServer::StreamServer() : listener( -1 ), intervalNs( 0 ), stopping( false ), wantedAtNs( 0 ),
+framesSent( 0 ), framesSkipped( 0 ), bytesSent( 0 ) {}
+
+/* The destructor for a StreamServer. It disconnects every viewer.
+ */
+StreamServer::~StreamServer() {
+  close();
+}
+
+/* This function starts listening for viewers and starts the sender thread. Returns false if the
+ * port could not be listened on.
+ *
+ * @param (int port) the TCP port
+ * @param (int fps) frames per second sent to viewers that ask for no rate of their own
+ */
+bool StreamServer::open( int port, int fps ) {
+  listener = ::socket( AF_INET, SOCK_STREAM, 0 );
+  if (listener < 0) return false;
+  int on = 1;
+  setsockopt( listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof( on ) );
+  sockaddr_in address = sockaddr_in();
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl( INADDR_ANY );
+  address.sin_port = htons( (uint16_t) port );
+  if (bind( listener, (sockaddr*) &address, sizeof( address ) ) != 0 || listen( listener, 16 ) != 0) {
+    ::close( listener );
+    listener = -1;
+    return false;
+  }
+  fcntl( listener, F_SETFL, fcntl( listener, F_GETFL ) | O_NONBLOCK );
+  intervalNs = fps > 0 ? 1000000000LL / fps : 0;
+  stopping = false;
+  sender = thread( &StreamServer::senderLoop, this );
+  return true;
+}
+
+/* This function stops the sender thread and disconnects every viewer. A frame a viewer is still
+ * receiving is cut short.
+ */
+void StreamServer::close() {
+  if (listener < 0) return;
+  stopping = true;
+  sender.join();
+  for (streamViewer_t& viewer: viewers) ::close( viewer.socket );
+  viewers.clear();
+  ::close( listener );
+  listener = -1;
+  wantedAtNs = 0;
+}
+
+/**
+ * This function offers the state after a step to the viewers. Unless a viewer is due a frame
+ * and the sender thread has taken the last one, it returns without doing anything; otherwise
+ * it copies the positions, radii and colors for the sender thread to encode. It never waits.
+ *
+ * @param (long step) the step the state is after
+ * @param (const BodyStore& bodies) the bodies
+ */
+void StreamServer::publish( long step, const BodyStore& bodies ) {
+  long long wanted = wantedAtNs.load( memory_order_acquire );
+  if (wanted == 0 || exchange.fresh()) return;
+  if (streamPaceNs() < wanted) return;
+  static const vector<double> none;
+  exchange.capture( bodies, none, none, step, streamClockNs() );
+}
+
+/* This function quantizes a captured frame into x, y, radius and color
+ *
+ * @param (const renderFrame_t& frame) the frame
+ */
+void StreamServer::quantize( const renderFrame_t& frame ) {
+  const BodyStore& bodies = frame.bodies;
+  size_t n = (size_t) bodies.size();
+  x.resize( n );
+  y.resize( n );
+  radius.resize( n );
+  color.resize( n );
+  for (size_t i = 0; i < n; i++) {
+    x[i] = quantizeUnits( toDouble( bodies.x[i] ), 2, STREAM_POSITION_SCALE );
+    y[i] = quantizeUnits( toDouble( bodies.y[i] ), 2, STREAM_POSITION_SCALE );
+    bool drawn = (bodies.mask[i] & BODY_HAS( CIRCLE_RENDER_TYPE )) != 0;
+    radius[i] = drawn ? quantizeUnits( toDouble( bodies.renderRadius[i] ), 0, STREAM_RADIUS_SCALE ) : 0;
+    const color_t& c = bodies.color[i];
+    color[i] = quantizeChannel( c.R ) | (uint32_t) quantizeChannel( c.G ) << 8 | (uint32_t) quantizeChannel( c.B ) << 16;
+  }
+}
+
+/* This function encodes the quantized frame for a viewer, as a keyframe or as a delta from the
+ * last frame it was sent, and makes it the viewer's pending frame
+ *
+ * @param (streamViewer_t& viewer) the viewer; must have nothing pending
+ * @param (long step) the step of the frame
+ * @param (long long captureNs) when the frame was captured
+ */
+void StreamServer::encode( streamViewer_t& viewer, long step, long long captureNs ) {
+  size_t n = x.size();
+  bool keyframe = viewer.framesToKeyframe <= 0 || viewer.x.size() != n;
+  vector<uint8_t>& out = viewer.pending;
+  out.clear();
+  viewer.sent = 0;
+  put<uint32_t>( out, 0 ); // Byte count, filled in at the end
+  out.push_back( keyframe ? STREAM_KEYFRAME : STREAM_DELTA );
+  putVarint( out, step );
+  putVarint( out, captureNs );
+  putVarint( out, (int64_t) n );
+  if (keyframe) {
+    out.reserve( out.size() + n * 9 );
+    for (size_t i = 0; i < n; i++) {
+      put<uint16_t>( out, x[i] );
+      put<uint16_t>( out, y[i] );
+      put<uint16_t>( out, radius[i] );
+      for (int shift = 0; shift < 24; shift += 8) out.push_back( (uint8_t) (color[i] >> shift) );
+    }
+    viewer.framesToKeyframe = STREAM_KEYFRAME_INTERVAL;
+  } else {
+    long changed = 0;
+    for (size_t i = 0; i < n; i++) {
+      putVarint( out, (int64_t) x[i] - viewer.x[i] );
+      putVarint( out, (int64_t) y[i] - viewer.y[i] );
+      if (radius[i] != viewer.radius[i] || color[i] != viewer.color[i]) changed++;
+    }
+    putVarint( out, changed );
+    size_t last = 0;
+    for (size_t i = 0; i < n && changed > 0; i++) {
+      if (radius[i] == viewer.radius[i] && color[i] == viewer.color[i]) continue;
+      putVarint( out, (int64_t) (i - last) );
+      last = i;
+      put<uint16_t>( out, radius[i] );
+      for (int shift = 0; shift < 24; shift += 8) out.push_back( (uint8_t) (color[i] >> shift) );
+    }
+    viewer.framesToKeyframe--;
+  }
+  uint32_t bytes = (uint32_t) (out.size() - sizeof( uint32_t ));
+  memcpy( out.data(), &bytes, sizeof( bytes ) );
+  viewer.x = x;
+  viewer.y = y;
+  viewer.radius = radius;
+  viewer.color = color;
+  framesSent++;
+}
+
+/* This function sends as much of a viewer's pending frame as its socket takes without waiting.
+ * Returns false if the viewer has gone.
+ *
+ * @param (streamViewer_t& viewer) the viewer
+ */
+bool StreamServer::flush( streamViewer_t& viewer ) {
+  while (viewer.sent < viewer.pending.size()) {
+    ssize_t sent = send( viewer.socket, viewer.pending.data() + viewer.sent, viewer.pending.size() - viewer.sent,
+      MSG_NOSIGNAL | MSG_DONTWAIT );
+    if (sent > 0) {
+      viewer.sent += (size_t) sent;
+      bytesSent += (uint64_t) sent;
+    } else {
+      return sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+    }
+  }
+  return true;
+}
+
+/**
+ * This function is the sender thread. It accepts viewers, reads the rate each asks for, sends
+ * pending frames as their sockets drain and, whenever publish() has captured a frame, encodes
+ * it for every viewer that is due one and has nothing pending. Afterwards it tells publish()
+ * when the next viewer will be due a frame.
+ */
+void StreamServer::senderLoop() {
+  vector<pollfd> polls;
+  while (!stopping.load()) {
+    polls.clear();
+    polls.push_back( pollfd{ listener, POLLIN, 0 } );
+    for (const streamViewer_t& viewer: viewers) {
+      short events = POLLIN | (viewer.sent < viewer.pending.size() ? POLLOUT : 0);
+      polls.push_back( pollfd{ viewer.socket, events, 0 } );
+    }
+    poll( polls.data(), polls.size(), 1 );
+
+    // Viewers that have gone are dropped; polls stays in step with viewers until then
+    vector<char> gone( viewers.size(), 0 );
+    for (size_t k = 0; k < viewers.size(); k++) {
+      streamViewer_t& viewer = viewers[k];
+      if (polls[k + 1].revents & (POLLIN | POLLHUP | POLLERR)) {
+        uint8_t bytes[64];
+        ssize_t got = recv( viewer.socket, bytes, viewer.greeted ? sizeof( bytes ) : sizeof( uint32_t ), MSG_DONTWAIT | MSG_PEEK );
+        if (got == 0 || (got < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) gone[k] = 1;
+        else if (!viewer.greeted && got == (ssize_t) sizeof( uint32_t )) {
+          uint32_t fps;
+          recv( viewer.socket, &fps, sizeof( fps ), MSG_DONTWAIT );
+          viewer.intervalNs = fps > 0 ? 1000000000LL / fps : intervalNs;
+          viewer.greeted = true;
+        } else if (viewer.greeted && got > 0) {
+          recv( viewer.socket, bytes, (size_t) got, MSG_DONTWAIT ); // Nothing more is expected from a viewer
+        }
+      }
+      if (!gone[k] && !flush( viewer )) gone[k] = 1;
+    }
+    for (size_t k = viewers.size(); k-- > 0;) {
+      if (!gone[k]) continue;
+      ::close( viewers[k].socket );
+      viewers.erase( viewers.begin() + k );
+    }
+
+    if (polls[0].revents & POLLIN) {
+      int accepted;
+      while ((accepted = accept( listener, NULL, NULL )) >= 0) {
+        int on = 1;
+        setsockopt( accepted, IPPROTO_TCP, TCP_NODELAY, &on, sizeof( on ) );
+        streamViewer_t viewer = streamViewer_t();
+        viewer.socket = accepted;
+        viewers.push_back( viewer );
+      }
+    }
+
+    long long now = streamPaceNs();
+    if (exchange.fresh()) {
+      const renderFrame_t& frame = exchange.latest();
+      quantize( frame );
+      for (streamViewer_t& viewer: viewers) {
+        if (!viewer.greeted || now < viewer.nextFrameNs || viewer.sent < viewer.pending.size()) continue;
+        encode( viewer, frame.step, frame.timeNs );
+        viewer.nextFrameNs = now + viewer.intervalNs;
+        flush( viewer );
+      }
+    }
+
+    // Viewers still receiving a frame are not due another until they have it; the frames they
+    // miss meanwhile are dropped
+    long long wanted = 0;
+    for (streamViewer_t& viewer: viewers) {
+      if (!viewer.greeted) continue;
+      if (viewer.sent < viewer.pending.size()) {
+        for (; viewer.intervalNs > 0 && now >= viewer.nextFrameNs; viewer.nextFrameNs += viewer.intervalNs) framesSkipped++;
+        continue;
+      }
+      long long due = max( viewer.nextFrameNs, 1LL );
+      if (wanted == 0 || due < wanted) wanted = due;
+    }
+    wantedAtNs.store( wanted, memory_order_release );
+  }
+}
+
+/*End StreamServer-------------------------------------------------------*/
+
+/*Begin StreamClient-------------------------------------------------------*/
+
+/* This function reads a zigzag varint written by putVarint without reading past the end of the
+ * message. Returns false if it would.
+ *
+ * @param (const vector<uint8_t>& message) the message
+ * @param (size_t& at) offset of the value; moved past it
+ * @param (int64_t& value) receives the value
+ */
+static bool readVarint( const vector<uint8_t>& message, size_t& at, int64_t& value ) {
+  return getVarint( message.data(), at, message.size(), value );
+}
+
+/* This function reads exactly size bytes from a socket, waiting for them. Returns false if the
+ * connection ends first.
+ *
+ * @param (int socket) the socket
+ * @param (void* bytes) where to put them
+ * @param (size_t size) how many
+ */
+static bool receiveAll( int socket, void* bytes, size_t size ) {
+  uint8_t* at = (uint8_t*) bytes;
+  while (size > 0) {
+    ssize_t got = recv( socket, at, size, 0 );
+    if (got < 0 && errno == EINTR) continue;
+    if (got <= 0) return false;
+    at += got;
+    size -= (size_t) got;
+  }
+  return true;
+}
+
+/* The constructor for a StreamClient. It does nothing until connect().
+ */
+StreamClient::StreamClient() : socket( -1 ), step( 0 ), captureNs( 0 ), frames( 0 ), keyframes( 0 ), bytesReceived( 0 ) {}
+
+/* The destructor for a StreamClient. It disconnects.
+ */
+StreamClient::~StreamClient() {
+  close();
+}
+
+/* This function connects to a StreamServer and asks for a frame rate. Returns false if the
+ * server cannot be reached.
+ *
+ * @param (const char* host) name or address of the server
+ * @param (int port) its port
+ * @param (int fps) the frames per second wanted, 0 for the server's rate
+ */
+bool StreamClient::connect( const char* host, int port, int fps ) {
+  close();
+  addrinfo hints = addrinfo();
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* found = NULL;
+  char service[16];
+  snprintf( service, sizeof( service ), "%d", port );
+  if (getaddrinfo( host, service, &hints, &found ) != 0) return false;
+  for (addrinfo* a = found; a != NULL && socket < 0; a = a->ai_next) {
+    socket = ::socket( a->ai_family, a->ai_socktype, a->ai_protocol );
+    if (socket >= 0 && ::connect( socket, a->ai_addr, a->ai_addrlen ) != 0) {
+      ::close( socket );
+      socket = -1;
+    }
+  }
+  freeaddrinfo( found );
+  if (socket < 0) return false;
+  int on = 1;
+  setsockopt( socket, IPPROTO_TCP, TCP_NODELAY, &on, sizeof( on ) );
+  uint32_t wanted = (uint32_t) max( 0, fps );
+  return send( socket, &wanted, sizeof( wanted ), MSG_NOSIGNAL ) == (ssize_t) sizeof( wanted );
+}
+
+/* This function disconnects from the server.
+ */
+void StreamClient::close() {
+  if (socket >= 0) ::close( socket );
+  socket = -1;
+}
+
+/* This function waits for the next frame and applies it to the state. Returns false when the
+ * connection ends or a frame cannot be decoded.
+ */
+bool StreamClient::readFrame() {
+  uint32_t bytes;
+  if (socket < 0 || !receiveAll( socket, &bytes, sizeof( bytes ) ) || bytes > STREAM_MAX_FRAME_BYTES) return false;
+  message.resize( bytes );
+  if (!receiveAll( socket, message.data(), bytes )) return false;
+  bytesReceived += sizeof( bytes ) + bytes;
+  return decode();
+}
+
+/* This function applies the frame in message to the quantized state, checking every read
+ * against its length, and converts the result back to world units.
+ */
+bool StreamClient::decode() {
+  if (message.empty()) return false;
+  int kind = message[0];
+  size_t at = 1;
+  int64_t frameStep, frameNs, bodies;
+  if (!readVarint( message, at, frameStep ) || !readVarint( message, at, frameNs ) || !readVarint( message, at, bodies )) return false;
+  if (bodies < 0 || (uint64_t) bodies > message.size()) return false;
+  size_t n = (size_t) bodies;
+  if (kind == STREAM_KEYFRAME) {
+    if (message.size() - at != n * 9) return false;
+    qx.resize( n );
+    qy.resize( n );
+    qradius.resize( n );
+    qcolor.resize( n );
+    for (size_t i = 0; i < n; i++) {
+      qx[i] = get<uint16_t>( message.data(), at );
+      qy[i] = get<uint16_t>( message.data(), at );
+      qradius[i] = get<uint16_t>( message.data(), at );
+      qcolor[i] = message[at] | (uint32_t) message[at + 1] << 8 | (uint32_t) message[at + 2] << 16;
+      at += 3;
+    }
+    keyframes++;
+  } else if (kind == STREAM_DELTA) {
+    if (qx.size() != n) return false;
+    for (size_t i = 0; i < n; i++) {
+      int64_t deltaX, deltaY;
+      if (!readVarint( message, at, deltaX ) || !readVarint( message, at, deltaY )) return false;
+      qx[i] = (uint16_t) (qx[i] + deltaX);
+      qy[i] = (uint16_t) (qy[i] + deltaY);
+    }
+    int64_t changed;
+    if (!readVarint( message, at, changed ) || changed < 0) return false;
+    size_t i = 0;
+    for (int64_t k = 0; k < changed; k++) {
+      int64_t skip;
+      if (!readVarint( message, at, skip ) || skip < 0 || (uint64_t) skip >= n - i || message.size() - at < 5) return false;
+      i += (size_t) skip;
+      qradius[i] = get<uint16_t>( message.data(), at );
+      qcolor[i] = message[at] | (uint32_t) message[at + 1] << 8 | (uint32_t) message[at + 2] << 16;
+      at += 3;
+    }
+    if (at != message.size()) return false;
+  } else {
+    return false;
+  }
+
+  x.resize( n );
+  y.resize( n );
+  radius.resize( n );
+  color.resize( n );
+  for (size_t i = 0; i < n; i++) {
+    x[i] = qx[i] / STREAM_POSITION_SCALE - 2;
+    y[i] = qy[i] / STREAM_POSITION_SCALE - 2;
+    radius[i] = qradius[i] / STREAM_RADIUS_SCALE;
+    color[i].R = (qcolor[i] & 0xff) / 255.0f;
+    color[i].G = (qcolor[i] >> 8 & 0xff) / 255.0f;
+    color[i].B = (qcolor[i] >> 16 & 0xff) / 255.0f;
+  }
+  step = (long) frameStep;
+  captureNs = frameNs;
+  frames++;
+  return true;
+}
+
+/*End StreamClient-------------------------------------------------------*/
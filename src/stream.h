@@ -0,0 +1,117 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <stdint.h>
+#include "bodies.h"
+#include "publish.h"
+
+using namespace std;
+
+#define STREAM_KEYFRAME 1              // Frame kinds, the first byte of every frame
+#define STREAM_DELTA 2
+#define STREAM_KEYFRAME_INTERVAL 60    // Frames sent to a viewer between two keyframes
+#define STREAM_DEFAULT_FPS 30          // Frames per second sent to a viewer that asks for no rate
+#define STREAM_POSITION_SCALE 16384.0  // Position units per world unit; positions cover [-2, 2)
+#define STREAM_RADIUS_SCALE 32768.0    // Radius units per world unit; radii cover [0, 2)
+#define STREAM_MAX_FRAME_BYTES ( 1u << 30 ) // Larger frames are taken as a corrupt stream by StreamClient
+
+/* Wire format of a live stream, all values little endian. A viewer connects over TCP and sends
+ * the frames per second it wants as a uint32, 0 for the server's rate. The server then sends
+ * frames, each a uint32 byte count followed by
+ *
+ *   kind (uint8), step, capture time in ns on the system clock and body count as zigzag varints,
+ *   keyframe: x, y and radius of every body as uint16 and its R, G, B as uint8, 9 bytes a body,
+ *   delta:    the change in x and y of every body since the last frame sent to this viewer as
+ *             varints, then the number of bodies whose radius or color changed and for each the
+ *             change in its row from the one before as a varint and its radius and color as in
+ *             a keyframe.
+ *
+ * A body that does not render has radius 0. A resting body costs 2 bytes of a delta frame and
+ * one moving a few pixels a frame 4. A keyframe follows every STREAM_KEYFRAME_INTERVAL frames,
+ * and whenever the body count changes.
+ */
+
+// One viewer of a StreamServer; owned by the sender thread
+struct streamViewer_t {
+  int socket;
+  bool greeted;                // Whether the requested rate has been read
+  long long intervalNs;        // Least time between two frames to this viewer
+  long long nextFrameNs;        // On the steady clock, like every time frames are paced by
+  vector<uint8_t> pending;     // The frame being sent
+  size_t sent;                 // Bytes of pending already sent
+  vector<uint16_t> x, y, radius; // Quantized state of the last frame sent, the base of the next delta
+  vector<uint32_t> color;
+  long framesToKeyframe;
+};
+
+/* Publishes the state of the bodies to viewers over TCP, see the wire format above. The
+ * simulation thread hands every step to publish(), which copies the render state into a
+ * FrameExchange only when the sender thread has taken the last one and a viewer is due a
+ * frame, so it never waits for the network. The sender thread encodes each frame for every
+ * viewer that is due one, against the last frame that viewer got. A viewer still receiving its
+ * last frame is skipped, so slow viewers get fewer frames instead of holding anyone up.
+ */
+class StreamServer {
+  private:
+    int listener;
+    long long intervalNs;          // Default time between frames
+    FrameExchange exchange;
+    thread sender;
+    atomic<bool> stopping;
+    atomic<long long> wantedAtNs;  // Time on the steady clock the next viewer is due a frame, 0 without viewers
+    vector<streamViewer_t> viewers;
+    vector<uint16_t> x, y, radius; // Quantized state of the frame being sent
+    vector<uint32_t> color;
+    StreamServer( const StreamServer& );
+
+    void senderLoop();
+    void quantize( const renderFrame_t& frame );
+    void encode( streamViewer_t& viewer, long step, long long captureNs );
+    bool flush( streamViewer_t& viewer );
+
+  public:
+    long framesSent;               // Frames sent over all viewers
+    long framesSkipped;            // Frames dropped because a viewer was still receiving an earlier one
+    uint64_t bytesSent;
+
+    StreamServer();
+    ~StreamServer();
+    bool open( int port, int fps = STREAM_DEFAULT_FPS ); // Listen on port on every interface and start the sender thread
+    void publish( long step, const BodyStore& bodies );  // Offer the state after a step; returns at once
+    void close();
+};
+
+extern StreamServer* streamServer; // Receives every fixed step when not NULL
+
+/* Connects to a StreamServer and rebuilds the state of the bodies from its frames. */
+class StreamClient {
+  private:
+    int socket;
+    vector<uint8_t> message;
+    vector<uint16_t> qx, qy, qradius;
+    vector<uint32_t> qcolor;
+
+    bool decode();
+
+  public:
+    vector<double> x, y, radius;   // State after the last frame read
+    vector<color_t> color;
+    long step;
+    long long captureNs;           // When the server captured the last frame, on the system clock
+    long frames;
+    long keyframes;
+    uint64_t bytesReceived;        // Including the byte counts in front of the frames
+
+    StreamClient();
+    ~StreamClient();
+    bool connect( const char* host, int port, int fps = 0 ); // fps 0 takes the server's rate
+    bool readFrame();              // Wait for the next frame and apply it; false when the stream ends or is corrupt
+    void close();
+};
+
+long long streamClockNs(); // The system clock in ns, which frames are stamped with
+
+#endif
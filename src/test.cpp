@@ -0,0 +1,390 @@
+/*-------------------------------------------------------
+
+Headless regression tests of the simulation. Each test
+builds a small world, steps it and checks the result,
+printing a line for every check that fails.
+
+Build and run with "make test"; the exit status is the
+number of failed checks.
+
+---------------------------------------------------------*/
+
+#include "components.h"
+#include "components.cpp"
+#include "gameloop.cpp"
+#include "balls.cpp"
+#include <thread>
+
+static int checksFailed = 0;
+
+/* This function reports a check that failed
+ *
+ * @param (bool passed) the result of the check
+ * @param (const char* test) the test making the check
+ * @param (const char* what) what was checked
+ */
+static void check(bool passed, const char* test, const char* what) {
+  if (passed) return;
+  printf("FAIL %s: %s\n", test, what);
+  checksFailed++;
+}
+
+/* This function creates a resting ball that only collides, so contacts stay as they are built
+ *
+ * @param (double x) the x position of the ball
+ * @param (double y) the y position of the ball
+ */
+static GameObject* createRestingBall(double x, double y) {
+  GameObject* obj = new GameObject(x, y);
+  new Collider(obj, .1);
+  return obj;
+}
+
+static thread_local vector<contact_t> lastEvents; // The events of the last step; worlds on other threads keep their own
+
+/* This function keeps the events of every step for the tests to check
+ *
+ * @param (const contact_t* events) the events
+ * @param (int count) how many there are
+ * @param (float dt) the fixed step in milliseconds
+ */
+static void keepEvents(const contact_t* events, int count, float dt) {
+  lastEvents.assign(events, events + count);
+}
+
+/* This function returns how many of the last step's events have a phase
+ *
+ * @param (collisionPhase_t phase) the phase
+ */
+static int countEvents(collisionPhase_t phase) {
+  int count = 0;
+  for (const contact_t& event: lastEvents) count += event.phase == phase;
+  return count;
+}
+
+/* Destroying a touching body between the steps of the window loop, with interpolation on,
+ * removes its row before the step and again at the start of fixedUpdateAll. The pair it was in
+ * must exit, and the pair whose body was moved into its row must stay.
+ */
+static void testDestroyTouchingWithInterpolation() {
+  const char* name = "destroy touching body with interpolation";
+  World world;
+  world.enter();
+  double dt = 10;
+  ODLGameLoop_initGameLoopState(dt, 5, 1, 0);
+  createRestingBall(0, 0);
+  GameObject* destroyed = createRestingBall(.15, 0);
+  createRestingBall(.5, .5);
+  createRestingBall(.65, .5);
+
+  Component::fixedUpdateAll(dt);
+  check(countEvents(COLLISION_ENTER) == 2, name, "both pairs enter");
+  Component::fixedUpdateAll(dt);
+  check(countEvents(COLLISION_STAY) == 2, name, "both pairs stay");
+
+  destroyed->destroy();
+  odlGameLoopState().lastLoopTimeNs = ODLGameLoop_nowNs();
+  odlGameLoopState().timeAccumulatedMs = dt * 1.5;
+  check(ODLGameLoop_advance() == 1, name, "one step runs");
+  check(bodyStore().size() == 3, name, "the body is removed");
+  check(countEvents(COLLISION_STAY) == 1, name, "the moved pair stays");
+  check(countEvents(COLLISION_ENTER) == 0, name, "no pair enters");
+  check(countEvents(COLLISION_EXIT) == 1, name, "the pair of the removed body exits");
+  for (const contact_t& event: lastEvents) {
+    if (event.phase != COLLISION_EXIT) continue;
+    check(event.bodyA == 0 && event.bodyB == -1 && event.b == NULL, name, "the exit names the removed body as -1");
+  }
+
+  Component::fixedUpdateAll(dt);
+  check(countEvents(COLLISION_STAY) == 1 && lastEvents.size() == 1, name, "the moved pair still stays a step later");
+  world.leave();
+}
+
+/* Fixed point division must saturate instead of trapping when dividing by zero or overflowing,
+ * whatever scalar_t the build uses
+ */
+static void testFixedDivision() {
+  const char* name = "fixed point division";
+  Fixed zero(0.0);
+  check((Fixed(1.5) / Fixed(.5)) == Fixed(3.0), name, "1.5 / .5 is 3");
+  check((Fixed(1.0) / zero).raw == INT64_MAX, name, "1 / 0 saturates up");
+  check((Fixed(-1.0) / zero).raw == -INT64_MAX, name, "-1 / 0 saturates down");
+  check((zero / zero).raw == 0, name, "0 / 0 is 0");
+  check((Fixed(1e6) / Fixed::fromRaw(1)).raw == INT64_MAX, name, "an overflowing quotient saturates");
+}
+
+/* A snapshot whose header claims more bodies than the file holds, or whose directory points
+ * past its end, must be rejected without allocating for the bodies, leaving the world empty
+ */
+static void testCorruptSnapshot() {
+  const char* name = "corrupt snapshot";
+  World world;
+  world.enter();
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/ballbouncer-test-%d.snap", (int) getpid());
+
+  // A header and an empty trigger table with no columns at all
+  snapshotHeader_t header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, snapshotMagic, sizeof(header.magic));
+  header.version = SNAPSHOT_VERSION;
+  header.bodies = 1000000000000ull;
+  header.triggersOffset = sizeof(header);
+  header.triggersBytes = 8;
+  uint32_t triggers[2] = { 1, 0 }; // One set, the empty one
+  FILE* file = fopen(path, "wb");
+  fwrite(&header, sizeof(header), 1, file);
+  fwrite(triggers, sizeof(triggers), 1, file);
+  fclose(file);
+  check(!loadSnapshot(path), name, "10^12 bodies without columns are rejected");
+  check(bodyStore().size() == 0, name, "the world stays empty");
+
+  // A real snapshot whose body count is raised and whose mask column points past the end
+  createRestingBall(0, 0);
+  createRestingBall(.5, 0);
+  check(saveSnapshot(path), name, "the snapshot is saved");
+  world.leave();
+  World restored;
+  restored.enter();
+  file = fopen(path, "r+b");
+  fread(&header, sizeof(header), 1, file);
+  header.bodies = (uint64_t) INT_MAX + 1;
+  fseek(file, 0, SEEK_SET);
+  fwrite(&header, sizeof(header), 1, file);
+  fclose(file);
+  check(!loadSnapshot(path), name, "more than INT_MAX bodies are rejected");
+  header.bodies = 2;
+  snapshotColumn_t mask;
+  file = fopen(path, "r+b");
+  fwrite(&header, sizeof(header), 1, file);
+  fread(&mask, sizeof(mask), 1, file);
+  mask.offset = UINT64_MAX - 4;
+  fseek(file, sizeof(header), SEEK_SET);
+  fwrite(&mask, sizeof(mask), 1, file);
+  fclose(file);
+  check(!loadSnapshot(path), name, "a column whose end overflows is rejected");
+  check(bodyStore().size() == 0, name, "the world stays empty after a bad column");
+  restored.leave();
+  remove(path);
+}
+
+/* This function builds a seeded world of moving, colliding balls in a World of its own, steps
+ * it and returns its BodyStore columns and last contacts as bytes, to be compared with memcmp
+ *
+ * @param (int steps) the fixed steps to run
+ * @param (vector<char>& state) receives the columns, then the contacts without their pointers
+ */
+static void stepSeededWorld(int steps, vector<char>& state) {
+  World world;
+  world.enter();
+  unsigned int seed = 12345;
+  auto next = [&seed]() { seed = seed * 1103515245u + 12345u; return (seed >> 8) / 16777216.0; };
+  // More rows than one integration chunk of jobPool, and not a multiple of any vector width
+  for (int i = 0; i < 17001; i++) {
+    createBall(next() * 1.9 - .95, next() * 1.9 - .95, (next() - .5) * .002, (next() - .5) * .002, .002 + next() * .002);
+  }
+  for (int step = 0; step < steps; step++) Component::fixedUpdateAll(10);
+
+  int n = bodyStore().size();
+  state.clear();
+  const BodyColumn<scalar_t>* columns[] = { &bodyStore().x, &bodyStore().y, &bodyStore().dx, &bodyStore().dy };
+  for (const BodyColumn<scalar_t>* column: columns) {
+    state.insert(state.end(), (const char*) column->data(), (const char*) (column->data() + n));
+  }
+  state.insert(state.end(), (const char*) bodyStore().mask.data(), (const char*) (bodyStore().mask.data() + n));
+  for (contact_t contact: Collider::contacts()) {
+    contact.a = contact.b = NULL;
+    state.insert(state.end(), (const char*) &contact, (const char*) (&contact + 1));
+  }
+  world.leave();
+}
+
+/* Every integration kernel this CPU supports must give results bit-identical to the scalar one
+ */
+static void testKernelsIdentical() {
+  const char* name = "identical kernels";
+  const char* kernels[] = { "scalar", "sse2", "avx2", "avx512" };
+  vector<char> expected, state;
+  check(selectStepKernel("scalar"), name, "the scalar kernel is always there");
+  stepSeededWorld(8, expected);
+  check(expected.size() > 17001 * (4 * sizeof(scalar_t) + sizeof(unsigned int)), name, "the balls touch");
+  for (const char* kernel: kernels) {
+    if (!selectStepKernel(kernel)) continue;
+    stepSeededWorld(8, state);
+    string what = string(kernel) + " gives the state of scalar";
+    check(state.size() == expected.size() && memcmp(state.data(), expected.data(), state.size()) == 0, name, what.c_str());
+  }
+  selectStepKernel("auto");
+}
+
+/* Stepping on any number of threads must give the same state and contacts as one thread
+ */
+static void testThreadsIdentical() {
+  const char* name = "identical thread counts";
+  const int threadCounts[] = { 2, 3, 8 };
+  vector<char> expected, state;
+  jobPool.stop();
+  stepSeededWorld(8, expected);
+  for (int threads: threadCounts) {
+    jobPool.start(threads);
+    stepSeededWorld(8, state);
+    string what = to_string(threads) + " threads give the state of 1";
+    check(state.size() == expected.size() && memcmp(state.data(), expected.data(), state.size()) == 0, name, what.c_str());
+  }
+  jobPool.stop();
+}
+
+/* Worlds stepped at the same time on their own threads, one of them spreading its loops over
+ * jobPool, must each give the state of a world stepped alone
+ */
+static void testConcurrentWorlds() {
+  const char* name = "concurrent worlds";
+  vector<char> expected, first, second;
+  jobPool.stop();
+  stepSeededWorld(4, expected);
+  jobPool.start(2);
+  thread other([&first]() { stepSeededWorld(4, first); });
+  stepSeededWorld(4, second);
+  other.join();
+  jobPool.stop();
+  check(first.size() == expected.size() && memcmp(first.data(), expected.data(), first.size()) == 0, name, "the world on the other thread gives the state of one alone");
+  check(second.size() == expected.size() && memcmp(second.data(), expected.data(), second.size()) == 0, name, "the world on this thread gives the state of one alone");
+}
+
+static int countedAlive = 0; // Counted components not deleted yet
+
+// A scripted component that counts its instances
+class Counted : public Component {
+  public:
+    Counted(GameObject* parent) : Component(parent, "Counted") { countedAlive++; }
+    ~Counted() { countedAlive--; }
+};
+
+/* Deleting a World while another one is current must delete its objects and components and
+ * leave the current world as it is
+ */
+static void testDeleteWorldElsewhere() {
+  const char* name = "delete world while another is current";
+  World* deleted = new World();
+  deleted->enter();
+  for (int i = 0; i < 5; i++) new Counted(createRestingBall(i * .3 - .6, 0));
+  deleted->leave();
+  {
+    World current;
+    current.enter();
+    new Counted(createRestingBall(0, .5));
+    delete deleted;
+    check(countedAlive == 1, name, "the components of the deleted world are deleted");
+    check(bodyStore().size() == 1, name, "the current world keeps its body");
+    Component::fixedUpdateAll(10);
+    current.leave();
+  }
+  check(countedAlive == 0, name, "the components of the current world are deleted with it");
+}
+
+/* This function builds world number n of the ensemble test: twenty balls whose speed depends
+ * on n
+ *
+ * @param (int world) the number of the world
+ */
+static void createEnsembleWorld(int world) {
+  for (int i = 0; i < 20; i++) {
+    createBall(i % 5 * .35 - .7, i / 5 * .35 - .55, (i % 3 - 1) * .0003 * (1 + world), (i % 7 - 3) * .0001 * (1 + world), .05 + i % 4 * .02);
+  }
+}
+
+/* An ensemble must give the same summaries on any number of threads
+ */
+static void testEnsembleThreads() {
+  const char* name = "ensemble threads";
+  vector<worldSummary_t> expected, summaries;
+  jobPool.stop();
+  runEnsemble(9, 200, 10, createEnsembleWorld, expected);
+  check(expected.size() == 9 && expected[8].bodies == 20 && expected[8].contacts > 0, name, "the worlds are built and collide");
+  jobPool.start(4);
+  runEnsemble(9, 200, 10, createEnsembleWorld, summaries);
+  jobPool.stop();
+  check(summaries.size() == expected.size() && memcmp(summaries.data(), expected.data(), expected.size() * sizeof(worldSummary_t)) == 0,
+    name, "4 threads give the summaries of 1");
+  check(bodyStore().size() == 0, name, "the process world is left empty");
+}
+
+static string archetypeCalls; // The fixedUpdate calls of the archetype test, in order
+
+// Scripted components that log their fixedUpdate calls
+class LoggedA : public Component {
+  public:
+    LoggedA(GameObject* parent) : Component(parent, "LoggedA") {}
+    void fixedUpdate(float dt) { archetypeCalls += "A" + to_string(parent->body) + " "; }
+};
+
+class LoggedB : public Component {
+  public:
+    LoggedB(GameObject* parent) : Component(parent, "LoggedB") {}
+    void fixedUpdate(float dt) { archetypeCalls += "B" + to_string(parent->body) + " "; }
+};
+
+class LoggedBSubclass : public LoggedB {
+  public:
+    LoggedBSubclass(GameObject* parent) : LoggedB(parent) {}
+    void fixedUpdate(float dt) { archetypeCalls += "S" + to_string(parent->body) + " "; }
+};
+
+typedef Archetype<Collider, LoggedA, LoggedB> LoggedPair;
+
+/* This function builds the world of the archetype test and logs the calls of two steps, the
+ * second after one member is destroyed
+ *
+ * @param (bool adopt) whether to adopt the objects into LoggedPair
+ * @param (int& adopted) receives how many objects were adopted
+ */
+static string logArchetypeWorld(bool adopt, int& adopted) {
+  World world;
+  world.enter();
+  for (int i = 0; i < 6; i++) {
+    GameObject* obj = createRestingBall(i * .3 - .9, 0);
+    new LoggedA(obj);
+    if (i == 4) new LoggedBSubclass(obj);
+    else new LoggedB(obj);
+  }
+  // Adopted in reverse, so the instances are in the opposite order to scriptedComponents
+  adopted = 0;
+  for (int row = bodyStore().size() - 1; row >= 0 && adopt; row--) adopted += LoggedPair::adopt(bodyStore().object(row));
+  archetypeCalls.clear();
+  Component::fixedUpdateScripts(10);
+  archetypeCalls += "| ";
+  bodyStore().object(2)->getComponent("LoggedA").front()->destroy();
+  Component::removeDestroyed();
+  Component::fixedUpdateScripts(10);
+  world.leave();
+  return archetypeCalls;
+}
+
+/* Adopted objects must run their scripted components in the same order as without the
+ * archetype, also after a member left, and a subclass of a listed type must keep its own
+ * fixedUpdate
+ */
+static void testArchetypeOrder() {
+  const char* name = "archetype order";
+  int adopted;
+  string expected = logArchetypeWorld(false, adopted);
+  string calls = logArchetypeWorld(true, adopted);
+  check(adopted == 5, name, "every object but the one with the subclass is adopted");
+  check(calls == expected, name, "the calls are in the order of scriptedComponents");
+  check(calls.find("S4") != string::npos, name, "the subclass runs its own fixedUpdate");
+}
+
+int main(int argc, char** argv) {
+  Collider::subscribe(keepEvents);
+  testDestroyTouchingWithInterpolation();
+  testFixedDivision();
+  testCorruptSnapshot();
+  testKernelsIdentical();
+  testThreadsIdentical();
+  testConcurrentWorlds();
+  testDeleteWorldElsewhere();
+  testEnsembleThreads();
+  testArchetypeOrder();
+  if (checksFailed == 0) printf("All tests passed\n");
+  return checksFailed;
+}
@@ -0,0 +1,536 @@
+/*-------------------------------------------------------
+
+Implements recording of simulation traces and their replay
+from a memory mapped file.
+
+---------------------------------------------------------*/
+
+#include "trace.h"
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+
+TraceRecorder* traceRecorder = NULL;
+
+static const char traceMagic[8] = { 'B', 'B', 'T', 'R', 'A', 'C', 'E', 0 };
+static const char traceEndMagic[8] = { 'B', 'B', 'T', 'R', 'E', 'N', 'D', 0 };
+static const char chunkMagic[4] = { 'B', 'B', 'C', 'K' };
+static const char indexMagic[4] = { 'B', 'B', 'I', 'X' };
+
+#define CHUNK_HEADER_BYTES 24 // magic, payload bytes, first step, frame count
+
+/*Begin Encoding-------------------------------------------------------*/
+
+/* This function appends the bytes of a plain value
+ *
+ * @param (vector<uint8_t>& out) the buffer to append to
+ * @param (const T& value) the value to append
+ */
+template <class T> static void put( vector<uint8_t>& out, const T& value ) {
+  const uint8_t* bytes = (const uint8_t*) &value;
+  out.insert( out.end(), bytes, bytes + sizeof( T ) );
+}
+
+/* This function reads a plain value and advances the cursor
+ *
+ * @param (const uint8_t* data) the mapped file
+ * @param (size_t& at) offset of the value; moved past it
+ */
+template <class T> static T get( const uint8_t* data, size_t& at ) {
+  T value;
+  memcpy( &value, data + at, sizeof( T ) );
+  at += sizeof( T );
+  return value;
+}
+
+/* This function appends a signed value as a zigzag varint: small magnitudes of either sign take
+ * one byte.
+ *
+ * @param (vector<uint8_t>& out) the buffer to append to
+ * @param (int64_t value) the value to append
+ */
+static void putVarint( vector<uint8_t>& out, int64_t value ) {
+  uint64_t v = ((uint64_t) value << 1) ^ (uint64_t) (value >> 63);
+  while (v >= 0x80) {
+    out.push_back( (uint8_t) (v | 0x80) );
+    v >>= 7;
+  }
+  out.push_back( (uint8_t) v );
+}
+
+/* This function reads a zigzag varint and advances the cursor. It returns false, leaving value
+ * alone, when the varint runs past end or is longer than 64 bits.
+ *
+ * @param (const uint8_t* data) the mapped file
+ * @param (size_t& at) offset of the value; moved past it
+ * @param (size_t end) offset the value must end by
+ * @param (int64_t& value) receives the value
+ */
+static bool getVarint( const uint8_t* data, size_t& at, size_t end, int64_t& value ) {
+  uint64_t v = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    if (at >= end) return false;
+    uint8_t byte = data[at++];
+    v |= (uint64_t) (byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      value = (int64_t) (v >> 1) ^ -(int64_t) (v & 1);
+      return true;
+    }
+  }
+  return false;
+}
+
+/*End Encoding-------------------------------------------------------*/
+
+/*Begin TraceRecorder-------------------------------------------------------*/
+
+/* The constructor for a TraceRecorder. Nothing is recorded until open() is called.
+ */
+TraceRecorder::TraceRecorder() : file( NULL ), flags( 0 ), framesPerChunk( TRACE_FRAMES_PER_CHUNK ),
+chunkFirstStep( 0 ), chunkFrames( 0 ), chunkBodies( 0 ), offset( 0 ), closing( false ) {}
+
+/* The destructor for a TraceRecorder. Finishes the file if it is still open.
+ */
+TraceRecorder::~TraceRecorder() {
+  close();
+}
+
+/* This function creates a trace file, writes its header and starts the writer thread
+ *
+ * @param (const char* path) the file to create
+ * @param (const BodyStore& bodies) the bodies whose radius and color go in the header
+ * @param (bool quantized) store delta coded fixed point values instead of raw doubles
+ * @param (int framesPerChunk) frames per chunk; also the most frames seek() has to decode
+ */
+bool TraceRecorder::open( const char* path, const BodyStore& bodies, bool quantized, int framesPerChunk ) {
+  close();
+  file = fopen( path, "wb" );
+  if (file == NULL) return false;
+  flags = quantized ? TRACE_QUANTIZED : 0;
+  this->framesPerChunk = framesPerChunk > 0 ? framesPerChunk : TRACE_FRAMES_PER_CHUNK;
+  chunk.clear();
+  chunkFrames = 0;
+  offset = 0;
+  indexSteps.clear();
+  indexOffsets.clear();
+  indexFrames.clear();
+
+  vector<uint8_t> header;
+  header.insert( header.end(), traceMagic, traceMagic + 8 );
+  put<uint32_t>( header, TRACE_VERSION );
+  put<uint32_t>( header, flags );
+  put<double>( header, TRACE_POSITION_SCALE );
+  put<double>( header, TRACE_VELOCITY_SCALE );
+  put<uint32_t>( header, (uint32_t) this->framesPerChunk );
+  put<uint32_t>( header, (uint32_t) bodies.size() );
+  for (int i = 0; i < bodies.size(); i++) {
+    put<float>( header, (float) bodies.renderRadius[i] );
+    put<float>( header, bodies.color[i].R );
+    put<float>( header, bodies.color[i].G );
+    put<float>( header, bodies.color[i].B );
+  }
+
+  closing = false;
+  writer = thread( &TraceRecorder::writerLoop, this );
+  enqueue( header );
+  return true;
+}
+
+/* This function is the body of the writer thread. It writes queued buffers in order until
+ * close() is called and the queue is empty.
+ */
+void TraceRecorder::writerLoop() {
+  while (true) {
+    vector<uint8_t> bytes;
+    {
+      unique_lock<mutex> lk( queueLock );
+      queueReady.wait( lk, [this]{ return closing || !queue.empty(); } );
+      if (queue.empty()) return;
+      bytes.swap( queue.front() );
+      queue.pop_front();
+    }
+    fwrite( &bytes[0], 1, bytes.size(), file );
+  }
+}
+
+/* This function hands a buffer to the writer thread. The buffer is left empty.
+ *
+ * @param (vector<uint8_t>& bytes) the bytes to write
+ */
+void TraceRecorder::enqueue( vector<uint8_t>& bytes ) {
+  if (bytes.empty()) return;
+  offset += bytes.size();
+  {
+    lock_guard<mutex> lk( queueLock );
+    queue.push_back( vector<uint8_t>() );
+    queue.back().swap( bytes );
+  }
+  queueReady.notify_one();
+}
+
+/* This function wraps the frames collected so far in a chunk header, records the chunk in the
+ * index and queues it for writing
+ */
+void TraceRecorder::flushChunk() {
+  if (chunkFrames == 0) return;
+  indexSteps.push_back( (uint64_t) chunkFirstStep );
+  indexOffsets.push_back( offset );
+  indexFrames.push_back( (uint32_t) chunkFrames );
+
+  vector<uint8_t> bytes;
+  bytes.reserve( CHUNK_HEADER_BYTES + chunk.size() );
+  bytes.insert( bytes.end(), chunkMagic, chunkMagic + 4 );
+  put<uint32_t>( bytes, (uint32_t) chunk.size() );
+  put<uint64_t>( bytes, (uint64_t) chunkFirstStep );
+  put<uint32_t>( bytes, (uint32_t) chunkFrames );
+  put<uint32_t>( bytes, 0 );
+  bytes.insert( bytes.end(), chunk.begin(), chunk.end() );
+  chunk.clear();
+  chunkFrames = 0;
+  enqueue( bytes );
+}
+
+/* This function appends one step to the trace: the position and velocity of every body and
+ * the body rows of every contact.
+ *
+ * @param (long step) the number of the step that just ran
+ * @param (const BodyStore& bodies) the bodies after the step
+ * @param (const vector<contact_t>& contacts) the contacts found during the step
+ */
+void TraceRecorder::record( long step, const BodyStore& bodies, const vector<contact_t>& contacts ) {
+  if (file == NULL) return;
+  PROFILE_SCOPE( "trace record" );
+  int n = bodies.size();
+  // Delta frames need the same rows as the frame before, so a new body count starts a new chunk
+  if (chunkFrames > 0 && n != chunkBodies) flushChunk();
+  chunkBodies = n;
+  if (chunkFrames == 0) chunkFirstStep = step;
+  bool keyframe = chunkFrames == 0;
+
+  pairs.clear();
+  for (const contact_t& c: contacts) pairs.push_back( make_pair( c.bodyA, c.bodyB ) );
+  sort( pairs.begin(), pairs.end() );
+
+  putVarint( chunk, step );
+  putVarint( chunk, n );
+  putVarint( chunk, (int64_t) pairs.size() );
+
+  if (flags & TRACE_QUANTIZED) {
+    const BodyColumn<scalar_t>* columns[4] = { &bodies.x, &bodies.y, &bodies.dx, &bodies.dy };
+    const double scales[4] = { TRACE_POSITION_SCALE, TRACE_POSITION_SCALE, TRACE_VELOCITY_SCALE, TRACE_VELOCITY_SCALE };
+    previous.resize( 4 * (size_t) n );
+    for (int c = 0; c < 4; c++) {
+      const BodyColumn<scalar_t>& column = *columns[c];
+      int64_t* prev = &previous[(size_t) c * n];
+      for (int i = 0; i < n; i++) {
+        int64_t q = (int64_t) llround( toDouble( column[i] ) * scales[c] );
+        putVarint( chunk, keyframe ? q : q - prev[i] );
+        prev[i] = q;
+      }
+    }
+  } else {
+    // Traces always hold doubles, whatever the precision of the build
+    const BodyColumn<scalar_t>* columns[4] = { &bodies.x, &bodies.y, &bodies.dx, &bodies.dy };
+    for (int c = 0; c < 4; c++) {
+      size_t at = chunk.size();
+      chunk.resize( at + sizeof( double ) * n );
+      for (int i = 0; i < n; i++) {
+        double value = toDouble( (*columns[c])[i] );
+        memcpy( &chunk[at + sizeof( double ) * i], &value, sizeof( double ) );
+      }
+    }
+  }
+
+  // Contacts are sorted, so store the gap to the previous first body and the gap to the partner
+  int lastA = 0;
+  for (const pair<int, int>& p: pairs) {
+    putVarint( chunk, p.first - lastA );
+    putVarint( chunk, p.second - p.first );
+    lastA = p.first;
+  }
+
+  chunkFrames++;
+  if (chunkFrames >= framesPerChunk) flushChunk();
+}
+
+/* This function writes the last chunk, the chunk index and the footer, then waits for the
+ * writer thread to finish and closes the file
+ */
+void TraceRecorder::close() {
+  if (file == NULL) return;
+  flushChunk();
+
+  vector<uint8_t> tail;
+  uint64_t indexOffset = offset;
+  tail.insert( tail.end(), indexMagic, indexMagic + 4 );
+  put<uint32_t>( tail, (uint32_t) indexSteps.size() );
+  for (size_t k = 0; k < indexSteps.size(); k++) {
+    put<uint64_t>( tail, indexSteps[k] );
+    put<uint64_t>( tail, indexOffsets[k] );
+    put<uint32_t>( tail, indexFrames[k] );
+    put<uint32_t>( tail, 0 );
+  }
+  put<uint64_t>( tail, indexOffset );
+  tail.insert( tail.end(), traceEndMagic, traceEndMagic + 8 );
+  enqueue( tail );
+
+  {
+    lock_guard<mutex> lk( queueLock );
+    closing = true;
+  }
+  queueReady.notify_one();
+  writer.join();
+  fclose( file );
+  file = NULL;
+}
+
+/*End TraceRecorder-------------------------------------------------------*/
+
+/*Begin TraceReader-------------------------------------------------------*/
+
+/* The constructor for a TraceReader
+ */
+TraceReader::TraceReader() : data( NULL ), size( 0 ), flags( 0 ), positionScale( 1 ), velocityScale( 1 ),
+cursor( 0 ), chunkEnd( 0 ), chunk( 0 ), frameInChunk( 0 ) {}
+
+/* The destructor for a TraceReader. Unmaps the file.
+ */
+TraceReader::~TraceReader() {
+  close();
+}
+
+/* This function maps a trace file, reads its header and loads (or rebuilds) the chunk index.
+ * The reader is left at the first frame.
+ *
+ * @param (const char* path) the trace file
+ */
+bool TraceReader::open( const char* path ) {
+  close();
+  int fd = ::open( path, O_RDONLY );
+  if (fd < 0) return false;
+  struct stat st;
+  if (fstat( fd, &st ) != 0 || st.st_size < 40) {
+    ::close( fd );
+    return false;
+  }
+  size = (size_t) st.st_size;
+  void* mapped = mmap( NULL, size, PROT_READ, MAP_PRIVATE, fd, 0 );
+  ::close( fd );
+  if (mapped == MAP_FAILED) {
+    size = 0;
+    return false;
+  }
+  data = (const uint8_t*) mapped;
+  madvise( mapped, size, MADV_SEQUENTIAL );
+
+  size_t at = 0;
+  if (memcmp( data, traceMagic, 8 ) != 0) {
+    close();
+    return false;
+  }
+  at += 8;
+  uint32_t version = get<uint32_t>( data, at );
+  flags = get<uint32_t>( data, at );
+  positionScale = get<double>( data, at );
+  velocityScale = get<double>( data, at );
+  get<uint32_t>( data, at ); // Frames per chunk, only needed by the recorder
+  uint32_t bodies = get<uint32_t>( data, at );
+  if (version != TRACE_VERSION || at + (size_t) bodies * 16 > size) {
+    close();
+    return false;
+  }
+  radius.resize( bodies );
+  color.resize( bodies );
+  for (uint32_t i = 0; i < bodies; i++) {
+    radius[i] = get<float>( data, at );
+    color[i].R = get<float>( data, at );
+    color[i].G = get<float>( data, at );
+    color[i].B = get<float>( data, at );
+  }
+
+  if (!loadIndex()) scanChunks();
+  if (chunkSteps.empty()) return true;
+  return seek( (long) chunkSteps[0] );
+}
+
+/* This function reads the chunk index from the end of the file. An index that points outside
+ * the file, at something other than a chunk, or at chunks out of step order is rejected, and
+ * the chunks are found by scanChunks instead.
+ */
+bool TraceReader::loadIndex() {
+  if (memcmp( data + size - 8, traceEndMagic, 8 ) != 0) return false;
+  size_t at = size - 16;
+  size_t indexOffset = (size_t) get<uint64_t>( data, at );
+  if (indexOffset > size - 16 - 8 || memcmp( data + indexOffset, indexMagic, 4 ) != 0) return false;
+  at = indexOffset + 4;
+  uint32_t chunks = get<uint32_t>( data, at );
+  if (chunks > (size - 16 - at) / 24) return false;
+  size_t firstChunk = 8 + 4 * 4 + 2 * 8 + radius.size() * 16;
+  for (uint32_t k = 0; k < chunks; k++) {
+    uint64_t step = get<uint64_t>( data, at );
+    uint64_t offset = get<uint64_t>( data, at );
+    uint32_t frames = get<uint32_t>( data, at );
+    get<uint32_t>( data, at );
+    bool valid = offset >= firstChunk && offset + CHUNK_HEADER_BYTES <= indexOffset &&
+      memcmp( data + offset, chunkMagic, 4 ) == 0 && (chunkSteps.empty() || step > chunkSteps.back());
+    size_t payloadAt = (size_t) offset + 4;
+    if (valid) valid = payloadAt + 20 + get<uint32_t>( data, payloadAt ) <= indexOffset;
+    if (!valid) {
+      chunkSteps.clear();
+      chunkOffsets.clear();
+      chunkFrames.clear();
+      return false;
+    }
+    chunkSteps.push_back( step );
+    chunkOffsets.push_back( offset );
+    chunkFrames.push_back( frames );
+  }
+  return true;
+}
+
+/* This function rebuilds the chunk index of a trace that was not closed by walking the chunk
+ * headers from the start. A chunk cut off at the end of the file is dropped.
+ */
+void TraceReader::scanChunks() {
+  size_t at = 8 + 4 * 4 + 2 * 8 + radius.size() * 16;
+  while (at + CHUNK_HEADER_BYTES <= size && memcmp( data + at, chunkMagic, 4 ) == 0) {
+    size_t start = at;
+    at += 4;
+    uint32_t payload = get<uint32_t>( data, at );
+    uint64_t step = get<uint64_t>( data, at );
+    uint32_t frames = get<uint32_t>( data, at );
+    at += 4;
+    if (at + payload > size) break;
+    chunkSteps.push_back( step );
+    chunkOffsets.push_back( start );
+    chunkFrames.push_back( frames );
+    at += payload;
+  }
+}
+
+/* This function unmaps the file
+ */
+void TraceReader::close() {
+  if (data != NULL) munmap( (void*) data, size );
+  data = NULL;
+  size = 0;
+  chunkSteps.clear();
+  chunkOffsets.clear();
+  chunkFrames.clear();
+}
+
+/* This function returns the step of the first frame, or -1 for an empty trace
+ */
+long TraceReader::firstStep() const {
+  return chunkSteps.empty() ? -1 : (long) chunkSteps.front();
+}
+
+/* This function returns the step of the last frame, or -1 for an empty trace.
+ * Steps are recorded one after the other, so it follows from the last chunk's frame count.
+ */
+long TraceReader::lastStep() const {
+  return chunkSteps.empty() ? -1 : (long) (chunkSteps.back() + chunkFrames.back() - 1);
+}
+
+/* This function moves the reader to the first frame of a chunk
+ *
+ * @param (int k) the chunk
+ */
+void TraceReader::enterChunk( int k ) {
+  chunk = k;
+  frameInChunk = 0;
+  size_t at = (size_t) chunkOffsets[k] + 4;
+  chunkEnd = (size_t) chunkOffsets[k] + CHUNK_HEADER_BYTES + get<uint32_t>( data, at );
+  cursor = (size_t) chunkOffsets[k] + CHUNK_HEADER_BYTES;
+}
+
+/* This function positions the reader so the next frame returned is the given step. It finds
+ * the chunk with a binary search over the index and decodes the frames before the step.
+ *
+ * @param (long step) the step to go to
+ */
+bool TraceReader::seek( long step ) {
+  if (chunkSteps.empty()) return false;
+  int k = (int) (upper_bound( chunkSteps.begin(), chunkSteps.end(), (uint64_t) max( step, 0L ) ) - chunkSteps.begin()) - 1;
+  if (k < 0) k = 0;
+  enterChunk( k );
+
+  traceFrame_t skipped;
+  while (frameInChunk < (int) chunkFrames[chunk] && (long) chunkSteps[chunk] + frameInChunk < step) {
+    if (!readFrame( skipped )) return false;
+  }
+  return true;
+}
+
+/* This function decodes the next frame. A frame whose counts or values run past the end of its
+ * chunk is taken as the end of the trace.
+ *
+ * @param (traceFrame_t& frame) receives the frame
+ */
+bool TraceReader::readFrame( traceFrame_t& frame ) {
+  if (chunk >= (int) chunkSteps.size()) return false;
+  if (frameInChunk >= (int) chunkFrames[chunk]) {
+    if (chunk + 1 >= (int) chunkSteps.size()) {
+      chunk++;
+      return false;
+    }
+    enterChunk( chunk + 1 );
+  }
+  bool keyframe = frameInChunk == 0;
+
+  size_t at = cursor;
+  int64_t step, n, contactCount;
+  if (!getVarint( data, at, chunkEnd, step ) || !getVarint( data, at, chunkEnd, n ) || !getVarint( data, at, chunkEnd, contactCount )) return false;
+  // Every value takes at least a byte, and every contact two
+  size_t valueBytes = flags & TRACE_QUANTIZED ? 1 : sizeof( double );
+  if (n < 0 || (uint64_t) n > (chunkEnd - at) / (4 * valueBytes)) return false;
+  if (contactCount < 0 || (uint64_t) contactCount > (chunkEnd - at - 4 * valueBytes * n) / 2) return false;
+  if ((flags & TRACE_QUANTIZED) && !keyframe && previous.size() != 4 * (size_t) n) return false;
+  frame.step = (long) step;
+  vector<double>* columns[4] = { &frame.x, &frame.y, &frame.dx, &frame.dy };
+
+  if (flags & TRACE_QUANTIZED) {
+    const double scales[4] = { positionScale, positionScale, velocityScale, velocityScale };
+    if (keyframe) previous.assign( 4 * (size_t) n, 0 );
+    for (int c = 0; c < 4; c++) {
+      vector<double>& column = *columns[c];
+      column.resize( n );
+      int64_t* prev = &previous[(size_t) c * n];
+      for (int i = 0; i < n; i++) {
+        int64_t delta;
+        if (!getVarint( data, at, chunkEnd, delta )) return false;
+        prev[i] += delta;
+        column[i] = prev[i] / scales[c];
+      }
+    }
+  } else {
+    for (int c = 0; c < 4; c++) {
+      columns[c]->resize( n );
+      memcpy( columns[c]->data(), data + at, sizeof( double ) * n );
+      at += sizeof( double ) * n;
+    }
+  }
+
+  frame.contactA.resize( contactCount );
+  frame.contactB.resize( contactCount );
+  int64_t lastA = 0;
+  for (int k = 0; k < contactCount; k++) {
+    int64_t a, b;
+    if (!getVarint( data, at, chunkEnd, a ) || !getVarint( data, at, chunkEnd, b )) return false;
+    // Both bodies are rows of this frame
+    if (a < 0 || a >= n - lastA || b < 0 || b >= n - lastA - a) return false;
+    lastA += a;
+    frame.contactA[k] = (int) lastA;
+    frame.contactB[k] = (int) (lastA + b);
+  }
+
+  cursor = at;
+  frameInChunk++;
+  return true;
+}
+
+/*End TraceReader-------------------------------------------------------*/
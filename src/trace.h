@@ -0,0 +1,127 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <stdio.h>
+#include <stdint.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "bodies.h"
+
+using namespace std;
+
+struct contact_t;
+
+#define TRACE_VERSION 1
+#define TRACE_QUANTIZED 1u         // Header flag: frames hold delta coded fixed point values instead of doubles
+#define TRACE_FRAMES_PER_CHUNK 64  // Default frames per chunk; seeking decodes at most one chunk
+#define TRACE_POSITION_SCALE 1048576.0   // Quantized position units per world unit (2^20)
+#define TRACE_VELOCITY_SCALE 1073741824.0 // Quantized velocity units per world unit per ms (2^30)
+
+/* Layout of a trace file (all values little endian):
+ *
+ *   header:  "BBTRACE\0", version, flags, position scale, velocity scale, frames per chunk,
+ *            body count, then radius and R, G, B of every body at the start of the recording
+ *   chunks:  "BBCK", payload bytes, first step, frame count, then the frames. The first frame
+ *            of a chunk is absolute; in quantized traces the others are deltas from the frame
+ *            before, as zigzag varints
+ *   index:   "BBIX", chunk count, then first step, file offset and frame count per chunk
+ *   footer:  index offset, "BBTREND\0"
+ *
+ * A trace cut short (eg by a crash) has no index; TraceReader then finds the chunks by
+ * walking them from the start of the file.
+ */
+
+struct traceFrame_t {
+  long step;
+  vector<double> x;
+  vector<double> y;
+  vector<double> dx;
+  vector<double> dy;
+  vector<int> contactA;  // Body rows of each contact, sorted by contactA then contactB
+  vector<int> contactB;
+};
+
+/* Appends the per-step state of a BodyStore to a trace file. Frames are encoded into an in
+ * memory chunk during record(); full chunks are handed to a background thread that writes
+ * them, so the step loop never waits on the disk.
+ */
+class TraceRecorder {
+  private:
+    FILE* file;
+    uint32_t flags;
+    int framesPerChunk;
+    vector<uint8_t> chunk;          // Frames of the chunk being filled
+    long chunkFirstStep;
+    int chunkFrames;
+    int chunkBodies;                // Body count of every frame in the current chunk
+    vector<int64_t> previous;       // Quantized x, y, dx, dy of the last frame, for delta coding
+    vector< pair<int, int> > pairs; // Scratch for sorting contacts
+    uint64_t offset;                // Bytes written or queued so far
+    vector<uint64_t> indexSteps;
+    vector<uint64_t> indexOffsets;
+    vector<uint32_t> indexFrames;
+
+    thread writer;
+    mutex queueLock;
+    condition_variable queueReady;
+    deque< vector<uint8_t> > queue;
+    bool closing;
+
+    void writerLoop();
+    void enqueue( vector<uint8_t>& bytes );
+    void flushChunk();
+
+  public:
+    TraceRecorder();
+    ~TraceRecorder();
+    bool open( const char* path, const BodyStore& bodies, bool quantized, int framesPerChunk = TRACE_FRAMES_PER_CHUNK );
+    void record( long step, const BodyStore& bodies, const vector<contact_t>& contacts );
+    void close(); // Write the last chunk and the index
+};
+
+/* Reads a trace file through a read only memory mapping. Frames are decoded straight from the
+ * mapped bytes; seek() uses the chunk index to start decoding from the chunk holding a step.
+ */
+class TraceReader {
+  private:
+    const uint8_t* data;
+    size_t size;
+    uint32_t flags;
+    double positionScale;
+    double velocityScale;
+    vector<uint64_t> chunkSteps;
+    vector<uint64_t> chunkOffsets;
+    vector<uint32_t> chunkFrames;
+    size_t cursor;                  // Offset of the next frame to decode
+    size_t chunkEnd;                // Offset of the end of the chunk holding the next frame
+    int chunk;                      // Chunk holding the next frame
+    int frameInChunk;
+    vector<int64_t> previous;
+
+    bool loadIndex();
+    void scanChunks();
+    void enterChunk( int k );
+
+  public:
+    vector<float> radius;           // Radius and color of each body when recording started
+    vector<color_t> color;
+
+    TraceReader();
+    ~TraceReader();
+    bool open( const char* path );
+    void close();
+    bool seek( long step );           // The next readFrame returns this step, or the first one after it
+    bool readFrame( traceFrame_t& frame ); // Decode the next frame; false at the end of the trace
+    long firstStep() const;
+    long lastStep() const;
+    int chunkCount() const { return (int) chunkSteps.size(); }
+    bool isQuantized() const { return (flags & TRACE_QUANTIZED) != 0; }
+};
+
+extern TraceRecorder* traceRecorder; // Receives every fixed step when not NULL
+
+#endif
@@ -0,0 +1,118 @@
+/*-------------------------------------------------------
+
+Implements the shared memory transport used by the
+processes of a domain decomposed run.
+
+---------------------------------------------------------*/
+
+#include "transport.h"
+#include <string.h>
+#include <new>
+#include <thread>
+#include <sys/mman.h>
+
+/*Begin SharedMemoryTransport-------------------------------------------------------*/
+
+/* The constructor for a SharedMemoryTransport. It maps the rings of every ordered pair of
+ * endpoints; the pages are only backed once something is written to them.
+ *
+ * @param (int endpoints) the number of endpoints
+ * @param (size_t ringBytes) the bytes each ring holds
+ */
+SharedMemoryTransport::SharedMemoryTransport( int endpoints, size_t ringBytes ) :
+count( endpoints ), me( 0 ), ringBytes( ringBytes ), mapped( NULL ) {
+  mappedBytes = (size_t) endpoints * endpoints * (sizeof( shmRing_t ) + ringBytes);
+  void* at = mmap( NULL, mappedBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0 );
+  if (at == MAP_FAILED) return;
+  mapped = (uint8_t*) at;
+  for (int from = 0; from < count; from++) {
+    for (int to = 0; to < count; to++) {
+      new (ring( from, to )) shmRing_t();
+      ring( from, to )->written.store( 0 );
+      ring( from, to )->read.store( 0 );
+    }
+  }
+}
+
+/* The destructor for a SharedMemoryTransport. Each process unmaps its own view.
+ */
+SharedMemoryTransport::~SharedMemoryTransport() {
+  if (mapped != NULL) munmap( mapped, mappedBytes );
+}
+
+/* This function streams bytes into a ring, waiting whenever it is full
+ *
+ * @param (shmRing_t* r) the ring
+ * @param (const uint8_t* bytes) the bytes
+ * @param (size_t size) how many
+ */
+void SharedMemoryTransport::write( shmRing_t* r, const uint8_t* bytes, size_t size ) {
+  uint8_t* data = (uint8_t*) (r + 1);
+  uint64_t written = r->written.load( memory_order_relaxed );
+  while (size > 0) {
+    size_t room = ringBytes - (size_t) (written - r->read.load( memory_order_acquire ));
+    if (room == 0) {
+      this_thread::yield();
+      continue;
+    }
+    size_t at = (size_t) (written % ringBytes);
+    size_t chunk = min( min( room, size ), ringBytes - at );
+    memcpy( data + at, bytes, chunk );
+    written += chunk;
+    r->written.store( written, memory_order_release );
+    bytes += chunk;
+    size -= chunk;
+  }
+}
+
+/* This function streams bytes out of a ring, waiting whenever it is empty
+ *
+ * @param (shmRing_t* r) the ring
+ * @param (uint8_t* bytes) where to put the bytes
+ * @param (size_t size) how many
+ */
+void SharedMemoryTransport::read( shmRing_t* r, uint8_t* bytes, size_t size ) {
+  const uint8_t* data = (const uint8_t*) (r + 1);
+  uint64_t read = r->read.load( memory_order_relaxed );
+  while (size > 0) {
+    size_t ready = (size_t) (r->written.load( memory_order_acquire ) - read);
+    if (ready == 0) {
+      this_thread::yield();
+      continue;
+    }
+    size_t at = (size_t) (read % ringBytes);
+    size_t chunk = min( min( ready, size ), ringBytes - at );
+    memcpy( bytes, data + at, chunk );
+    read += chunk;
+    r->read.store( read, memory_order_release );
+    bytes += chunk;
+    size -= chunk;
+  }
+}
+
+/* This function sends a message to another endpoint
+ *
+ * @param (int to) the endpoint
+ * @param (const vector<uint8_t>& message) the message
+ */
+void SharedMemoryTransport::send( int to, const vector<uint8_t>& message ) {
+  shmRing_t* r = ring( me, to );
+  uint64_t size = message.size();
+  write( r, (const uint8_t*) &size, sizeof( size ) );
+  write( r, message.data(), message.size() );
+}
+
+/* This function receives the next message from another endpoint
+ *
+ * @param (int from) the endpoint
+ * @param (vector<uint8_t>& message) receives the message
+ */
+void SharedMemoryTransport::receive( int from, vector<uint8_t>& message ) {
+  shmRing_t* r = ring( from, me );
+  uint64_t size;
+  read( r, (uint8_t*) &size, sizeof( size ) );
+  message.resize( (size_t) size );
+  read( r, message.data(), message.size() );
+}
+
+/*End SharedMemoryTransport-------------------------------------------------------*/
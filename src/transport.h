@@ -0,0 +1,64 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <vector>
+#include <atomic>
+#include <stdint.h>
+#include <stddef.h>
+
+using namespace std;
+
+#define TRANSPORT_RING_BYTES ( 1 << 22 ) // Bytes buffered from one endpoint to another before send() waits
+
+/* Moves whole messages between a fixed set of endpoints, numbered from 0, such as the processes
+ * of a domain decomposed run. Messages from one endpoint to another arrive in the order they
+ * were sent. send() may wait for the receiver to make room and receive() waits for a whole
+ * message, so two endpoints must agree on the order of their sends and receives.
+ */
+class Transport {
+  public:
+    virtual ~Transport() {}
+    virtual int endpoints() const = 0;
+    virtual int self() const = 0;                                      // Endpoint of the caller
+    virtual void send( int to, const vector<uint8_t>& message ) = 0;   // Queue a message for endpoint to
+    virtual void receive( int from, vector<uint8_t>& message ) = 0;    // Wait for the next message from endpoint from
+};
+
+// One direction between two endpoints: a single producer, single consumer byte ring
+struct shmRing_t {
+  atomic<uint64_t> written; // Bytes ever written; only the sender changes it
+  char pad[56];             // Keep the two counters on separate cache lines
+  atomic<uint64_t> read;    // Bytes ever read; only the receiver changes it
+  char pad2[56];
+};
+
+/* A Transport between processes forked from the one that created it. Every ordered pair of
+ * endpoints gets a byte ring in one shared anonymous mapping; a message is its length followed
+ * by its bytes, streamed through the ring, so messages may be larger than the ring. Waiting is
+ * done by yielding the CPU. Call bind() in each process after the fork.
+ */
+class SharedMemoryTransport : public Transport {
+  private:
+    int count;
+    int me;
+    size_t ringBytes;
+    size_t mappedBytes;
+    uint8_t* mapped;
+    SharedMemoryTransport( const SharedMemoryTransport& );
+
+    shmRing_t* ring( int from, int to ) const { return (shmRing_t*) (mapped + ((size_t) from * count + to) * (sizeof( shmRing_t ) + ringBytes)); }
+    void write( shmRing_t* r, const uint8_t* bytes, size_t size );
+    void read( shmRing_t* r, uint8_t* bytes, size_t size );
+
+  public:
+    SharedMemoryTransport( int endpoints, size_t ringBytes = TRANSPORT_RING_BYTES );
+    ~SharedMemoryTransport();
+    bool valid() const { return mapped != NULL; } // False if the shared mapping could not be made
+    void bind( int endpoint ) { me = endpoint; }  // Set the endpoint of the calling process
+    int endpoints() const { return count; }
+    int self() const { return me; }
+    void send( int to, const vector<uint8_t>& message );
+    void receive( int from, vector<uint8_t>& message );
+};
+
+#endif
@@ -0,0 +1,69 @@
+/*-------------------------------------------------------
+
+Implements World, which keeps the state of a simulation,
+and the per thread current world the simulation code
+works on.
+
+---------------------------------------------------------*/
+
+#include "world.h"
+
+World World::process( sleepSettings_t{false, SLEEP_SPEED, SLEEP_DELAY_MS}, 0 );
+thread_local World* World::current = &World::process;
+
+/*Begin World-------------------------------------------------------*/
+
+/* The constructor for the process's world and the one every World() delegates to. The world
+ * starts without bodies, at step 0, with the one empty trigger set every world has.
+ *
+ * @param (const sleepSettings_t& sleep) the sleep settings of the world
+ * @param (int substeps) its Collider::continuousSubsteps
+ */
+World::World( const sleepSettings_t& sleep, int substeps ) :
+scheduledSize( 0 ), scriptedVersion( 0 ), scheduledVersion( (unsigned long) -1 ),
+maxRadius( 0 ), sleepingMaxRadius( 0 ), sleepingVersion( (unsigned long) -1 ), pairTests( 0 ),
+triggerSets( 1 ), continuousSubsteps( substeps ), lastSubsteps( 0 ), sleepSettings( sleep ),
+sleepingBodies( 0 ), trackedVersion( (unsigned long) -1 ), trackedRows( 0 ), gameLoop(),
+previous( NULL ), entered( false ) {}
+
+/* The constructor for a World. The world starts without bodies, at step 0, with the sleep and
+ * continuous collision settings of the world current on the calling thread.
+ */
+World::World() : World( current->sleepSettings, current->continuousSubsteps ) {}
+
+/* The destructor for a World. It makes the world current one last time to delete its
+ * GameObjects and components, so their destructors see the state they belong to, then puts
+ * back the world that was current, or the one before enter() if this one was. The process's
+ * world is left as it is at exit, as before there were worlds.
+ */
+World::~World() {
+  if (this == &process) return;
+  World* after = current == this ? previous : current;
+  current = this;
+  for (int row = 0; row < bodyStore.size(); row++) bodyStore.removeLater( row );
+  Component::removeDestroyed();
+  current = after;
+  for (ArchetypeBase* instances: archetypes) delete instances;
+}
+
+/* This function makes this world the current one on the calling thread. Returns false,
+ * changing nothing, if it is already entered.
+ */
+bool World::enter() {
+  if (entered) return false;
+  previous = current;
+  current = this;
+  entered = true;
+  return true;
+}
+
+/* This function makes the world that was current before enter() current again on the calling
+ * thread.
+ */
+void World::leave() {
+  if (!entered) return;
+  current = previous;
+  entered = false;
+}
+
+/*End World-------------------------------------------------------*/
@@ -0,0 +1,135 @@
+#ifndef WORLD_H
+#define WORLD_H
+
+#include <vector>
+#include <unordered_map>
+#include "bodies.h"
+#include "broadphase.h"
+#include "sleep.h"
+#include "ODLGameLoop_private.h"
+
+using namespace std;
+
+// Included at the end of components.h, after Component, Collider and ArchetypeBase
+
+/* The state of one simulation: its bodies, GameObjects and components, the Collider's grids,
+ * contacts, trigger sets and collision history, its archetype instances, sleep state and step
+ * count.
+ *
+ * The simulation code reaches the state through accessors with the names it always had, such
+ * as bodyStore(), Collider::contacts() and odlGameLoopState(), which return the state of the
+ * current world. The current world is kept per thread: every thread starts in the process's
+ * own world, World::process, the one main() builds, and enter() makes another World current
+ * on the calling thread only. So any number of worlds can be kept in one process, and worlds
+ * entered on different threads are stepped at the same time without touching each other's
+ * state. jobPool runs each task in the world current where it was submitted.
+ *
+ * GameObjects must only be created, destroyed or touched on a thread where their world is
+ * current. Registered triggers, collision subscribers, jobPool and tracing are shared by
+ * every world.
+ */
+class World {
+  public:
+    BodyStore bodyStore;
+    vector<Component*> components;
+    vector<Component*> scriptedComponents;
+    vector<Component*> destroyQueue;
+    vector<Component::scriptRun_t> scriptRuns;
+    vector<int> runInstances;
+    size_t scheduledSize;
+    unsigned long scriptedVersion;
+    unsigned long scheduledVersion;
+    SpatialHash grid;
+    vector<int> indexed;
+    double maxRadius;
+    SpatialHash sleepingGrid;
+    vector<int> sleepingIndexed;
+    double sleepingMaxRadius;
+    unsigned long sleepingVersion;
+    SpatialHash recentGrid;
+    vector<int> recentIndexed;
+    vector< vector<contact_t> > chunkContacts;
+    vector<long> chunkPairTests;
+    vector<int> batchStart;
+    vector<contact_t> contacts;
+    long pairTests;
+    vector<contact_t> events;
+    vector<unsigned long long> touching;
+    vector< vector<triggerFunc> > triggerSets;
+    int continuousSubsteps;
+    int lastSubsteps;
+    vector<ArchetypeBase*> archetypes; // Instances of ArchetypeBase::registered[k] in archetypes[k], made on first use
+    sleepSettings_t sleepSettings;
+    int sleepingBodies;
+    vector<unsigned int> islandsToWake;
+    vector<int> sleepersToIndex;
+    vector<int> awakeList;
+    unordered_map< unsigned int, vector<int> > islandRows;
+    unsigned long trackedVersion;
+    int trackedRows;
+    ODLGameLoopState gameLoop;
+
+    static World process;                 // The process's own world
+    static thread_local World* current;   // The world current on this thread, process until enter()
+
+    World();                // An empty world with the sleep and continuous collision settings of the current one
+    ~World();               // Deletes its GameObjects, whichever world is current
+    bool enter();           // Make this world current on this thread; false if it is entered already
+    void leave();           // Make the world current before enter() current again
+
+  private:
+    World* previous;        // current before enter()
+    bool entered;
+
+    World( const sleepSettings_t& sleep, int substeps );
+    World( const World& );
+};
+
+// The state of the current world under the names the simulation code uses
+
+inline BodyStore& bodyStore() { return World::current->bodyStore; }
+inline ODLGameLoopState& odlGameLoopState() { return World::current->gameLoop; }
+inline sleepSettings_t& sleepSettings() { return World::current->sleepSettings; }
+inline int& sleepingBodies() { return World::current->sleepingBodies; }
+inline vector<int>& sleepersToIndex() { return World::current->sleepersToIndex; }
+
+inline vector<Component*>& Component::components() { return World::current->components; }
+inline vector<Component*>& Component::scriptedComponents() { return World::current->scriptedComponents; }
+inline vector<Component*>& Component::destroyQueue() { return World::current->destroyQueue; }
+inline vector<Component::scriptRun_t>& Component::scriptRuns() { return World::current->scriptRuns; }
+inline vector<int>& Component::runInstances() { return World::current->runInstances; }
+inline size_t& Component::scheduledSize() { return World::current->scheduledSize; }
+inline unsigned long& Component::scriptedVersion() { return World::current->scriptedVersion; }
+inline unsigned long& Component::scheduledVersion() { return World::current->scheduledVersion; }
+
+inline SpatialHash& Collider::grid() { return World::current->grid; }
+inline vector<int>& Collider::indexed() { return World::current->indexed; }
+inline double& Collider::maxRadius() { return World::current->maxRadius; }
+inline SpatialHash& Collider::sleepingGrid() { return World::current->sleepingGrid; }
+inline vector<int>& Collider::sleepingIndexed() { return World::current->sleepingIndexed; }
+inline double& Collider::sleepingMaxRadius() { return World::current->sleepingMaxRadius; }
+inline unsigned long& Collider::sleepingVersion() { return World::current->sleepingVersion; }
+inline SpatialHash& Collider::recentGrid() { return World::current->recentGrid; }
+inline vector<int>& Collider::recentIndexed() { return World::current->recentIndexed; }
+inline vector< vector<contact_t> >& Collider::chunkContacts() { return World::current->chunkContacts; }
+inline vector<long>& Collider::chunkPairTests() { return World::current->chunkPairTests; }
+inline vector<int>& Collider::batchStart() { return World::current->batchStart; }
+inline vector<contact_t>& Collider::contacts() { return World::current->contacts; }
+inline long& Collider::pairTests() { return World::current->pairTests; }
+inline vector<contact_t>& Collider::events() { return World::current->events; }
+inline vector<unsigned long long>& Collider::touching() { return World::current->touching; }
+inline vector< vector<triggerFunc> >& Collider::triggerSets() { return World::current->triggerSets; }
+inline int& Collider::continuousSubsteps() { return World::current->continuousSubsteps; }
+inline int& Collider::lastSubsteps() { return World::current->lastSubsteps; }
+
+inline ArchetypeBase* ArchetypeBase::instancesIn( int type ) {
+  vector<ArchetypeBase*>& archetypes = World::current->archetypes;
+  if (type >= (int) archetypes.size()) archetypes.resize( type + 1, NULL );
+  if (archetypes[type] == NULL) {
+    lock_guard<mutex> hold( registryLock );
+    archetypes[type] = registered[type]->create();
+  }
+  return archetypes[type];
+}
+
+#endif